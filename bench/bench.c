@@ -0,0 +1,246 @@
+/**
+ * Benchmarks for SquirrelDB C SDK
+ *
+ * Runs the client against an in-process loopback server that answers every
+ * request immediately, so the numbers measure SDK overhead (framing, JSON,
+ * pending-table bookkeeping, thread handoffs) rather than a database. The
+ * same workload drives the PGO training run (make pgo).
+ *
+ * Build: make bench
+ * Run: ./build/release/bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "squirreldb.h"
+#include "squirreldb/query.h"
+#include "squirreldb/metrics.h"
+#include "squirreldb/shard.h"
+#include "../tests/loopback.h"
+
+#define DEFAULT_ITERATIONS 20000
+#define PIPELINE_DEPTH     64
+#define MAX_SHARDS         16
+
+/* Harness */
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, int ops, double elapsed) {
+  printf("%-24s %8d ops %9.3f s %12.0f ops/s %9.2f us/op\n",
+         name, ops, elapsed, ops / elapsed, elapsed * 1e6 / ops);
+}
+
+static sqrl_client_t *connect_with(uint16_t port, const sqrl_options_t *opts) {
+  sqrl_client_t *client = NULL;
+  sqrl_error_t err = sqrl_connect(&client, "127.0.0.1", port, opts);
+  if (err != SQRL_OK) {
+    fprintf(stderr, "connect failed: %s\n", sqrl_error_string(err));
+    exit(1);
+  }
+  return client;
+}
+
+static sqrl_client_t *connect_client(uint16_t port, int batch_window_us) {
+  sqrl_options_t opts = sqrl_options_default();
+  opts.batch_window_us = batch_window_us;
+  return connect_with(port, &opts);
+}
+
+/* Benchmarks */
+
+static void bench_query_sync(uint16_t port, int iterations) {
+  sqrl_client_t *client = connect_client(port, 0);
+
+  double start = now_sec();
+  for (int i = 0; i < iterations; i++) {
+    char *result = NULL;
+    if (sqrl_query(client, "db.table(\"bench\").run()", &result) == SQRL_OK) sqrl_string_free(result);
+  }
+  report("query_sync", iterations, now_sec() - start);
+
+  sqrl_disconnect(client);
+}
+
+static void bench_insert_sync(const char *name, uint16_t port, int iterations, bool compact) {
+  sqrl_options_t opts = sqrl_options_default();
+  opts.compact_documents = compact;
+  sqrl_client_t *client = connect_with(port, &opts);
+
+  double start = now_sec();
+  for (int i = 0; i < iterations; i++) {
+    sqrl_document_t *doc = NULL;
+    if (sqrl_insert(client, "bench", "{\"n\":1,\"name\":\"squirrel\"}", &doc) == SQRL_OK) sqrl_document_free(doc);
+  }
+  report(name, iterations, now_sec() - start);
+
+  sqrl_disconnect(client);
+}
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int in_flight;
+  int completed;
+} pipeline_t;
+
+static void pipeline_done(sqrl_error_t err, char *result, void *user_data) {
+  pipeline_t *p = user_data;
+  (void)err;
+  sqrl_string_free(result);
+  pthread_mutex_lock(&p->mutex);
+  p->in_flight--;
+  p->completed++;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->mutex);
+}
+
+static void bench_query_pipeline(const char *name, uint16_t port, int iterations, int batch_window_us) {
+  sqrl_client_t *client = connect_client(port, batch_window_us);
+  pipeline_t p = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+
+  double start = now_sec();
+  for (int i = 0; i < iterations; i++) {
+    pthread_mutex_lock(&p.mutex);
+    while (p.in_flight >= PIPELINE_DEPTH) pthread_cond_wait(&p.cond, &p.mutex);
+    p.in_flight++;
+    pthread_mutex_unlock(&p.mutex);
+
+    if (sqrl_query_async(client, "db.table(\"bench\").run()", pipeline_done, &p) != SQRL_OK) {
+      pthread_mutex_lock(&p.mutex);
+      p.in_flight--;
+      p.completed++;
+      pthread_mutex_unlock(&p.mutex);
+    }
+  }
+  pthread_mutex_lock(&p.mutex);
+  while (p.completed < iterations) pthread_cond_wait(&p.cond, &p.mutex);
+  pthread_mutex_unlock(&p.mutex);
+  report(name, iterations, now_sec() - start);
+
+  sqrl_disconnect(client);
+}
+
+static void bench_query_builder(int iterations) {
+  double start = now_sec();
+  for (int i = 0; i < iterations; i++) {
+    sqrl_query_t *q = sqrl_table("users");
+    sqrl_find_gt(q, "age", 21);
+    sqrl_find_eq_str(q, "status", "active");
+    sqrl_sort(q, "name", SQRL_ASC);
+    sqrl_limit(q, 10);
+    free(sqrl_query_compile(q));
+    sqrl_query_free(q);
+  }
+  report("query_builder", iterations, now_sec() - start);
+}
+
+static void bench_metrics_render(uint16_t port, int iterations) {
+  sqrl_client_t *client = connect_client(port, 0);
+  char buf[16384];
+
+  double start = now_sec();
+  for (int i = 0; i < iterations; i++) {
+    size_t len;
+    sqrl_metrics_render(client, NULL, "bench=\"1\"", buf, sizeof(buf), &len);
+  }
+  report("metrics_render", iterations, now_sec() - start);
+
+  sqrl_disconnect(client);
+}
+
+typedef struct {
+  sqrl_shards_t *shards;
+  int index;
+  int iterations;
+  pthread_barrier_t *start;
+} shard_worker_t;
+
+static void *shard_worker(void *arg) {
+  shard_worker_t *w = arg;
+  sqrl_shards_attach(w->shards, w->index, true);
+  sqrl_client_t *client = sqrl_shard_client(w->shards);
+
+  pthread_barrier_wait(w->start);
+  for (int i = 0; i < w->iterations; i++) {
+    char *result = NULL;
+    if (sqrl_query(client, "db.table(\"bench\").run()", &result) == SQRL_OK) sqrl_string_free(result);
+  }
+  sqrl_shards_detach(w->shards);
+  return NULL;
+}
+
+/* Every shard runs the same sync workload; ops/s should grow with the
+ * shard count until the loopback server runs out of cores */
+static void bench_sharded_scaling(uint16_t port, int iterations) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_shards = cpus > MAX_SHARDS ? MAX_SHARDS : cpus > 0 ? (int)cpus : 1;
+
+  for (int n = 1; n <= max_shards; n = n < max_shards && n * 2 > max_shards ? max_shards : n * 2) {
+    sqrl_shards_t *shards = NULL;
+    if (sqrl_shards_connect(&shards, "127.0.0.1", port, NULL, n) != SQRL_OK) {
+      fprintf(stderr, "shard connect failed\n");
+      exit(1);
+    }
+
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, (unsigned)n + 1);
+    pthread_t threads[MAX_SHARDS];
+    shard_worker_t workers[MAX_SHARDS];
+    for (int i = 0; i < n; i++) {
+      workers[i] = (shard_worker_t){shards, i, iterations, &start};
+      pthread_create(&threads[i], NULL, shard_worker, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start);
+    double t0 = now_sec();
+    for (int i = 0; i < n; i++) pthread_join(threads[i], NULL);
+    double elapsed = now_sec() - t0;
+
+    char name[32];
+    snprintf(name, sizeof(name), "sharded_query_x%d", n);
+    report(name, iterations * n, elapsed);
+
+    pthread_barrier_destroy(&start);
+    sqrl_shards_disconnect(shards);
+  }
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+  if (iterations <= 0) iterations = DEFAULT_ITERATIONS;
+
+  loopback_t *server = loopback_start(NULL, NULL);
+  if (!server) {
+    fprintf(stderr, "failed to start loopback server\n");
+    return 1;
+  }
+  uint16_t port = loopback_port(server);
+
+  sqrl_init();
+  printf("SquirrelDB C SDK Benchmarks (%d iterations)\n", iterations);
+  printf("============================================\n");
+
+  bench_query_sync(port, iterations);
+  bench_insert_sync("insert_sync", port, iterations, false);
+  bench_insert_sync("insert_sync_compact", port, iterations, true);
+  bench_query_pipeline("query_pipeline", port, iterations, 0);
+  bench_query_pipeline("query_pipeline_batched", port, iterations, 200);
+  bench_query_builder(iterations * 10);
+  bench_metrics_render(port, iterations);
+  bench_sharded_scaling(port, iterations);
+
+  sqrl_cleanup();
+  loopback_stop(server);
+  return 0;
+}
@@ -100,7 +100,7 @@ int main(void) {
 
   /* Query documents */
   char *result = NULL;
-  err = sqrl_query(client, "db.table(\\\"users\\\").filter(u => u.active).run()", &result);
+  err = sqrl_query(client, "db.table(\"users\").filter(u => u.active).run()", &result);
   if (err == SQRL_OK) {
     printf("Active users: %s\n", result);
     sqrl_string_free(result);
@@ -127,7 +127,7 @@ int main(void) {
 
   sqrl_subscription_t *sub = NULL;
   err = sqrl_subscribe(client,
-    "db.table(\\\"users\\\").changes()",
+    "db.table(\"users\").changes()",
     change_callback, NULL, &sub);
   if (err != SQRL_OK) {
     fprintf(stderr, "Subscribe failed: %s\n", sqrl_error_string(err));
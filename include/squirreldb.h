@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -26,6 +27,9 @@ extern "C" {
 #define SQRL_MAX_MESSAGE_SIZE (16 * 1024 * 1024)
 #define SQRL_DEFAULT_PORT 8082
 
+/* Latency histograms: bucket i counts samples below 2^(i+1) microseconds */
+#define SQRL_LATENCY_BUCKETS 24
+
 /* Error codes */
 typedef enum {
   SQRL_OK = 0,
@@ -43,6 +47,9 @@ typedef enum {
   SQRL_ERR_DECODE = 12,
   SQRL_ERR_SERVER = 13,
   SQRL_ERR_NOT_FOUND = 14,
+  SQRL_ERR_OVERLOADED = 15,
+  SQRL_ERR_UNAVAILABLE = 16,
+  SQRL_ERR_CONFLICT = 17,
 } sqrl_error_t;
 
 /* Encoding formats */
@@ -62,6 +69,8 @@ typedef enum {
 /* Forward declarations */
 typedef struct sqrl_client sqrl_client_t;
 typedef struct sqrl_subscription sqrl_subscription_t;
+typedef struct sqrl_query sqrl_query_t;
+typedef struct sqrl_patch sqrl_patch_t;
 
 /* Document structure */
 typedef struct {
@@ -70,6 +79,10 @@ typedef struct {
   char *data;
   char *created_at;
   char *updated_at;
+  uint64_t version;          /* Bumped by every write, 0 if the server doesn't report it */
+  int64_t created_ns;        /* Unix epoch nanoseconds, 0 if absent or malformed */
+  int64_t updated_ns;
+  bool shared_collection;    /* collection is interned by the client, see compact_documents */
 } sqrl_document_t;
 
 /* Change event structure */
@@ -78,6 +91,8 @@ typedef struct {
   sqrl_document_t *document;
   sqrl_document_t *new_doc;
   char *old_data;
+  int64_t commit_time_us;    /* Server commit time, microseconds since the Unix epoch; 0 if not sent */
+  char *collection;          /* Collection the change happened in */
 } sqrl_change_event_t;
 
 /* Connection options */
@@ -86,14 +101,125 @@ typedef struct {
   bool use_msgpack;
   int connect_timeout_ms;
   int request_timeout_ms;
+  int batch_window_us;       /* Max write coalescing delay, 0 = send immediately */
+  size_t batch_max_bytes;    /* Flush a batch once this many bytes are queued */
+  double hedge_percentile;   /* Hedge sqrl_query() slower than this latency percentile, 0 = off */
+  int hedge_min_delay_ms;    /* Never hedge earlier than this */
+  const char *hedge_host;    /* Replica for hedged reads, NULL = same host */
+  uint16_t hedge_port;       /* 0 = same port */
+  int max_concurrency;       /* Ceiling for the adaptive in-flight limit, 0 = unlimited */
+  int breaker_threshold;     /* Consecutive failures that open the circuit, 0 = off */
+  int breaker_cooldown_ms;   /* Time the circuit stays open before probing */
+  bool lazy_connect;         /* Return from sqrl_connect() at once and connect in the background */
+  int connections;           /* Sockets requests are striped over, 1 = a single socket */
+  size_t bulk_threshold;     /* Requests and replies this large use a separate socket, 0 = off */
+  bool coalesce_reads;       /* Identical concurrent sqrl_query() calls share one round trip */
+  int result_cache_ttl_ms;   /* Cache sqrl_query() results this long, 0 = no result cache */
+  size_t result_cache_max_entries;
+  size_t result_cache_max_bytes;
+  int subscription_credits;  /* Change events outstanding per feed before the server pauses it, 0 = no flow control */
+  bool compact_documents;    /* Decode timestamps only into *_ns and share collection names, see below */
 } sqrl_options_t;
 
+/* Client statistics */
+typedef struct {
+  uint64_t frames_sent;
+  uint64_t bytes_sent;
+  uint64_t frames_received;
+  uint64_t bytes_received;
+  uint64_t requests_completed;
+  uint64_t requests_timed_out;
+  uint64_t latency_buckets[SQRL_LATENCY_BUCKETS];  /* Request round trips */
+  uint64_t latency_count;
+  uint64_t latency_sum_us;
+  uint64_t batches_flushed;
+  double avg_batch_frames;
+  uint64_t avg_batch_delay_us;
+  int batch_window_us;       /* Current adaptive batching window */
+  uint64_t hedges_sent;
+  uint64_t hedges_won;       /* Hedged reads answered first by the hedge */
+  int connections;           /* Open sockets, including the bulk one */
+  uint64_t bulk_requests;    /* Requests sent on the bulk socket */
+  uint64_t coalesced_queries; /* sqrl_query() calls answered by another call's reply */
+  uint64_t cache_hits;       /* sqrl_query() calls served from the result cache */
+  uint64_t cache_misses;
+  uint64_t cache_invalidations; /* Cached results dropped because their table changed */
+  int concurrency_limit;     /* Current adaptive limit, 0 when unlimited */
+  int in_flight;
+  uint64_t requests_rejected; /* Failed fast with OVERLOADED or UNAVAILABLE */
+  uint64_t breaker_opens;
+  bool breaker_open;
+} sqrl_stats_t;
+
+/* Latency histogram, bucketed like sqrl_stats_t.latency_buckets */
+typedef struct {
+  uint64_t buckets[SQRL_LATENCY_BUCKETS];
+  uint64_t count;
+  uint64_t sum_us;
+} sqrl_histogram_t;
+
+/* Change-feed lag of a subscription's feed. total and network only count
+ * events that carried a commit time; network is measured against the local
+ * wall clock, so it includes clock skew between client and server. */
+typedef struct {
+  uint64_t events;
+  sqrl_histogram_t total;    /* Commit to the last callback returning */
+  sqrl_histogram_t network;  /* Commit to receipt by the client */
+  sqrl_histogram_t queue;    /* Receipt to the first callback starting */
+  sqrl_histogram_t callback; /* Time spent in the callbacks */
+} sqrl_subscription_stats_t;
+
+/* Debug snapshot of an outstanding request */
+typedef struct {
+  char id[32];
+  char op[16];               /* Request type, e.g. "query" */
+  uint64_t age_us;           /* Time since the request was sent */
+  size_t bytes;              /* Request payload size */
+  bool async;
+} sqrl_pending_info_t;
+
+/* Debug snapshot of a subscription */
+typedef struct {
+  char id[32];               /* Server subscription id, shared by its handles */
+  int listeners;             /* sqrl_subscribe() handles sharing this feed */
+  uint64_t events_delivered;
+  size_t queue_depth;        /* Events queued for or running in the callback */
+  uint64_t last_event_age_us; /* 0 if no event has been delivered yet */
+  uint64_t callback_age_us;  /* How long the running callback has taken, 0 if idle */
+} sqrl_subscription_info_t;
+
+typedef struct {
+  sqrl_pending_info_t *pending;
+  size_t pending_count;
+  sqrl_subscription_info_t *subscriptions;
+  size_t subscription_count;
+} sqrl_debug_snapshot_t;
+
 /* Subscription callback */
 typedef void (*sqrl_change_callback_t)(
   const sqrl_change_event_t *event,
   void *user_data
 );
 
+/* Async completion callbacks
+ *
+ * Invoked exactly once, on the client's reader thread, when the server
+ * replies or the connection is lost. Ownership of result/doc passes to the
+ * callback (release with sqrl_string_free/sqrl_document_free); both are
+ * NULL when err != SQRL_OK.
+ */
+typedef void (*sqrl_result_callback_t)(
+  sqrl_error_t err,
+  char *result,
+  void *user_data
+);
+
+typedef void (*sqrl_document_callback_t)(
+  sqrl_error_t err,
+  sqrl_document_t *doc,
+  void *user_data
+);
+
 /* Initialization */
 sqrl_error_t sqrl_init(void);
 void sqrl_cleanup(void);
@@ -106,6 +232,41 @@ void sqrl_disconnect(sqrl_client_t *client);
 const char *sqrl_session_id(const sqrl_client_t *client);
 bool sqrl_is_connected(const sqrl_client_t *client);
 sqrl_error_t sqrl_ping(sqrl_client_t *client);
+sqrl_error_t sqrl_get_stats(const sqrl_client_t *client, sqrl_stats_t *stats_out);
+
+/* Connection striping
+ *
+ * With connections > 1 requests rotate over that many sockets, which share
+ * one table of outstanding requests, so a slow or large reply on one socket
+ * doesn't delay replies on the others. With bulk_threshold set, requests of
+ * at least that many bytes, and queries whose previous reply was at least
+ * that large, use a dedicated bulk socket. Subscriptions and write batching
+ * stay on the first socket. Requests on different sockets may be executed
+ * out of order, so wait for a write's reply before reading what it wrote.
+ */
+
+/* Compact documents
+ *
+ * Every document carries created_ns/updated_ns, decoded once from the
+ * server's RFC 3339 timestamps. With compact_documents set, the
+ * created_at/updated_at strings are left NULL and collection points at a
+ * name the client interns once per connection, so decoding a result's rows
+ * allocates nothing per row for either. Their collection is freed by
+ * sqrl_disconnect() and must not be read afterwards, though the documents
+ * can still be passed to sqrl_document_free().
+ */
+
+/* Lazy connections
+ *
+ * With lazy_connect set, sqrl_connect() returns a client that connects in
+ * the background; requests made meanwhile are queued and sent once the
+ * handshake completes, or fail with the connect error. sqrl_wait_connected()
+ * blocks until that happens (timeout_ms <= 0 waits indefinitely).
+ * sqrl_warmup() pings every client in parallel and waits for all replies,
+ * returning the first error.
+ */
+sqrl_error_t sqrl_wait_connected(sqrl_client_t *client, int timeout_ms);
+sqrl_error_t sqrl_warmup(sqrl_client_t *const *clients, size_t count);
 
 /* Document operations */
 sqrl_error_t sqrl_query(sqrl_client_t *client, const char *query, char **result_out);
@@ -114,11 +275,156 @@ sqrl_error_t sqrl_update(sqrl_client_t *client, const char *collection, const ch
 sqrl_error_t sqrl_delete(sqrl_client_t *client, const char *collection, const char *document_id, sqrl_document_t **doc_out);
 sqrl_error_t sqrl_list_collections(sqrl_client_t *client, char ***names_out, size_t *count_out);
 
-/* Subscriptions */
+/* Count how many documents match a query builder's filter, or whether any
+ * does, without transferring them. The query runs as if sqrl_count_mode()
+ * or sqrl_exists_mode() had been called, but the builder is left as it was
+ * and the caller still owns and frees it. A changes query is rejected with
+ * SQRL_ERR_INVALID_ARG. Runs through sqrl_query(), so the result cache and
+ * read coalescing apply. */
+sqrl_error_t sqrl_count(sqrl_client_t *client, sqrl_query_t *query, size_t *count_out);
+sqrl_error_t sqrl_exists(sqrl_client_t *client, sqrl_query_t *query, bool *found_out);
+
+/* Optimistic concurrency
+ *
+ * sqrl_update_if() applies only while the stored document's version still
+ * equals version (as read from sqrl_document_t.version) and otherwise fails
+ * with SQRL_ERR_CONFLICT. On a conflict, doc_out receives the current
+ * document when the server sends it, so a read-modify-write loop can retry
+ * straight away. sqrl_upsert() replaces the document, creating it under
+ * document_id if it doesn't exist.
+ */
+sqrl_error_t sqrl_update_if(sqrl_client_t *client, const char *collection, const char *document_id, const char *data, uint64_t version, sqrl_document_t **doc_out);
+sqrl_error_t sqrl_upsert(sqrl_client_t *client, const char *collection, const char *document_id, const char *data, sqrl_document_t **doc_out);
+
+/* Apply a patch built with squirreldb/patch.h to one document. Only the
+ * operations cross the wire and the server applies them atomically, so
+ * counters and flags need no prior read. The caller still owns and frees
+ * the patch. */
+sqrl_error_t sqrl_update_patch(sqrl_client_t *client, const char *collection, const char *document_id, const sqrl_patch_t *patch, sqrl_document_t **doc_out);
+
+/* Bulk writes
+ *
+ * Delete, or apply a patch to, every document matching a query builder's
+ * filter in one request, executed entirely by the server. Sort and limit
+ * narrow the set as they would for a read, e.g. to delete the oldest N.
+ * count_out (can be NULL) receives the number of documents affected. The
+ * caller still owns and frees the query and patch. A builder without a
+ * table name fails with SQRL_ERR_INVALID_ARG.
+ */
+sqrl_error_t sqrl_delete_where(sqrl_client_t *client, sqrl_query_t *query, size_t *count_out);
+sqrl_error_t sqrl_update_where(sqrl_client_t *client, sqrl_query_t *query, const sqrl_patch_t *patch, size_t *count_out);
+
+/* Client-generated ids
+ *
+ * sqrl_generate_id() writes a UUIDv7 string: ids from one thread sort in
+ * the order they were generated, and ids from any thread sort by
+ * millisecond. sqrl_insert_ack() inserts under such an id, returned in
+ * id_out before the server is involved, and waits only as long as ack
+ * asks for: SQRL_ACK_DURABLE until the document is stored, SQRL_ACK_QUEUED
+ * until the server has accepted the write, SQRL_ACK_NONE not at all (the
+ * frame is written and the server sends no reply, so errors after that
+ * point go unreported).
+ */
+#define SQRL_ID_SIZE 37  /* Text form plus NUL */
+
+typedef enum {
+  SQRL_ACK_DURABLE = 0,
+  SQRL_ACK_QUEUED = 1,
+  SQRL_ACK_NONE = 2,
+} sqrl_ack_t;
+
+void sqrl_generate_id(char id_out[SQRL_ID_SIZE]);
+sqrl_error_t sqrl_insert_ack(sqrl_client_t *client, const char *collection, const char *data, sqrl_ack_t ack, char id_out[SQRL_ID_SIZE]);
+
+/* Result cache
+ *
+ * With result_cache_ttl_ms set, sqrl_query() results are cached in the
+ * client, keyed by the query text with insignificant whitespace removed
+ * (sqrl_query_compile_structured() output caches well). The first cached
+ * query on a table subscribes to that table's changes; any change, and any
+ * write through this client, drops the table's cached results. Results also
+ * expire after the TTL. Queries without a table are never cached.
+ */
+sqrl_error_t sqrl_result_cache_flush(sqrl_client_t *client);
+
+/* Multi-query
+ *
+ * sqrl_query_many() sends count queries in one frame and waits for the one
+ * reply, so independent reads cost a single round trip. results_out must
+ * hold count entries; each gets its own error and, on success, its result
+ * (release with sqrl_query_results_free). The return value is SQRL_OK when
+ * the batch made the round trip, even if some queries in it failed; on any
+ * other return every entry carries that error. Batches bypass the result
+ * cache and read coalescing.
+ */
+typedef struct {
+  sqrl_error_t error;
+  char *result;
+} sqrl_query_result_t;
+
+sqrl_error_t sqrl_query_many(sqrl_client_t *client, const char *const *queries, size_t count, sqrl_query_result_t *results_out);
+void sqrl_query_results_free(sqrl_query_result_t *results, size_t count);
+
+/* Async document operations
+ *
+ * Return once the request is queued. On a non-OK return the callback is
+ * never invoked.
+ */
+sqrl_error_t sqrl_query_async(sqrl_client_t *client, const char *query, sqrl_result_callback_t callback, void *user_data);
+sqrl_error_t sqrl_insert_async(sqrl_client_t *client, const char *collection, const char *data, sqrl_document_callback_t callback, void *user_data);
+sqrl_error_t sqrl_update_async(sqrl_client_t *client, const char *collection, const char *document_id, const char *data, sqrl_document_callback_t callback, void *user_data);
+sqrl_error_t sqrl_delete_async(sqrl_client_t *client, const char *collection, const char *document_id, sqrl_document_callback_t callback, void *user_data);
+
+/* Subscriptions
+ *
+ * Handles whose queries differ only in insignificant whitespace share one
+ * server feed. A handle joining a feed that includes initial documents is
+ * replayed the feed's current documents as SQRL_CHANGE_INITIAL events, on
+ * the calling thread, before sqrl_subscribe() returns; changes that arrive
+ * meanwhile follow in order. A feed whose result set grows past 1 MiB stops
+ * being shared, and later handles open their own. sqrl_subscription_id()
+ * returns the shared server id.
+ *
+ * Callbacks normally run on the reader thread. With subscription_credits
+ * set they run on a dispatcher thread instead, and each feed has at most
+ * that many events in flight: the client grants more as callbacks return,
+ * so a slow callback pauses its feed at the server. Callbacks for all feeds
+ * share the dispatcher thread. Unsubscribing discards undelivered events.
+ *
+ * A callback may call sqrl_unsubscribe() on any handle, its own included:
+ * the handle stops receiving events at once and the server feed is closed
+ * without waiting for the reply. Without subscription_credits, callbacks
+ * must not make other blocking calls on the client, because the reply
+ * could only be read by the thread that is waiting for it.
+ */
 sqrl_error_t sqrl_subscribe(sqrl_client_t *client, const char *query, sqrl_change_callback_t callback, void *user_data, sqrl_subscription_t **sub_out);
+
+/* Subscribe with a query builder (squirreldb/query.h). The filters and any
+ * sqrl_select() projection are evaluated by the server, so only matching
+ * documents, trimmed to the selected fields, cross the wire. The query is
+ * sent as a changes query whether or not sqrl_changes() was called on it;
+ * the builder is left as it was, and the caller still owns and frees it. */
+sqrl_error_t sqrl_subscribe_query(sqrl_client_t *client, sqrl_query_t *query, sqrl_change_callback_t callback, void *user_data, sqrl_subscription_t **sub_out);
+
+/* Subscribe to every change in a set of collections as one ordered stream;
+ * use event->collection to tell them apart. count == 0, or a "*" entry,
+ * covers all collections. */
+sqrl_error_t sqrl_subscribe_collections(sqrl_client_t *client, const char *const *collections, size_t count, sqrl_change_callback_t callback, void *user_data, sqrl_subscription_t **sub_out);
 sqrl_error_t sqrl_unsubscribe(sqrl_subscription_t *sub);
 const char *sqrl_subscription_id(const sqrl_subscription_t *sub);
 
+/* Lag statistics of the feed behind sub, shared by every handle on it */
+sqrl_error_t sqrl_subscription_get_stats(const sqrl_subscription_t *sub, sqrl_subscription_stats_t *stats_out);
+
+/* Debugging
+ *
+ * Safe to call from any thread while traffic is flowing; release a
+ * snapshot with sqrl_debug_snapshot_free().
+ */
+sqrl_error_t sqrl_debug_snapshot(sqrl_client_t *client, sqrl_debug_snapshot_t *snapshot_out);
+void sqrl_debug_snapshot_free(sqrl_debug_snapshot_t *snapshot);
+sqrl_error_t sqrl_debug_dump(sqrl_client_t *client, FILE *out);
+
 /* Memory management */
 void sqrl_document_free(sqrl_document_t *doc);
 void sqrl_change_event_free(sqrl_change_event_t *event);
@@ -0,0 +1,489 @@
+/**
+ * SquirrelDB C++ Client SDK
+ *
+ * Header-only C++20 layer over the C API: move-only RAII handles,
+ * std::string_view accessors that point into SDK-owned buffers, and
+ * co_await-able operations built on the async C calls.
+ *
+ * Example:
+ *   sqrl::client db = sqrl::client::connect("localhost");
+ *   sqrl::result users = db.query("db.table(\"users\").run()");
+ *   std::string_view json = users.json();
+ *
+ *   sqrl::task handler(sqrl::client &db) {
+ *     sqrl::document doc = co_await db.insert_async("users", "{\"name\":\"Alice\"}");
+ *     std::string_view id = doc.id();
+ *   }
+ *
+ * Awaited operations resume on the client's reader thread. Failures are
+ * reported by throwing sqrl::error.
+ */
+
+#ifndef SQUIRRELDB_HPP
+#define SQUIRRELDB_HPP
+
+#include "squirreldb.h"
+#include "squirreldb/query.h"
+#include "squirreldb/patch.h"
+
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace sqrl {
+
+/* Error carrying the C error code */
+class error : public std::runtime_error {
+ public:
+  explicit error(sqrl_error_t code) : std::runtime_error(sqrl_error_string(code)), code_(code) {}
+  sqrl_error_t code() const noexcept { return code_; }
+
+ private:
+  sqrl_error_t code_;
+};
+
+inline void check(sqrl_error_t err) {
+  if (err != SQRL_OK) throw error(err);
+}
+
+namespace detail {
+
+inline std::string_view view(const char *s) noexcept {
+  return s ? std::string_view(s) : std::string_view();
+}
+
+}  // namespace detail
+
+/* Owned result JSON returned by a query */
+class result {
+ public:
+  result() noexcept = default;
+  explicit result(char *json) noexcept : json_(json) {}
+  result(result &&other) noexcept : json_(std::exchange(other.json_, nullptr)) {}
+  result &operator=(result &&other) noexcept {
+    if (this != &other) {
+      sqrl_string_free(json_);
+      json_ = std::exchange(other.json_, nullptr);
+    }
+    return *this;
+  }
+  result(const result &) = delete;
+  result &operator=(const result &) = delete;
+  ~result() { sqrl_string_free(json_); }
+
+  std::string_view json() const noexcept { return detail::view(json_); }
+  const char *c_str() const noexcept { return json_; }
+  explicit operator bool() const noexcept { return json_ != nullptr; }
+  char *release() noexcept { return std::exchange(json_, nullptr); }
+
+ private:
+  char *json_ = nullptr;
+};
+
+/* Owned document */
+class document {
+ public:
+  document() noexcept = default;
+  explicit document(sqrl_document_t *doc) noexcept : doc_(doc) {}
+  document(document &&other) noexcept : doc_(std::exchange(other.doc_, nullptr)) {}
+  document &operator=(document &&other) noexcept {
+    if (this != &other) {
+      sqrl_document_free(doc_);
+      doc_ = std::exchange(other.doc_, nullptr);
+    }
+    return *this;
+  }
+  document(const document &) = delete;
+  document &operator=(const document &) = delete;
+  ~document() { sqrl_document_free(doc_); }
+
+  std::string_view id() const noexcept { return doc_ ? detail::view(doc_->id) : std::string_view(); }
+  std::string_view collection() const noexcept { return doc_ ? detail::view(doc_->collection) : std::string_view(); }
+  std::string_view data() const noexcept { return doc_ ? detail::view(doc_->data) : std::string_view(); }
+  std::string_view created_at() const noexcept { return doc_ ? detail::view(doc_->created_at) : std::string_view(); }
+  std::string_view updated_at() const noexcept { return doc_ ? detail::view(doc_->updated_at) : std::string_view(); }
+  uint64_t version() const noexcept { return doc_ ? doc_->version : 0; }
+  int64_t created_ns() const noexcept { return doc_ ? doc_->created_ns : 0; }
+  int64_t updated_ns() const noexcept { return doc_ ? doc_->updated_ns : 0; }
+
+  const sqrl_document_t *get() const noexcept { return doc_; }
+  explicit operator bool() const noexcept { return doc_ != nullptr; }
+  sqrl_document_t *release() noexcept { return std::exchange(doc_, nullptr); }
+
+ private:
+  sqrl_document_t *doc_ = nullptr;
+};
+
+/* Query builder */
+class query {
+ public:
+  explicit query(const char *table) : q_(sqrl_table(table)) {
+    if (!q_) throw error(SQRL_ERR_MEMORY);
+  }
+  query(query &&other) noexcept : q_(std::exchange(other.q_, nullptr)) {}
+  query &operator=(query &&other) noexcept {
+    if (this != &other) {
+      sqrl_query_free(q_);
+      q_ = std::exchange(other.q_, nullptr);
+    }
+    return *this;
+  }
+  query(const query &) = delete;
+  query &operator=(const query &) = delete;
+  ~query() { sqrl_query_free(q_); }
+
+  query &find_eq(const char *field, const char *value) { sqrl_find_eq_str(q_, field, value); return *this; }
+  query &find_eq(const char *field, long value) { sqrl_find_eq_int(q_, field, value); return *this; }
+  query &find_eq(const char *field, double value) { sqrl_find_eq_double(q_, field, value); return *this; }
+  query &find_eq(const char *field, bool value) { sqrl_find_eq_bool(q_, field, value); return *this; }
+  query &find_ne(const char *field, const char *value) { sqrl_find_ne_str(q_, field, value); return *this; }
+  query &find_ne(const char *field, long value) { sqrl_find_ne_int(q_, field, value); return *this; }
+  query &find_gt(const char *field, double value) { sqrl_find_gt(q_, field, value); return *this; }
+  query &find_gte(const char *field, double value) { sqrl_find_gte(q_, field, value); return *this; }
+  query &find_lt(const char *field, double value) { sqrl_find_lt(q_, field, value); return *this; }
+  query &find_lte(const char *field, double value) { sqrl_find_lte(q_, field, value); return *this; }
+  query &find_contains(const char *field, const char *value) { sqrl_find_contains(q_, field, value); return *this; }
+  query &find_starts_with(const char *field, const char *value) { sqrl_find_starts_with(q_, field, value); return *this; }
+  query &find_ends_with(const char *field, const char *value) { sqrl_find_ends_with(q_, field, value); return *this; }
+  query &find_exists(const char *field, bool exists = true) { sqrl_find_exists(q_, field, exists); return *this; }
+  query &sort(const char *field, sqrl_sort_dir_t direction = SQRL_ASC) { sqrl_sort(q_, field, direction); return *this; }
+  query &limit(size_t n) { sqrl_limit(q_, n); return *this; }
+  query &skip(size_t n) { sqrl_skip(q_, n); return *this; }
+  query &changes() { sqrl_changes(q_); return *this; }
+  query &select(const char *field) { sqrl_select(q_, field); return *this; }
+  query &include_initial(bool include = true) { sqrl_include_initial(q_, include); return *this; }
+  query &count_mode() { sqrl_count_mode(q_); return *this; }
+  query &exists_mode() { sqrl_exists_mode(q_); return *this; }
+
+  /* Compiled JS query string, ready for client::query() */
+  result compile() const { return compiled(sqrl_query_compile(q_)); }
+  result compile_structured() const { return compiled(sqrl_query_compile_structured(q_)); }
+
+  sqrl_query_t *get() const noexcept { return q_; }
+
+ private:
+  static result compiled(char *s) {
+    if (!s) throw error(SQRL_ERR_ENCODE);
+    return result(s);
+  }
+
+  sqrl_query_t *q_;
+};
+
+/* Patch builder */
+class patch {
+ public:
+  patch() : p_(sqrl_patch_new()) {
+    if (!p_) throw error(SQRL_ERR_MEMORY);
+  }
+  patch(patch &&other) noexcept : p_(std::exchange(other.p_, nullptr)) {}
+  patch &operator=(patch &&other) noexcept {
+    if (this != &other) {
+      sqrl_patch_free(p_);
+      p_ = std::exchange(other.p_, nullptr);
+    }
+    return *this;
+  }
+  patch(const patch &) = delete;
+  patch &operator=(const patch &) = delete;
+  ~patch() { sqrl_patch_free(p_); }
+
+  patch &set(const char *field, const char *value) { sqrl_patch_set_str(p_, field, value); return *this; }
+  patch &set(const char *field, long value) { sqrl_patch_set_int(p_, field, value); return *this; }
+  patch &set(const char *field, double value) { sqrl_patch_set_double(p_, field, value); return *this; }
+  patch &set(const char *field, bool value) { sqrl_patch_set_bool(p_, field, value); return *this; }
+  patch &set_json(const char *field, const char *json) { sqrl_patch_set_json(p_, field, json); return *this; }
+  patch &unset(const char *field) { sqrl_patch_unset(p_, field); return *this; }
+  patch &inc(const char *field, long delta = 1) { sqrl_patch_inc_int(p_, field, delta); return *this; }
+  patch &inc(const char *field, double delta) { sqrl_patch_inc_double(p_, field, delta); return *this; }
+  patch &push(const char *field, const char *value) { sqrl_patch_push_str(p_, field, value); return *this; }
+  patch &push(const char *field, long value) { sqrl_patch_push_int(p_, field, value); return *this; }
+  patch &push_json(const char *field, const char *json) { sqrl_patch_push_json(p_, field, json); return *this; }
+  patch &pull(const char *field, const char *value) { sqrl_patch_pull_str(p_, field, value); return *this; }
+  patch &pull(const char *field, long value) { sqrl_patch_pull_int(p_, field, value); return *this; }
+  patch &pull_json(const char *field, const char *json) { sqrl_patch_pull_json(p_, field, json); return *this; }
+
+  sqrl_patch_t *get() const noexcept { return p_; }
+
+ private:
+  sqrl_patch_t *p_;
+};
+
+/* Change subscription; unsubscribes when destroyed */
+class subscription {
+ public:
+  using handler = std::function<void(const sqrl_change_event_t &)>;
+
+  subscription() noexcept = default;
+  subscription(subscription &&other) noexcept
+    : sub_(std::exchange(other.sub_, nullptr)), handler_(std::move(other.handler_)) {}
+  subscription &operator=(subscription &&other) noexcept {
+    if (this != &other) {
+      reset();
+      sub_ = std::exchange(other.sub_, nullptr);
+      handler_ = std::move(other.handler_);
+    }
+    return *this;
+  }
+  subscription(const subscription &) = delete;
+  subscription &operator=(const subscription &) = delete;
+  ~subscription() { reset(); }
+
+  std::string_view id() const noexcept { return detail::view(sqrl_subscription_id(sub_)); }
+  explicit operator bool() const noexcept { return sub_ != nullptr; }
+
+  void reset() noexcept {
+    if (sub_) sqrl_unsubscribe(std::exchange(sub_, nullptr));
+    handler_.reset();
+  }
+
+ private:
+  friend class client;
+
+  static void dispatch(const sqrl_change_event_t *event, void *user_data) {
+    (*static_cast<handler *>(user_data))(*event);
+  }
+
+  sqrl_subscription_t *sub_ = nullptr;
+  std::unique_ptr<handler> handler_;
+};
+
+namespace detail {
+
+/* Shared await machinery: the C callback stores the outcome and resumes the
+ * suspended coroutine. await_suspend must not touch *this once the request
+ * is submitted, as the callback may already have run on the reader thread. */
+template <typename Value, typename Raw, typename Derived>
+class awaitable {
+ public:
+  bool await_ready() const noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    sqrl_error_t err = static_cast<Derived *>(this)->submit();
+    if (err != SQRL_OK) {
+      err_ = err;
+      return false;
+    }
+    return true;
+  }
+
+  Value await_resume() {
+    check(err_);
+    return Value(std::exchange(raw_, nullptr));
+  }
+
+ protected:
+  static void on_complete(sqrl_error_t err, Raw *raw, void *user_data) {
+    auto *self = static_cast<awaitable *>(user_data);
+    self->err_ = err;
+    self->raw_ = raw;
+    self->handle_.resume();
+  }
+
+ private:
+  std::coroutine_handle<> handle_;
+  sqrl_error_t err_ = SQRL_OK;
+  Raw *raw_ = nullptr;
+};
+
+}  // namespace detail
+
+class query_awaitable : public detail::awaitable<result, char, query_awaitable> {
+ public:
+  query_awaitable(sqrl_client_t *client, const char *query) noexcept : client_(client), query_(query) {}
+  sqrl_error_t submit() { return sqrl_query_async(client_, query_, &on_complete, this); }
+
+ private:
+  sqrl_client_t *client_;
+  const char *query_;
+};
+
+class insert_awaitable : public detail::awaitable<document, sqrl_document_t, insert_awaitable> {
+ public:
+  insert_awaitable(sqrl_client_t *client, const char *collection, const char *data) noexcept
+    : client_(client), collection_(collection), data_(data) {}
+  sqrl_error_t submit() { return sqrl_insert_async(client_, collection_, data_, &on_complete, this); }
+
+ private:
+  sqrl_client_t *client_;
+  const char *collection_;
+  const char *data_;
+};
+
+class update_awaitable : public detail::awaitable<document, sqrl_document_t, update_awaitable> {
+ public:
+  update_awaitable(sqrl_client_t *client, const char *collection, const char *document_id, const char *data) noexcept
+    : client_(client), collection_(collection), document_id_(document_id), data_(data) {}
+  sqrl_error_t submit() { return sqrl_update_async(client_, collection_, document_id_, data_, &on_complete, this); }
+
+ private:
+  sqrl_client_t *client_;
+  const char *collection_;
+  const char *document_id_;
+  const char *data_;
+};
+
+class remove_awaitable : public detail::awaitable<document, sqrl_document_t, remove_awaitable> {
+ public:
+  remove_awaitable(sqrl_client_t *client, const char *collection, const char *document_id) noexcept
+    : client_(client), collection_(collection), document_id_(document_id) {}
+  sqrl_error_t submit() { return sqrl_delete_async(client_, collection_, document_id_, &on_complete, this); }
+
+ private:
+  sqrl_client_t *client_;
+  const char *collection_;
+  const char *document_id_;
+};
+
+/* Client connection */
+class client {
+ public:
+  static client connect(const char *host, uint16_t port = SQRL_DEFAULT_PORT, const sqrl_options_t *options = nullptr) {
+    sqrl_client_t *c = nullptr;
+    check(sqrl_connect(&c, host, port, options));
+    return client(c);
+  }
+
+  explicit client(sqrl_client_t *c) noexcept : c_(c) {}
+  client(client &&other) noexcept : c_(std::exchange(other.c_, nullptr)) {}
+  client &operator=(client &&other) noexcept {
+    if (this != &other) {
+      sqrl_disconnect(c_);
+      c_ = std::exchange(other.c_, nullptr);
+    }
+    return *this;
+  }
+  client(const client &) = delete;
+  client &operator=(const client &) = delete;
+  ~client() { sqrl_disconnect(c_); }
+
+  std::string_view session_id() const noexcept { return detail::view(sqrl_session_id(c_)); }
+  bool connected() const noexcept { return sqrl_is_connected(c_); }
+  sqrl_client_t *get() const noexcept { return c_; }
+
+  /* Blocking operations */
+
+  result query(const char *q) {
+    char *out = nullptr;
+    check(sqrl_query(c_, q, &out));
+    return result(out);
+  }
+
+  document insert(const char *collection, const char *data) {
+    sqrl_document_t *doc = nullptr;
+    check(sqrl_insert(c_, collection, data, &doc));
+    return document(doc);
+  }
+
+  document update(const char *collection, const char *document_id, const char *data) {
+    sqrl_document_t *doc = nullptr;
+    check(sqrl_update(c_, collection, document_id, data, &doc));
+    return document(doc);
+  }
+
+  /* Returns false on a version conflict, with current holding the
+   * server's copy when it sent one */
+  bool update_if(const char *collection, const char *document_id, const char *data, uint64_t version, document &current) {
+    sqrl_document_t *doc = nullptr;
+    sqrl_error_t err = sqrl_update_if(c_, collection, document_id, data, version, &doc);
+    current = document(doc);
+    if (err == SQRL_ERR_CONFLICT) return false;
+    check(err);
+    return true;
+  }
+
+  document upsert(const char *collection, const char *document_id, const char *data) {
+    sqrl_document_t *doc = nullptr;
+    check(sqrl_upsert(c_, collection, document_id, data, &doc));
+    return document(doc);
+  }
+
+  document update(const char *collection, const char *document_id, const sqrl::patch &p) {
+    sqrl_document_t *doc = nullptr;
+    check(sqrl_update_patch(c_, collection, document_id, p.get(), &doc));
+    return document(doc);
+  }
+
+  size_t count(sqrl::query &q) {
+    size_t n = 0;
+    check(sqrl_count(c_, q.get(), &n));
+    return n;
+  }
+
+  bool exists(sqrl::query &q) {
+    bool found = false;
+    check(sqrl_exists(c_, q.get(), &found));
+    return found;
+  }
+
+  size_t remove(sqrl::query &q) {
+    size_t count = 0;
+    check(sqrl_delete_where(c_, q.get(), &count));
+    return count;
+  }
+
+  size_t update(sqrl::query &q, const sqrl::patch &p) {
+    size_t count = 0;
+    check(sqrl_update_where(c_, q.get(), p.get(), &count));
+    return count;
+  }
+
+  document remove(const char *collection, const char *document_id) {
+    sqrl_document_t *doc = nullptr;
+    check(sqrl_delete(c_, collection, document_id, &doc));
+    return document(doc);
+  }
+
+  subscription subscribe(const char *q, subscription::handler on_change) {
+    subscription sub;
+    sub.handler_ = std::make_unique<subscription::handler>(std::move(on_change));
+    check(sqrl_subscribe(c_, q, &subscription::dispatch, sub.handler_.get(), &sub.sub_));
+    return sub;
+  }
+
+  /* Filtered and projected on the server; see sqrl_subscribe_query() */
+  subscription subscribe(sqrl::query &q, subscription::handler on_change) {
+    subscription sub;
+    sub.handler_ = std::make_unique<subscription::handler>(std::move(on_change));
+    check(sqrl_subscribe_query(c_, q.get(), &subscription::dispatch, sub.handler_.get(), &sub.sub_));
+    return sub;
+  }
+
+  /* Awaitable operations; string arguments must outlive the co_await */
+
+  query_awaitable query_async(const char *q) noexcept { return query_awaitable(c_, q); }
+  insert_awaitable insert_async(const char *collection, const char *data) noexcept {
+    return insert_awaitable(c_, collection, data);
+  }
+  update_awaitable update_async(const char *collection, const char *document_id, const char *data) noexcept {
+    return update_awaitable(c_, collection, document_id, data);
+  }
+  remove_awaitable remove_async(const char *collection, const char *document_id) noexcept {
+    return remove_awaitable(c_, collection, document_id);
+  }
+
+ private:
+  sqrl_client_t *c_;
+};
+
+/* Minimal fire-and-forget coroutine type for awaiting SDK operations.
+ * Exceptions escaping the coroutine terminate the program. */
+struct task {
+  struct promise_type {
+    task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+}  // namespace sqrl
+
+#endif /* SQUIRRELDB_HPP */
@@ -37,6 +37,19 @@ typedef struct {
   int timeout_ms;
 } sqrl_cache_options_t;
 
+/* Cache statistics */
+#define SQRL_CACHE_LATENCY_BUCKETS 24  /* Bucket i counts commands below 2^(i+1) microseconds */
+
+typedef struct {
+  uint64_t commands;
+  uint64_t errors;          /* Transport failures and server error replies */
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t latency_buckets[SQRL_CACHE_LATENCY_BUCKETS];
+  uint64_t latency_count;
+  uint64_t latency_sum_us;
+} sqrl_cache_stats_t;
+
 /* Initialization */
 sqrl_cache_options_t sqrl_cache_options_default(void);
 const char *sqrl_cache_error_string(sqrl_cache_error_t err);
@@ -44,6 +57,7 @@ const char *sqrl_cache_error_string(sqrl_cache_error_t err);
 /* Connection */
 sqrl_cache_error_t sqrl_cache_connect(sqrl_cache_t **cache_out, const sqrl_cache_options_t *options);
 void sqrl_cache_disconnect(sqrl_cache_t *cache);
+sqrl_cache_error_t sqrl_cache_get_stats(const sqrl_cache_t *cache, sqrl_cache_stats_t *stats_out);
 
 /* String operations */
 sqrl_cache_error_t sqrl_cache_get(sqrl_cache_t *cache, const char *key, char **value_out);
@@ -0,0 +1,48 @@
+/**
+ * SquirrelDB Metrics Export
+ *
+ * Renders client and cache counters and latency histograms in OpenMetrics
+ * text format. Rendering reads the same lock-free counters as
+ * sqrl_get_stats() and sqrl_cache_get_stats(), so it never contends with
+ * requests in flight and is safe to call on every scrape.
+ *
+ * Example:
+ *   char buf[16384];
+ *   size_t len;
+ *   if (sqrl_metrics_render(client, cache, "service=\"orders\"", buf, sizeof(buf), &len) == SQRL_OK) {
+ *     write(scrape_fd, buf, len);
+ *   }
+ */
+
+#ifndef SQUIRRELDB_METRICS_H
+#define SQUIRRELDB_METRICS_H
+
+#include "../squirreldb.h"
+#include "cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Render metrics in OpenMetrics text format, terminated by "# EOF"
+ * @param client Client to export (can be NULL)
+ * @param cache Cache connection to export (can be NULL)
+ * @param labels Extra labels added to every sample, e.g. "service=\"orders\"" (can be NULL)
+ * @param buf Output buffer, always NUL-terminated when buf_size > 0
+ * @param buf_size Size of buf
+ * @param len_out Bytes written excluding the NUL, or the size needed if buf was too small
+ * @return SQRL_OK, or SQRL_ERR_ENCODE if buf was too small
+ */
+sqrl_error_t sqrl_metrics_render(const sqrl_client_t *client,
+                                 const sqrl_cache_t *cache,
+                                 const char *labels,
+                                 char *buf,
+                                 size_t buf_size,
+                                 size_t *len_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQUIRRELDB_METRICS_H */
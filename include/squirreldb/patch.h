@@ -0,0 +1,99 @@
+/**
+ * SquirrelDB Patch Builder
+ *
+ * Builds field-level updates that the server applies in place, so changing
+ * one field of a large document sends only that field. Operations are
+ * applied in the order they were added.
+ *
+ * Example:
+ *   sqrl_patch_t* p = sqrl_patch_new();
+ *   sqrl_patch_inc_int(p, "views", 1);
+ *   sqrl_patch_set_bool(p, "seen", true);
+ *   sqrl_patch_push_str(p, "tags", "hot");
+ *   sqrl_update_patch(client, "posts", "p1", p, NULL);
+ *   sqrl_patch_free(p);
+ */
+
+#ifndef SQUIRRELDB_PATCH_H
+#define SQUIRRELDB_PATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Patch builder opaque type */
+typedef struct sqrl_patch sqrl_patch_t;
+
+/**
+ * Create an empty patch
+ * @return New patch (must be freed with sqrl_patch_free)
+ */
+sqrl_patch_t* sqrl_patch_new(void);
+
+/**
+ * Free a patch
+ * @param patch Patch to free
+ */
+void sqrl_patch_free(sqrl_patch_t* patch);
+
+/**
+ * Set field to value, creating it if missing
+ */
+sqrl_patch_t* sqrl_patch_set_str(sqrl_patch_t* patch, const char* field, const char* value);
+sqrl_patch_t* sqrl_patch_set_int(sqrl_patch_t* patch, const char* field, long value);
+sqrl_patch_t* sqrl_patch_set_double(sqrl_patch_t* patch, const char* field, double value);
+sqrl_patch_t* sqrl_patch_set_bool(sqrl_patch_t* patch, const char* field, bool value);
+
+/**
+ * Set field to a JSON value (object, array or literal), copied verbatim
+ */
+sqrl_patch_t* sqrl_patch_set_json(sqrl_patch_t* patch, const char* field, const char* json);
+
+/**
+ * Remove field from the document
+ */
+sqrl_patch_t* sqrl_patch_unset(sqrl_patch_t* patch, const char* field);
+
+/**
+ * Add delta to a numeric field; a missing field counts as 0
+ */
+sqrl_patch_t* sqrl_patch_inc_int(sqrl_patch_t* patch, const char* field, long delta);
+sqrl_patch_t* sqrl_patch_inc_double(sqrl_patch_t* patch, const char* field, double delta);
+
+/**
+ * Append value to an array field, creating the array if missing
+ */
+sqrl_patch_t* sqrl_patch_push_str(sqrl_patch_t* patch, const char* field, const char* value);
+sqrl_patch_t* sqrl_patch_push_int(sqrl_patch_t* patch, const char* field, long value);
+sqrl_patch_t* sqrl_patch_push_json(sqrl_patch_t* patch, const char* field, const char* json);
+
+/**
+ * Remove every element equal to value from an array field
+ */
+sqrl_patch_t* sqrl_patch_pull_str(sqrl_patch_t* patch, const char* field, const char* value);
+sqrl_patch_t* sqrl_patch_pull_int(sqrl_patch_t* patch, const char* field, long value);
+sqrl_patch_t* sqrl_patch_pull_json(sqrl_patch_t* patch, const char* field, const char* json);
+
+/**
+ * Number of operations added
+ */
+size_t sqrl_patch_count(const sqrl_patch_t* patch);
+
+/**
+ * Compile patch to a JSON array of operations,
+ * e.g. [{"op":"inc","field":"views","value":1}]
+ * @param patch Patch builder
+ * @return Compiled JSON string (must be freed with free()), NULL if an
+ *         operation was dropped (NULL field or value, non-finite double,
+ *         or out of memory)
+ */
+char* sqrl_patch_compile(const sqrl_patch_t* patch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQUIRRELDB_PATCH_H */
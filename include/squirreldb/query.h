@@ -29,6 +29,13 @@ typedef enum {
     SQRL_DESC = 1
 } sqrl_sort_dir_t;
 
+/* What a query returns */
+typedef enum {
+    SQRL_RESULT_DOCUMENTS = 0,
+    SQRL_RESULT_COUNT = 1,
+    SQRL_RESULT_EXISTS = 2
+} sqrl_result_mode_t;
+
 /* Query builder opaque type */
 typedef struct sqrl_query sqrl_query_t;
 
@@ -140,17 +147,44 @@ sqrl_query_t* sqrl_skip(sqrl_query_t* query, size_t n);
  */
 sqrl_query_t* sqrl_changes(sqrl_query_t* query);
 
+/**
+ * Return only the given field of each document (call once per field);
+ * document id and metadata are always included. A field longer than 127
+ * bytes once escaped, or more than 32 fields, makes the query fail to
+ * compile instead of being truncated or dropped.
+ */
+sqrl_query_t* sqrl_select(sqrl_query_t* query, const char* field);
+
+/**
+ * For a changes feed, send the current matching documents as initial
+ * events before streaming changes (default: changes only)
+ */
+sqrl_query_t* sqrl_include_initial(sqrl_query_t* query, bool include);
+
+/**
+ * Return only the number of matching documents; sort and projection are
+ * dropped, skip and limit still apply. Not for changes feeds.
+ */
+sqrl_query_t* sqrl_count_mode(sqrl_query_t* query);
+
+/**
+ * Return only whether any document matches: a count limited to one
+ */
+sqrl_query_t* sqrl_exists_mode(sqrl_query_t* query);
+
 /**
  * Compile query to SquirrelDB JS string (legacy)
  * @param query Query builder
- * @return Compiled query string (must be freed with free())
+ * @return Compiled query string (must be freed with free()), NULL if a
+ *         field or a non-finite double was rejected, or out of memory
  */
 char* sqrl_query_compile(sqrl_query_t* query);
 
 /**
  * Compile query to structured JSON string (preferred, no JS evaluation on server)
  * @param query Query builder
- * @return Compiled JSON string (must be freed with free())
+ * @return Compiled JSON string (must be freed with free()), NULL if a
+ *         field or a non-finite double was rejected, or out of memory
  */
 char* sqrl_query_compile_structured(sqrl_query_t* query);
 
@@ -0,0 +1,70 @@
+/**
+ * SquirrelDB DNS Resolver Cache
+ *
+ * sqrl_connect() and sqrl_cache_connect() resolve hosts through a
+ * process-wide cache instead of calling getaddrinfo() every time. Entries
+ * live for ttl_ms; once expired they keep being served while a background
+ * thread refreshes them, so reconnects never wait on DNS for a host that
+ * resolved before. Concurrent lookups of the same uncached host share a
+ * single getaddrinfo() call, and failures are cached for negative_ttl_ms.
+ *
+ * Example:
+ *   sqrl_resolver_prefetch("db.internal", 8082);    // at startup, returns at once
+ *   ...
+ *   sqrl_connect(&client, "db.internal", 8082, &opts);  // served from cache
+ */
+
+#ifndef SQUIRRELDB_RESOLVER_H
+#define SQUIRRELDB_RESOLVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Resolver options */
+typedef struct {
+  int ttl_ms;               /* Lifetime of a successful lookup, 0 = no caching */
+  int negative_ttl_ms;      /* Lifetime of a failed lookup */
+  size_t max_entries;       /* Least recently used hosts are evicted beyond this */
+} sqrl_resolver_options_t;
+
+/* Resolver statistics */
+typedef struct {
+  uint64_t hits;            /* Served from a fresh entry */
+  uint64_t stale_hits;      /* Served from an expired entry while it refreshes */
+  uint64_t misses;          /* Had to wait for getaddrinfo() */
+  uint64_t lookups;         /* getaddrinfo() calls, foreground and background */
+  uint64_t failures;        /* Lookups that failed */
+  size_t entries;
+} sqrl_resolver_stats_t;
+
+sqrl_resolver_options_t sqrl_resolver_options_default(void);
+
+/**
+ * Replace the resolver options; existing entries keep their expiry
+ * @param options New options (NULL restores the defaults)
+ */
+void sqrl_resolver_configure(const sqrl_resolver_options_t *options);
+
+/**
+ * Resolve host in the background unless a fresh entry exists
+ * @param host Host name or address
+ * @param port Port the address will be used with
+ */
+void sqrl_resolver_prefetch(const char *host, uint16_t port);
+
+/**
+ * Drop every cached entry, e.g. after a known DNS change
+ */
+void sqrl_resolver_flush(void);
+
+void sqrl_resolver_get_stats(sqrl_resolver_stats_t *stats_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQUIRRELDB_RESOLVER_H */
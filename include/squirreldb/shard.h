@@ -0,0 +1,110 @@
+/**
+ * SquirrelDB Sharded Client
+ *
+ * Thread-per-core mode for shared-nothing servers. A shard group opens one
+ * complete client per shard, each with its own sockets, buffers, pending
+ * table and reader thread. A worker thread attaches to one shard (and may
+ * pin itself to a CPU) and from then on sqrl_shard_client() hands it that
+ * shard's client, so requests submitted from the thread only ever take
+ * locks that no other worker touches.
+ *
+ * Work that has to run on another shard is handed off with
+ * sqrl_shards_post(). Each shard has a lock-free inbox; the owning thread
+ * runs whatever arrived when it calls sqrl_shards_poll(), typically once
+ * per turn of its event loop.
+ *
+ * Example:
+ *   sqrl_shards_connect(&shards, "localhost", 8082, &opts, 0);  // one per CPU
+ *   ...
+ *   // in worker i
+ *   sqrl_shards_attach(shards, i, true);
+ *   for (;;) {
+ *     sqrl_query(sqrl_shard_client(shards), "db.table(\"users\").run()", &result);
+ *     sqrl_shards_poll(shards);
+ *   }
+ */
+
+#ifndef SQUIRRELDB_SHARD_H
+#define SQUIRRELDB_SHARD_H
+
+#include "../squirreldb.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sqrl_shards sqrl_shards_t;
+
+/* Cross-shard task, run on the target shard's thread with its client */
+typedef void (*sqrl_shard_task_t)(sqrl_client_t *client, void *user_data);
+
+/**
+ * Connect a shard group, one client per shard
+ * @param shards_out Output shard group
+ * @param host Server host
+ * @param port Server port
+ * @param options Options used for every shard (NULL for defaults)
+ * @param count Number of shards, 0 = one per online CPU
+ * @return SQRL_OK, or the first shard's connect error
+ */
+sqrl_error_t sqrl_shards_connect(sqrl_shards_t **shards_out, const char *host, uint16_t port,
+                                 const sqrl_options_t *options, int count);
+
+/**
+ * Disconnect every shard. Tasks still queued are run with a NULL client
+ * so they can release their user_data. No thread may be using the group.
+ */
+void sqrl_shards_disconnect(sqrl_shards_t *shards);
+
+int sqrl_shards_count(const sqrl_shards_t *shards);
+
+/**
+ * Make the calling thread the owner of a shard
+ * @param index Shard to own, 0 <= index < count
+ * @param pin Also pin the thread to the index-th CPU it may run on (best
+ *            effort; a no-op on platforms other than Linux)
+ * @return SQRL_OK, SQRL_ERR_INVALID_ARG for a bad index or a shard that
+ *         already has an owner
+ */
+sqrl_error_t sqrl_shards_attach(sqrl_shards_t *shards, int index, bool pin);
+
+/**
+ * Give up the calling thread's shard, e.g. before the thread exits
+ */
+void sqrl_shards_detach(sqrl_shards_t *shards);
+
+/**
+ * @return Client of the calling thread's shard, NULL if it has none
+ */
+sqrl_client_t *sqrl_shard_client(const sqrl_shards_t *shards);
+
+/**
+ * @return Index of the calling thread's shard, -1 if it has none
+ */
+int sqrl_shard_index(const sqrl_shards_t *shards);
+
+/**
+ * Hand a task to another shard; safe from any thread
+ * @param index Target shard
+ * @param task Run by the target's owner in its next sqrl_shards_poll()
+ * @return SQRL_OK, SQRL_ERR_INVALID_ARG or SQRL_ERR_MEMORY
+ */
+sqrl_error_t sqrl_shards_post(sqrl_shards_t *shards, int index, sqrl_shard_task_t task, void *user_data);
+
+/**
+ * Run the tasks posted to the calling thread's shard, in posting order
+ * @return Number of tasks run
+ */
+size_t sqrl_shards_poll(sqrl_shards_t *shards);
+
+/**
+ * Sum the statistics of every shard. Histograms are merged; gauges such
+ * as in_flight and connections are added up.
+ */
+void sqrl_shards_get_stats(const sqrl_shards_t *shards, sqrl_stats_t *stats_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQUIRRELDB_SHARD_H */
@@ -17,9 +17,9 @@ make test
 echo "Creating distribution archive..."
 DIST_DIR="squirreldb-sdk-${VERSION}"
 mkdir -p "$DIST_DIR/include" "$DIST_DIR/src"
-cp include/*.h "$DIST_DIR/include/"
+cp include/*.h include/*.hpp "$DIST_DIR/include/"
 cp -r include/squirreldb "$DIST_DIR/include/" 2>/dev/null || true
-cp src/*.c "$DIST_DIR/src/"
+cp src/*.c src/*.h "$DIST_DIR/src/"
 cp Makefile README.md LICENSE "$DIST_DIR/" 2>/dev/null || true
 tar -czf "squirreldb-sdk-${VERSION}.tar.gz" "$DIST_DIR"
 rm -rf "$DIST_DIR"
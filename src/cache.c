@@ -5,6 +5,7 @@
  */
 
 #include "squirreldb/cache.h"
+#include "resolver.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +17,8 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <time.h>
+#include <stdatomic.h>
 
 #define BUFFER_SIZE 4096
 
@@ -25,8 +28,29 @@ struct sqrl_cache {
   size_t buffer_size;
   size_t buffer_pos;
   size_t buffer_len;
+
+  /* Statistics, readable from other threads without locking */
+  _Atomic uint64_t stat_commands;
+  _Atomic uint64_t stat_errors;
+  _Atomic uint64_t stat_bytes_sent;
+  _Atomic uint64_t stat_bytes_received;
+  _Atomic uint64_t stat_latency_buckets[SQRL_CACHE_LATENCY_BUCKETS];
+  _Atomic uint64_t stat_latency_sum_us;
 };
 
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void record_latency(sqrl_cache_t *cache, uint64_t us) {
+  int bucket = 0;
+  for (uint64_t v = us; v > 1 && bucket < SQRL_CACHE_LATENCY_BUCKETS - 1; v >>= 1) bucket++;
+  atomic_fetch_add_explicit(&cache->stat_latency_buckets[bucket], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&cache->stat_latency_sum_us, us, memory_order_relaxed);
+}
+
 /* RESP protocol helpers */
 
 static ssize_t send_all(int fd, const void *buf, size_t len) {
@@ -45,20 +69,25 @@ static ssize_t send_all(int fd, const void *buf, size_t len) {
   return len;
 }
 
+/* Refills the read buffer; returns false on EOF or error */
+static bool fill_buffer(sqrl_cache_t *cache) {
+  ssize_t n = recv(cache->fd, cache->buffer, cache->buffer_size, 0);
+  if (n <= 0) return false;
+  cache->buffer_pos = 0;
+  cache->buffer_len = n;
+  atomic_fetch_add_explicit(&cache->stat_bytes_received, (uint64_t)n, memory_order_relaxed);
+  return true;
+}
+
 static char *read_line(sqrl_cache_t *cache) {
   char *line = malloc(1024);
   if (!line) return NULL;
 
   size_t pos = 0;
   while (1) {
-    if (cache->buffer_pos >= cache->buffer_len) {
-      ssize_t n = recv(cache->fd, cache->buffer, cache->buffer_size, 0);
-      if (n <= 0) {
-        free(line);
-        return NULL;
-      }
-      cache->buffer_pos = 0;
-      cache->buffer_len = n;
+    if (cache->buffer_pos >= cache->buffer_len && !fill_buffer(cache)) {
+      free(line);
+      return NULL;
     }
 
     char c = cache->buffer[cache->buffer_pos++];
@@ -79,14 +108,9 @@ static char *read_bulk_string(sqrl_cache_t *cache, int len) {
 
   size_t read_pos = 0;
   while (read_pos < (size_t)len) {
-    if (cache->buffer_pos >= cache->buffer_len) {
-      ssize_t n = recv(cache->fd, cache->buffer, cache->buffer_size, 0);
-      if (n <= 0) {
-        free(str);
-        return NULL;
-      }
-      cache->buffer_pos = 0;
-      cache->buffer_len = n;
+    if (cache->buffer_pos >= cache->buffer_len && !fill_buffer(cache)) {
+      free(str);
+      return NULL;
     }
 
     size_t avail = cache->buffer_len - cache->buffer_pos;
@@ -104,12 +128,7 @@ static char *read_bulk_string(sqrl_cache_t *cache, int len) {
   char crlf[2];
   size_t crlf_pos = 0;
   while (crlf_pos < 2) {
-    if (cache->buffer_pos >= cache->buffer_len) {
-      ssize_t n = recv(cache->fd, cache->buffer, cache->buffer_size, 0);
-      if (n <= 0) break;
-      cache->buffer_pos = 0;
-      cache->buffer_len = n;
-    }
+    if (cache->buffer_pos >= cache->buffer_len && !fill_buffer(cache)) break;
     crlf[crlf_pos++] = cache->buffer[cache->buffer_pos++];
   }
 
@@ -223,18 +242,23 @@ static sqrl_cache_error_t send_command(sqrl_cache_t *cache, const char **args, s
     pos += snprintf(cmd + pos, sizeof(cmd) - pos, "$%zu\r\n%s\r\n", len, args[i]);
   }
 
+  uint64_t start = now_us();
+  atomic_fetch_add_explicit(&cache->stat_commands, 1, memory_order_relaxed);
+
   if (send_all(cache->fd, cmd, pos) < 0) {
+    atomic_fetch_add_explicit(&cache->stat_errors, 1, memory_order_relaxed);
     return SQRL_CACHE_ERR_SEND;
   }
+  atomic_fetch_add_explicit(&cache->stat_bytes_sent, (uint64_t)pos, memory_order_relaxed);
 
   sqrl_cache_error_t err = parse_response(cache, response);
-  if (err != SQRL_CACHE_OK) return err;
+  if (err == SQRL_CACHE_OK && response->type == RESP_ERROR) err = SQRL_CACHE_ERR_SERVER;
 
-  if (response->type == RESP_ERROR) {
-    return SQRL_CACHE_ERR_SERVER;
+  record_latency(cache, now_us() - start);
+  if (err != SQRL_CACHE_OK) {
+    atomic_fetch_add_explicit(&cache->stat_errors, 1, memory_order_relaxed);
   }
-
-  return SQRL_CACHE_OK;
+  return err;
 }
 
 /* Public API */
@@ -277,39 +301,13 @@ sqrl_cache_error_t sqrl_cache_connect(sqrl_cache_t **cache_out, const sqrl_cache
   }
   cache->buffer_size = BUFFER_SIZE;
 
-  struct addrinfo hints = {0}, *res = NULL;
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-
-  char port_str[16];
-  snprintf(port_str, sizeof(port_str), "%u", opts.port);
-
-  if (getaddrinfo(opts.host, port_str, &hints, &res) != 0) {
-    free(cache->buffer);
-    free(cache);
-    return SQRL_CACHE_ERR_CONNECT;
-  }
-
-  cache->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+  cache->fd = sqrl_resolver_connect(opts.host, opts.port);
   if (cache->fd < 0) {
-    freeaddrinfo(res);
-    free(cache->buffer);
-    free(cache);
-    return SQRL_CACHE_ERR_CONNECT;
-  }
-
-  int flag = 1;
-  setsockopt(cache->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
-
-  if (connect(cache->fd, res->ai_addr, res->ai_addrlen) < 0) {
-    freeaddrinfo(res);
-    close(cache->fd);
     free(cache->buffer);
     free(cache);
     return SQRL_CACHE_ERR_CONNECT;
   }
 
-  freeaddrinfo(res);
   *cache_out = cache;
   return SQRL_CACHE_OK;
 }
@@ -321,6 +319,22 @@ void sqrl_cache_disconnect(sqrl_cache_t *cache) {
   free(cache);
 }
 
+sqrl_cache_error_t sqrl_cache_get_stats(const sqrl_cache_t *cache, sqrl_cache_stats_t *stats_out) {
+  if (!cache || !stats_out) return SQRL_CACHE_ERR_MEMORY;
+
+  memset(stats_out, 0, sizeof(*stats_out));
+  stats_out->commands = atomic_load_explicit(&cache->stat_commands, memory_order_relaxed);
+  stats_out->errors = atomic_load_explicit(&cache->stat_errors, memory_order_relaxed);
+  stats_out->bytes_sent = atomic_load_explicit(&cache->stat_bytes_sent, memory_order_relaxed);
+  stats_out->bytes_received = atomic_load_explicit(&cache->stat_bytes_received, memory_order_relaxed);
+  for (int i = 0; i < SQRL_CACHE_LATENCY_BUCKETS; i++) {
+    stats_out->latency_buckets[i] = atomic_load_explicit(&cache->stat_latency_buckets[i], memory_order_relaxed);
+    stats_out->latency_count += stats_out->latency_buckets[i];
+  }
+  stats_out->latency_sum_us = atomic_load_explicit(&cache->stat_latency_sum_us, memory_order_relaxed);
+  return SQRL_CACHE_OK;
+}
+
 sqrl_cache_error_t sqrl_cache_get(sqrl_cache_t *cache, const char *key, char **value_out) {
   if (!cache || !key || !value_out) return SQRL_CACHE_ERR_MEMORY;
 
@@ -0,0 +1,128 @@
+/**
+ * SquirrelDB Metrics Export Implementation
+ */
+
+#include "../include/squirreldb/metrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;       /* Bytes the full output needs, may exceed size */
+    const char *labels;
+} metrics_writer_t;
+
+static void emit(metrics_writer_t *w, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t avail = w->len < w->size ? w->size - w->len : 0;
+    int n = vsnprintf(avail ? w->buf + w->len : NULL, avail, fmt, ap);
+    va_end(ap);
+    if (n > 0) w->len += (size_t)n;
+}
+
+static void emit_counter(metrics_writer_t *w, const char *name, const char *help, uint64_t value) {
+    emit(w, "# TYPE %s counter\n# HELP %s %s\n", name, name, help);
+    if (w->labels) {
+        emit(w, "%s_total{%s} %llu\n", name, w->labels, (unsigned long long)value);
+    } else {
+        emit(w, "%s_total %llu\n", name, (unsigned long long)value);
+    }
+}
+
+static void emit_gauge(metrics_writer_t *w, const char *name, const char *help, double value) {
+    emit(w, "# TYPE %s gauge\n# HELP %s %s\n", name, name, help);
+    if (w->labels) {
+        emit(w, "%s{%s} %g\n", name, w->labels, value);
+    } else {
+        emit(w, "%s %g\n", name, value);
+    }
+}
+
+/* Buckets are log2 microseconds; the last one is open-ended and becomes +Inf */
+static void emit_histogram(metrics_writer_t *w, const char *name, const char *help,
+                           const uint64_t *buckets, size_t bucket_count, uint64_t sum_us) {
+    const char *sep = w->labels ? "," : "";
+    const char *labels = w->labels ? w->labels : "";
+    uint64_t cumulative = 0;
+
+    emit(w, "# TYPE %s histogram\n# UNIT %s seconds\n# HELP %s %s\n", name, name, name, help);
+    for (size_t i = 0; i + 1 < bucket_count; i++) {
+        cumulative += buckets[i];
+        emit(w, "%s_bucket{%s%sle=\"%.6f\"} %llu\n", name, labels, sep,
+             (double)(1ull << (i + 1)) / 1e6, (unsigned long long)cumulative);
+    }
+    cumulative += buckets[bucket_count - 1];
+    emit(w, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)cumulative);
+
+    if (w->labels) {
+        emit(w, "%s_sum{%s} %g\n%s_count{%s} %llu\n", name, labels, (double)sum_us / 1e6,
+             name, labels, (unsigned long long)cumulative);
+    } else {
+        emit(w, "%s_sum %g\n%s_count %llu\n", name, (double)sum_us / 1e6,
+             name, (unsigned long long)cumulative);
+    }
+}
+
+static void render_client(metrics_writer_t *w, const sqrl_client_t *client) {
+    sqrl_stats_t s;
+    if (sqrl_get_stats(client, &s) != SQRL_OK) return;
+
+    emit_gauge(w, "sqrl_client_connected", "Whether the client connection is up", sqrl_is_connected(client) ? 1 : 0);
+    emit_counter(w, "sqrl_client_frames_sent", "Frames written to the socket", s.frames_sent);
+    emit_counter(w, "sqrl_client_bytes_sent", "Bytes written to the socket", s.bytes_sent);
+    emit_counter(w, "sqrl_client_frames_received", "Frames read from the socket", s.frames_received);
+    emit_counter(w, "sqrl_client_bytes_received", "Bytes read from the socket", s.bytes_received);
+    emit_counter(w, "sqrl_client_requests_completed", "Requests answered by the server", s.requests_completed);
+    emit_counter(w, "sqrl_client_requests_timed_out", "Requests that hit request_timeout_ms", s.requests_timed_out);
+    emit_counter(w, "sqrl_client_requests_rejected", "Requests failed fast by the limiter or circuit breaker", s.requests_rejected);
+    emit_counter(w, "sqrl_client_batches_flushed", "Coalesced write batches", s.batches_flushed);
+    emit_gauge(w, "sqrl_client_batch_frames_avg", "Average frames per write batch", s.avg_batch_frames);
+    emit_gauge(w, "sqrl_client_batch_delay_avg_seconds", "Average queueing delay added by write batching", (double)s.avg_batch_delay_us / 1e6);
+    emit_gauge(w, "sqrl_client_batch_window_seconds", "Current adaptive batching window", (double)s.batch_window_us / 1e6);
+    emit_counter(w, "sqrl_client_hedges_sent", "Hedged duplicate reads sent", s.hedges_sent);
+    emit_counter(w, "sqrl_client_hedges_won", "Hedged reads answered first by the hedge", s.hedges_won);
+    emit_gauge(w, "sqrl_client_connections", "Open sockets, including the bulk socket", s.connections);
+    emit_counter(w, "sqrl_client_bulk_requests", "Requests sent on the bulk socket", s.bulk_requests);
+    emit_counter(w, "sqrl_client_coalesced_queries", "Queries answered by an identical in-flight query", s.coalesced_queries);
+    emit_counter(w, "sqrl_client_result_cache_hits", "Queries served from the result cache", s.cache_hits);
+    emit_counter(w, "sqrl_client_result_cache_misses", "Cacheable queries sent to the server", s.cache_misses);
+    emit_counter(w, "sqrl_client_result_cache_invalidations", "Cached results dropped because their table changed", s.cache_invalidations);
+    emit_gauge(w, "sqrl_client_concurrency_limit", "Adaptive in-flight request limit", s.concurrency_limit);
+    emit_gauge(w, "sqrl_client_in_flight", "Requests awaiting a reply", s.in_flight);
+    emit_counter(w, "sqrl_client_breaker_opens", "Times the circuit breaker opened", s.breaker_opens);
+    emit_gauge(w, "sqrl_client_breaker_open", "Whether the circuit breaker is open", s.breaker_open ? 1 : 0);
+    emit_histogram(w, "sqrl_client_request_latency_seconds", "Request round-trip latency",
+                   s.latency_buckets, SQRL_LATENCY_BUCKETS, s.latency_sum_us);
+}
+
+static void render_cache(metrics_writer_t *w, const sqrl_cache_t *cache) {
+    sqrl_cache_stats_t s;
+    if (sqrl_cache_get_stats(cache, &s) != SQRL_CACHE_OK) return;
+
+    emit_counter(w, "sqrl_cache_commands", "Cache commands sent", s.commands);
+    emit_counter(w, "sqrl_cache_errors", "Cache commands that failed", s.errors);
+    emit_counter(w, "sqrl_cache_bytes_sent", "Bytes written to the cache socket", s.bytes_sent);
+    emit_counter(w, "sqrl_cache_bytes_received", "Bytes read from the cache socket", s.bytes_received);
+    emit_histogram(w, "sqrl_cache_command_latency_seconds", "Cache command round-trip latency",
+                   s.latency_buckets, SQRL_CACHE_LATENCY_BUCKETS, s.latency_sum_us);
+}
+
+sqrl_error_t sqrl_metrics_render(const sqrl_client_t *client,
+                                 const sqrl_cache_t *cache,
+                                 const char *labels,
+                                 char *buf,
+                                 size_t buf_size,
+                                 size_t *len_out) {
+    if (!buf && buf_size > 0) return SQRL_ERR_INVALID_ARG;
+
+    metrics_writer_t w = {buf, buf_size, 0, labels && *labels ? labels : NULL};
+    if (client) render_client(&w, client);
+    if (cache) render_cache(&w, cache);
+    emit(&w, "# EOF\n");
+
+    if (len_out) *len_out = w.len;
+    return w.len < buf_size ? SQRL_OK : SQRL_ERR_ENCODE;
+}
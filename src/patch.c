@@ -0,0 +1,230 @@
+/**
+ * SquirrelDB Patch Builder Implementation
+ */
+
+#include "../include/squirreldb/patch.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_OPS 8
+
+typedef struct {
+    const char *op;      /* "set", "unset", "inc", "push" or "pull" */
+    char *field;         /* Escaped, without quotes */
+    char *value;         /* JSON text, NULL for unset */
+} patch_op_t;
+
+struct sqrl_patch {
+    patch_op_t *ops;
+    size_t count;
+    size_t capacity;
+    bool failed;         /* An operation was dropped: bad argument or no memory */
+};
+
+/* Returns str as the body of a JSON string literal, quotes excluded */
+static char *escape_json(const char *str) {
+    size_t len = 0;
+    for (const char *s = str; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        len += (c == '"' || c == '\\') ? 2 : c < 0x20 ? 6 : 1;
+    }
+
+    char *out = malloc(len + 1);
+    if (!out) return NULL;
+
+    char *p = out;
+    for (const char *s = str; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if (c < 0x20) {
+            p += sprintf(p, "\\u%04x", c);
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p = '\0';
+    return out;
+}
+
+static char *quote_json(const char *str) {
+    char *escaped = escape_json(str);
+    if (!escaped) return NULL;
+
+    size_t len = strlen(escaped);
+    char *out = malloc(len + 3);
+    if (out) {
+        out[0] = '"';
+        memcpy(out + 1, escaped, len);
+        out[len + 1] = '"';
+        out[len + 2] = '\0';
+    }
+    free(escaped);
+    return out;
+}
+
+/* Takes ownership of value */
+static sqrl_patch_t* add_op(sqrl_patch_t* patch, const char* op, const char* field, char* value, bool has_value) {
+    if (!patch) {
+        free(value);
+        return NULL;
+    }
+    if (!field || (has_value && !value)) {
+        free(value);
+        patch->failed = true;
+        return patch;
+    }
+
+    if (patch->count == patch->capacity) {
+        size_t capacity = patch->capacity ? patch->capacity * 2 : INITIAL_OPS;
+        patch_op_t *ops = realloc(patch->ops, capacity * sizeof(patch_op_t));
+        if (!ops) {
+            free(value);
+            patch->failed = true;
+            return patch;
+        }
+        patch->ops = ops;
+        patch->capacity = capacity;
+    }
+
+    char *escaped = escape_json(field);
+    if (!escaped) {
+        free(value);
+        patch->failed = true;
+        return patch;
+    }
+
+    patch_op_t *o = &patch->ops[patch->count++];
+    o->op = op;
+    o->field = escaped;
+    o->value = value;
+    return patch;
+}
+
+static char *format_long(long value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    return strdup(buf);
+}
+
+/* NULL for NaN and infinities, which JSON can't represent */
+static char *format_double(double value) {
+    if (!isfinite(value)) return NULL;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    return strdup(buf);
+}
+
+sqrl_patch_t* sqrl_patch_new(void) {
+    return calloc(1, sizeof(sqrl_patch_t));
+}
+
+void sqrl_patch_free(sqrl_patch_t* patch) {
+    if (!patch) return;
+    for (size_t i = 0; i < patch->count; i++) {
+        free(patch->ops[i].field);
+        free(patch->ops[i].value);
+    }
+    free(patch->ops);
+    free(patch);
+}
+
+sqrl_patch_t* sqrl_patch_set_str(sqrl_patch_t* patch, const char* field, const char* value) {
+    return add_op(patch, "set", field, value ? quote_json(value) : NULL, true);
+}
+
+sqrl_patch_t* sqrl_patch_set_int(sqrl_patch_t* patch, const char* field, long value) {
+    return add_op(patch, "set", field, format_long(value), true);
+}
+
+sqrl_patch_t* sqrl_patch_set_double(sqrl_patch_t* patch, const char* field, double value) {
+    return add_op(patch, "set", field, format_double(value), true);
+}
+
+sqrl_patch_t* sqrl_patch_set_bool(sqrl_patch_t* patch, const char* field, bool value) {
+    return add_op(patch, "set", field, strdup(value ? "true" : "false"), true);
+}
+
+sqrl_patch_t* sqrl_patch_set_json(sqrl_patch_t* patch, const char* field, const char* json) {
+    return add_op(patch, "set", field, json ? strdup(json) : NULL, true);
+}
+
+sqrl_patch_t* sqrl_patch_unset(sqrl_patch_t* patch, const char* field) {
+    return add_op(patch, "unset", field, NULL, false);
+}
+
+sqrl_patch_t* sqrl_patch_inc_int(sqrl_patch_t* patch, const char* field, long delta) {
+    return add_op(patch, "inc", field, format_long(delta), true);
+}
+
+sqrl_patch_t* sqrl_patch_inc_double(sqrl_patch_t* patch, const char* field, double delta) {
+    return add_op(patch, "inc", field, format_double(delta), true);
+}
+
+sqrl_patch_t* sqrl_patch_push_str(sqrl_patch_t* patch, const char* field, const char* value) {
+    return add_op(patch, "push", field, value ? quote_json(value) : NULL, true);
+}
+
+sqrl_patch_t* sqrl_patch_push_int(sqrl_patch_t* patch, const char* field, long value) {
+    return add_op(patch, "push", field, format_long(value), true);
+}
+
+sqrl_patch_t* sqrl_patch_push_json(sqrl_patch_t* patch, const char* field, const char* json) {
+    return add_op(patch, "push", field, json ? strdup(json) : NULL, true);
+}
+
+sqrl_patch_t* sqrl_patch_pull_str(sqrl_patch_t* patch, const char* field, const char* value) {
+    return add_op(patch, "pull", field, value ? quote_json(value) : NULL, true);
+}
+
+sqrl_patch_t* sqrl_patch_pull_int(sqrl_patch_t* patch, const char* field, long value) {
+    return add_op(patch, "pull", field, format_long(value), true);
+}
+
+sqrl_patch_t* sqrl_patch_pull_json(sqrl_patch_t* patch, const char* field, const char* json) {
+    return add_op(patch, "pull", field, json ? strdup(json) : NULL, true);
+}
+
+size_t sqrl_patch_count(const sqrl_patch_t* patch) {
+    return patch ? patch->count : 0;
+}
+
+char* sqrl_patch_compile(const sqrl_patch_t* patch) {
+    if (!patch || patch->failed) return NULL;
+
+    size_t size = 3;
+    for (size_t i = 0; i < patch->count; i++) {
+        const patch_op_t *o = &patch->ops[i];
+        size += 40 + strlen(o->op) + strlen(o->field) + (o->value ? strlen(o->value) : 0);
+    }
+
+    char *buf = malloc(size);
+    if (!buf) return NULL;
+
+    char *p = buf;
+    size_t remaining = size;
+    int n;
+
+    n = snprintf(p, remaining, "[");
+    p += n;
+    remaining -= n;
+
+    for (size_t i = 0; i < patch->count; i++) {
+        const patch_op_t *o = &patch->ops[i];
+        if (o->value) {
+            n = snprintf(p, remaining, "%s{\"op\":\"%s\",\"field\":\"%s\",\"value\":%s}",
+                         i > 0 ? "," : "", o->op, o->field, o->value);
+        } else {
+            n = snprintf(p, remaining, "%s{\"op\":\"%s\",\"field\":\"%s\"}",
+                         i > 0 ? "," : "", o->op, o->field);
+        }
+        p += n;
+        remaining -= n;
+    }
+
+    snprintf(p, remaining, "]");
+    return buf;
+}
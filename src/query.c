@@ -2,14 +2,15 @@
  * SquirrelDB Query Builder Implementation
  */
 
-#include "../include/squirreldb/query.h"
+#include "query.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define MAX_FILTERS 32
 #define MAX_SORTS 8
-#define BUFFER_SIZE 4096
+#define MAX_FIELDS 32
 
 typedef struct {
     char field[128];
@@ -28,11 +29,16 @@ struct sqrl_query {
     size_t filter_count;
     sort_entry_t sorts[MAX_SORTS];
     size_t sort_count;
+    char fields[MAX_FIELDS][128];
+    size_t field_count;
     size_t limit_value;
     size_t skip_value;
     bool has_limit;
     bool has_skip;
     bool is_changes;
+    bool include_initial;
+    bool invalid;           /* A field or value was rejected, compile returns NULL */
+    sqrl_result_mode_t mode;
 };
 
 static char *escape_json_string(const char *str, char *buf, size_t buf_size) {
@@ -73,6 +79,19 @@ static sqrl_query_t* add_filter(sqrl_query_t* query, const char* field, const ch
     return query;
 }
 
+/* %.17g round-trips every finite double; NaN and infinities aren't JSON */
+static sqrl_query_t* add_double_filter(sqrl_query_t* query, const char* field, const char* op, double value) {
+    if (!query) return query;
+    if (!isfinite(value)) {
+        query->invalid = true;
+        return query;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.17g", value);
+    return add_filter(query, field, op, buf);
+}
+
 sqrl_query_t* sqrl_find_eq_str(sqrl_query_t* query, const char* field, const char* value) {
     char escaped[512];
     char buf[520];
@@ -88,9 +107,7 @@ sqrl_query_t* sqrl_find_eq_int(sqrl_query_t* query, const char* field, long valu
 }
 
 sqrl_query_t* sqrl_find_eq_double(sqrl_query_t* query, const char* field, double value) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "%g", value);
-    return add_filter(query, field, "$eq", buf);
+    return add_double_filter(query, field, "$eq", value);
 }
 
 sqrl_query_t* sqrl_find_eq_bool(sqrl_query_t* query, const char* field, bool value) {
@@ -112,27 +129,19 @@ sqrl_query_t* sqrl_find_ne_int(sqrl_query_t* query, const char* field, long valu
 }
 
 sqrl_query_t* sqrl_find_gt(sqrl_query_t* query, const char* field, double value) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "%g", value);
-    return add_filter(query, field, "$gt", buf);
+    return add_double_filter(query, field, "$gt", value);
 }
 
 sqrl_query_t* sqrl_find_gte(sqrl_query_t* query, const char* field, double value) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "%g", value);
-    return add_filter(query, field, "$gte", buf);
+    return add_double_filter(query, field, "$gte", value);
 }
 
 sqrl_query_t* sqrl_find_lt(sqrl_query_t* query, const char* field, double value) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "%g", value);
-    return add_filter(query, field, "$lt", buf);
+    return add_double_filter(query, field, "$lt", value);
 }
 
 sqrl_query_t* sqrl_find_lte(sqrl_query_t* query, const char* field, double value) {
-    char buf[64];
-    snprintf(buf, sizeof(buf), "%g", value);
-    return add_filter(query, field, "$lte", buf);
+    return add_double_filter(query, field, "$lte", value);
 }
 
 sqrl_query_t* sqrl_find_contains(sqrl_query_t* query, const char* field, const char* value) {
@@ -189,6 +198,31 @@ sqrl_query_t* sqrl_skip(sqrl_query_t* query, size_t n) {
     return query;
 }
 
+sqrl_query_t* sqrl_select(sqrl_query_t* query, const char* field) {
+    if (!query) return query;
+
+    /* A truncated or dropped field would silently change the result */
+    if (!field || query->field_count >= MAX_FIELDS) {
+        query->invalid = true;
+        return query;
+    }
+
+    char *out = query->fields[query->field_count];
+    size_t j = 0;
+    for (const char *s = field; *s; s++) {
+        bool escape = *s == '"' || *s == '\\';
+        if (j + (escape ? 2 : 1) >= sizeof(query->fields[0])) {
+            query->invalid = true;
+            return query;
+        }
+        if (escape) out[j++] = '\\';
+        out[j++] = *s;
+    }
+    out[j] = '\0';
+    query->field_count++;
+    return query;
+}
+
 sqrl_query_t* sqrl_changes(sqrl_query_t* query) {
     if (query) {
         query->is_changes = true;
@@ -196,14 +230,53 @@ sqrl_query_t* sqrl_changes(sqrl_query_t* query) {
     return query;
 }
 
+sqrl_query_t* sqrl_include_initial(sqrl_query_t* query, bool include) {
+    if (query) {
+        query->include_initial = include;
+    }
+    return query;
+}
+
+sqrl_query_t* sqrl_count_mode(sqrl_query_t* query) {
+    if (query) {
+        query->mode = SQRL_RESULT_COUNT;
+    }
+    return query;
+}
+
+sqrl_query_t* sqrl_exists_mode(sqrl_query_t* query) {
+    if (query) {
+        query->mode = SQRL_RESULT_EXISTS;
+    }
+    return query;
+}
+
+/* Upper bound on either compiled form: every piece is one of the fixed
+ * strings below plus the builder's own fields */
+static size_t compiled_size(const sqrl_query_t *query) {
+    size_t size = 256 + strlen(query->table_name);
+    for (size_t i = 0; i < query->filter_count; i++) {
+        const filter_entry_t *f = &query->filters[i];
+        size += 32 + strlen(f->field) + strlen(f->op) + strlen(f->value);
+    }
+    for (size_t i = 0; i < query->sort_count; i++) {
+        size += 40 + strlen(query->sorts[i].field);
+    }
+    for (size_t i = 0; i < query->field_count; i++) {
+        size += 4 + strlen(query->fields[i]);
+    }
+    return size;
+}
+
 char* sqrl_query_compile(sqrl_query_t* query) {
-    if (!query) return NULL;
+    if (!query || query->invalid) return NULL;
 
-    char *buf = malloc(BUFFER_SIZE);
+    size_t size = compiled_size(query);
+    char *buf = malloc(size);
     if (!buf) return NULL;
 
     char *p = buf;
-    size_t remaining = BUFFER_SIZE;
+    size_t remaining = size;
     int n;
 
     n = snprintf(p, remaining, "db.table(\"%s\")", query->table_name);
@@ -262,8 +335,8 @@ char* sqrl_query_compile(sqrl_query_t* query) {
         remaining -= n;
     }
 
-    /* Sorts */
-    for (size_t i = 0; i < query->sort_count; i++) {
+    /* Sorts; order doesn't change a count */
+    for (size_t i = 0; query->mode == SQRL_RESULT_DOCUMENTS && i < query->sort_count; i++) {
         sort_entry_t *s = &query->sorts[i];
         if (s->direction == SQRL_DESC) {
             n = snprintf(p, remaining, ".orderBy(\"%s\", \"desc\")", s->field);
@@ -274,7 +347,12 @@ char* sqrl_query_compile(sqrl_query_t* query) {
         remaining -= n;
     }
 
-    if (query->has_limit) {
+    /* One match is enough to answer exists */
+    if (query->mode == SQRL_RESULT_EXISTS) {
+        n = snprintf(p, remaining, ".limit(1)");
+        p += n;
+        remaining -= n;
+    } else if (query->has_limit) {
         n = snprintf(p, remaining, ".limit(%zu)", query->limit_value);
         p += n;
         remaining -= n;
@@ -286,8 +364,26 @@ char* sqrl_query_compile(sqrl_query_t* query) {
         remaining -= n;
     }
 
+    if (query->mode == SQRL_RESULT_DOCUMENTS && query->field_count > 0) {
+        n = snprintf(p, remaining, ".pluck(");
+        p += n;
+        remaining -= n;
+
+        for (size_t i = 0; i < query->field_count; i++) {
+            n = snprintf(p, remaining, "%s\"%s\"", i > 0 ? ", " : "", query->fields[i]);
+            p += n;
+            remaining -= n;
+        }
+
+        n = snprintf(p, remaining, ")");
+        p += n;
+        remaining -= n;
+    }
+
     if (query->is_changes) {
-        snprintf(p, remaining, ".changes()");
+        snprintf(p, remaining, query->include_initial ? ".changes({includeInitial: true})" : ".changes()");
+    } else if (query->mode != SQRL_RESULT_DOCUMENTS) {
+        snprintf(p, remaining, ".count().run()");
     } else {
         snprintf(p, remaining, ".run()");
     }
@@ -295,14 +391,17 @@ char* sqrl_query_compile(sqrl_query_t* query) {
     return buf;
 }
 
-char* sqrl_query_compile_structured(sqrl_query_t* query) {
-    if (!query) return NULL;
+/* Structured form with the result mode and changes flag given separately,
+ * so the client can compile variants without touching the builder */
+static char *compile_structured(const sqrl_query_t *query, sqrl_result_mode_t mode, bool changes) {
+    if (query->invalid) return NULL;
 
-    char *buf = malloc(BUFFER_SIZE);
+    size_t size = compiled_size(query);
+    char *buf = malloc(size);
     if (!buf) return NULL;
 
     char *p = buf;
-    size_t remaining = BUFFER_SIZE;
+    size_t remaining = size;
     int n;
 
     n = snprintf(p, remaining, "{\"table\":\"%s\"", query->table_name);
@@ -316,7 +415,7 @@ char* sqrl_query_compile_structured(sqrl_query_t* query) {
         remaining -= n;
 
         for (size_t i = 0; i < query->filter_count; i++) {
-            filter_entry_t *f = &query->filters[i];
+            const filter_entry_t *f = &query->filters[i];
 
             if (i > 0) {
                 n = snprintf(p, remaining, ",");
@@ -334,14 +433,14 @@ char* sqrl_query_compile_structured(sqrl_query_t* query) {
         remaining -= n;
     }
 
-    /* Sorts */
-    if (query->sort_count > 0) {
+    /* Sorts; order doesn't change a count */
+    if (mode == SQRL_RESULT_DOCUMENTS && query->sort_count > 0) {
         n = snprintf(p, remaining, ",\"sort\":[");
         p += n;
         remaining -= n;
 
         for (size_t i = 0; i < query->sort_count; i++) {
-            sort_entry_t *s = &query->sorts[i];
+            const sort_entry_t *s = &query->sorts[i];
             if (i > 0) {
                 n = snprintf(p, remaining, ",");
                 p += n;
@@ -358,7 +457,12 @@ char* sqrl_query_compile_structured(sqrl_query_t* query) {
         remaining -= n;
     }
 
-    if (query->has_limit) {
+    /* One match is enough to answer exists */
+    if (mode == SQRL_RESULT_EXISTS) {
+        n = snprintf(p, remaining, ",\"limit\":1");
+        p += n;
+        remaining -= n;
+    } else if (query->has_limit) {
         n = snprintf(p, remaining, ",\"limit\":%zu", query->limit_value);
         p += n;
         remaining -= n;
@@ -370,8 +474,31 @@ char* sqrl_query_compile_structured(sqrl_query_t* query) {
         remaining -= n;
     }
 
-    if (query->is_changes) {
-        n = snprintf(p, remaining, ",\"changes\":{\"includeInitial\":false}");
+    if (mode == SQRL_RESULT_DOCUMENTS && query->field_count > 0) {
+        n = snprintf(p, remaining, ",\"projection\":[");
+        p += n;
+        remaining -= n;
+
+        for (size_t i = 0; i < query->field_count; i++) {
+            n = snprintf(p, remaining, "%s\"%s\"", i > 0 ? "," : "", query->fields[i]);
+            p += n;
+            remaining -= n;
+        }
+
+        n = snprintf(p, remaining, "]");
+        p += n;
+        remaining -= n;
+    }
+
+    if (changes) {
+        n = snprintf(p, remaining, ",\"changes\":{\"includeInitial\":%s}",
+                     query->include_initial ? "true" : "false");
+        p += n;
+        remaining -= n;
+    }
+
+    if (mode != SQRL_RESULT_DOCUMENTS) {
+        n = snprintf(p, remaining, ",\"count\":true");
         p += n;
         remaining -= n;
     }
@@ -380,3 +507,19 @@ char* sqrl_query_compile_structured(sqrl_query_t* query) {
 
     return buf;
 }
+
+char* sqrl_query_compile_structured(sqrl_query_t* query) {
+    return query ? compile_structured(query, query->mode, query->is_changes) : NULL;
+}
+
+bool sqrl_query_is_changes(const sqrl_query_t *query) {
+    return query && query->is_changes;
+}
+
+char *sqrl_query_compile_mode(const sqrl_query_t *query, sqrl_result_mode_t mode) {
+    return query ? compile_structured(query, mode, query->is_changes) : NULL;
+}
+
+char *sqrl_query_compile_changes(const sqrl_query_t *query) {
+    return query ? compile_structured(query, query->mode, true) : NULL;
+}
@@ -0,0 +1,29 @@
+/**
+ * SquirrelDB C Client SDK - Query builder internals shared with the client
+ */
+
+#ifndef SQUIRRELDB_SRC_QUERY_H
+#define SQUIRRELDB_SRC_QUERY_H
+
+#include "squirreldb/query.h"
+
+/* Whether sqrl_changes() was called on query */
+bool sqrl_query_is_changes(const sqrl_query_t *query);
+
+/**
+ * Compile query to its structured form in the given result mode, leaving
+ * the builder's own mode as it is
+ * @return Compiled JSON string (must be freed with free()), NULL if a
+ *         field was rejected or out of memory
+ */
+char *sqrl_query_compile_mode(const sqrl_query_t *query, sqrl_result_mode_t mode);
+
+/**
+ * Compile query to its structured form as a changes query, whether or not
+ * sqrl_changes() was called on it
+ * @return Compiled JSON string (must be freed with free()), NULL if a
+ *         field was rejected or out of memory
+ */
+char *sqrl_query_compile_changes(const sqrl_query_t *query);
+
+#endif /* SQUIRRELDB_SRC_QUERY_H */
@@ -0,0 +1,335 @@
+/**
+ * SquirrelDB C Client SDK - DNS Resolver Cache Implementation
+ */
+
+#include "resolver.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#define RESOLVER_MAX_ADDRS            8
+#define RESOLVER_DEFAULT_TTL_MS       30000
+#define RESOLVER_DEFAULT_NEG_TTL_MS   1000
+#define RESOLVER_DEFAULT_MAX_ENTRIES  64
+
+typedef struct {
+  int family;
+  int socktype;
+  int protocol;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+} resolved_addr_t;
+
+/* An entry is pinned while resolving or waiters > 0 and is then never
+ * freed, so threads may drop g_mutex while holding a pointer to it */
+typedef struct resolver_entry {
+  char *host;
+  uint16_t port;
+  resolved_addr_t addrs[RESOLVER_MAX_ADDRS];
+  int count;                 /* 0 caches a failed lookup */
+  bool resolved;             /* addrs/count hold a lookup result */
+  bool resolving;            /* A lookup is in flight */
+  int waiters;
+  uint64_t resolved_ns;
+  uint64_t expires_ns;
+  uint64_t last_used_ns;
+  struct resolver_entry *next;
+} resolver_entry_t;
+
+static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static resolver_entry_t *g_entries;
+static size_t g_entry_count;
+static sqrl_resolver_options_t g_options = {
+  RESOLVER_DEFAULT_TTL_MS,
+  RESOLVER_DEFAULT_NEG_TTL_MS,
+  RESOLVER_DEFAULT_MAX_ENTRIES,
+};
+
+static _Atomic uint64_t g_hits;
+static _Atomic uint64_t g_stale_hits;
+static _Atomic uint64_t g_misses;
+static _Atomic uint64_t g_lookups;
+static _Atomic uint64_t g_failures;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void count_stat(_Atomic uint64_t *stat) {
+  atomic_fetch_add_explicit(stat, 1, memory_order_relaxed);
+}
+
+/* Blocking getaddrinfo(); returns the number of addresses, 0 on failure */
+static int lookup(const char *host, uint16_t port, resolved_addr_t *addrs) {
+  struct addrinfo hints = {0}, *res = NULL;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%u", port);
+
+  count_stat(&g_lookups);
+  if (getaddrinfo(host, port_str, &hints, &res) != 0) {
+    count_stat(&g_failures);
+    return 0;
+  }
+
+  int count = 0;
+  for (struct addrinfo *ai = res; ai && count < RESOLVER_MAX_ADDRS; ai = ai->ai_next) {
+    if (ai->ai_addrlen > sizeof(struct sockaddr_storage)) continue;
+    addrs[count].family = ai->ai_family;
+    addrs[count].socktype = ai->ai_socktype;
+    addrs[count].protocol = ai->ai_protocol;
+    addrs[count].addrlen = ai->ai_addrlen;
+    memcpy(&addrs[count].addr, ai->ai_addr, ai->ai_addrlen);
+    count++;
+  }
+  freeaddrinfo(res);
+
+  if (count == 0) count_stat(&g_failures);
+  return count;
+}
+
+/* Cache table, all helpers below expect g_mutex held */
+
+static bool entry_pinned(const resolver_entry_t *e) {
+  return e->resolving || e->waiters > 0;
+}
+
+static resolver_entry_t *find_entry(const char *host, uint16_t port) {
+  for (resolver_entry_t *e = g_entries; e; e = e->next) {
+    if (e->port == port && strcmp(e->host, host) == 0) return e;
+  }
+  return NULL;
+}
+
+static void unlink_entry(resolver_entry_t *e) {
+  resolver_entry_t **link = &g_entries;
+  while (*link && *link != e) link = &(*link)->next;
+  if (*link) *link = e->next;
+  g_entry_count--;
+  free(e->host);
+  free(e);
+}
+
+static void evict_lru(void) {
+  resolver_entry_t *victim = NULL;
+  for (resolver_entry_t *e = g_entries; e; e = e->next) {
+    if (!entry_pinned(e) && (!victim || e->last_used_ns < victim->last_used_ns)) victim = e;
+  }
+  if (victim) unlink_entry(victim);
+}
+
+static resolver_entry_t *get_entry(const char *host, uint16_t port) {
+  resolver_entry_t *e = find_entry(host, port);
+  if (e) return e;
+
+  if (g_options.max_entries > 0 && g_entry_count >= g_options.max_entries) evict_lru();
+
+  e = calloc(1, sizeof(resolver_entry_t));
+  if (!e) return NULL;
+  e->host = strdup(host);
+  if (!e->host) {
+    free(e);
+    return NULL;
+  }
+  e->port = port;
+  e->next = g_entries;
+  g_entries = e;
+  g_entry_count++;
+  return e;
+}
+
+/* Records a lookup and unpins the entry. A failed refresh keeps the old
+ * addresses, they are still the best guess we have. */
+static void store_result(resolver_entry_t *e, const resolved_addr_t *addrs, int count) {
+  uint64_t now = now_ns();
+  if (count > 0 || !e->resolved) {
+    memcpy(e->addrs, addrs, sizeof(resolved_addr_t) * (size_t)count);
+    e->count = count;
+  }
+  e->resolved = true;
+  e->resolving = false;
+  e->resolved_ns = now;
+  e->expires_ns = now + (uint64_t)(count > 0 ? g_options.ttl_ms : g_options.negative_ttl_ms) * 1000000ull;
+  pthread_cond_broadcast(&g_cond);
+}
+
+static void *refresh_thread_func(void *arg) {
+  resolver_entry_t *e = arg;
+  resolved_addr_t addrs[RESOLVER_MAX_ADDRS];
+
+  int count = lookup(e->host, e->port, addrs);
+
+  pthread_mutex_lock(&g_mutex);
+  store_result(e, addrs, count);
+  pthread_mutex_unlock(&g_mutex);
+  return NULL;
+}
+
+static void start_refresh(resolver_entry_t *e) {
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  e->resolving = true;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&thread, &attr, refresh_thread_func, e) != 0) {
+    e->resolving = false;
+    pthread_cond_broadcast(&g_cond);
+  }
+  pthread_attr_destroy(&attr);
+}
+
+/* Fresh entries are served as is, expired ones are served while a
+ * background refresh runs, and only unknown hosts (or expired failures)
+ * wait for getaddrinfo(), once per host however many threads ask */
+static int resolve(const char *host, uint16_t port, resolved_addr_t *out) {
+  pthread_mutex_lock(&g_mutex);
+  resolver_entry_t *e = g_options.ttl_ms > 0 ? get_entry(host, port) : NULL;
+  if (!e) {
+    pthread_mutex_unlock(&g_mutex);
+    return lookup(host, port, out);
+  }
+
+  e->last_used_ns = now_ns();
+  e->waiters++;
+  for (;;) {
+    uint64_t now = now_ns();
+    if (e->resolved && (now < e->expires_ns || e->count > 0)) {
+      if (now < e->expires_ns) {
+        count_stat(&g_hits);
+      } else {
+        count_stat(&g_stale_hits);
+        if (!e->resolving) start_refresh(e);
+      }
+      int count = e->count;
+      memcpy(out, e->addrs, sizeof(resolved_addr_t) * (size_t)count);
+      e->waiters--;
+      pthread_mutex_unlock(&g_mutex);
+      return count;
+    }
+    if (!e->resolving) break;
+    pthread_cond_wait(&g_cond, &g_mutex);
+  }
+
+  count_stat(&g_misses);
+  e->resolving = true;
+  pthread_mutex_unlock(&g_mutex);
+
+  int count = lookup(host, port, out);
+
+  pthread_mutex_lock(&g_mutex);
+  store_result(e, out, count);
+  e->waiters--;
+  pthread_mutex_unlock(&g_mutex);
+  return count;
+}
+
+/* Expires an entry whose addresses all refused, at most once per
+ * negative TTL so a dead server doesn't turn into a DNS storm */
+static void expire(const char *host, uint16_t port) {
+  pthread_mutex_lock(&g_mutex);
+  resolver_entry_t *e = find_entry(host, port);
+  if (e && e->resolved &&
+      now_ns() - e->resolved_ns >= (uint64_t)g_options.negative_ttl_ms * 1000000ull) {
+    e->expires_ns = 0;
+  }
+  pthread_mutex_unlock(&g_mutex);
+}
+
+int sqrl_resolver_connect(const char *host, uint16_t port) {
+  resolved_addr_t addrs[RESOLVER_MAX_ADDRS];
+  int count = resolve(host, port, addrs);
+
+  for (int i = 0; i < count; i++) {
+    int fd = socket(addrs[i].family, addrs[i].socktype, addrs[i].protocol);
+    if (fd < 0) continue;
+
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+#ifdef SO_NOSIGPIPE
+    /* A write to a dropped connection fails with EPIPE instead of killing the process */
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &flag, sizeof(flag));
+#endif
+
+    if (connect(fd, (struct sockaddr *)&addrs[i].addr, addrs[i].addrlen) == 0) return fd;
+    close(fd);
+  }
+
+  if (count > 0) expire(host, port);
+  return -1;
+}
+
+/* Public API */
+
+sqrl_resolver_options_t sqrl_resolver_options_default(void) {
+  sqrl_resolver_options_t opts = {
+    .ttl_ms = RESOLVER_DEFAULT_TTL_MS,
+    .negative_ttl_ms = RESOLVER_DEFAULT_NEG_TTL_MS,
+    .max_entries = RESOLVER_DEFAULT_MAX_ENTRIES,
+  };
+  return opts;
+}
+
+void sqrl_resolver_configure(const sqrl_resolver_options_t *options) {
+  pthread_mutex_lock(&g_mutex);
+  g_options = options ? *options : sqrl_resolver_options_default();
+  if (g_options.negative_ttl_ms < 0) g_options.negative_ttl_ms = 0;
+  pthread_mutex_unlock(&g_mutex);
+}
+
+void sqrl_resolver_prefetch(const char *host, uint16_t port) {
+  if (!host) return;
+
+  pthread_mutex_lock(&g_mutex);
+  resolver_entry_t *e = g_options.ttl_ms > 0 ? get_entry(host, port) : NULL;
+  if (e && !e->resolving && !(e->resolved && now_ns() < e->expires_ns)) {
+    e->last_used_ns = now_ns();
+    start_refresh(e);
+  }
+  pthread_mutex_unlock(&g_mutex);
+}
+
+void sqrl_resolver_flush(void) {
+  pthread_mutex_lock(&g_mutex);
+  resolver_entry_t *e = g_entries;
+  while (e) {
+    resolver_entry_t *next = e->next;
+    if (entry_pinned(e)) {
+      e->expires_ns = 0;
+    } else {
+      unlink_entry(e);
+    }
+    e = next;
+  }
+  pthread_mutex_unlock(&g_mutex);
+}
+
+void sqrl_resolver_get_stats(sqrl_resolver_stats_t *stats_out) {
+  if (!stats_out) return;
+
+  memset(stats_out, 0, sizeof(*stats_out));
+  stats_out->hits = atomic_load_explicit(&g_hits, memory_order_relaxed);
+  stats_out->stale_hits = atomic_load_explicit(&g_stale_hits, memory_order_relaxed);
+  stats_out->misses = atomic_load_explicit(&g_misses, memory_order_relaxed);
+  stats_out->lookups = atomic_load_explicit(&g_lookups, memory_order_relaxed);
+  stats_out->failures = atomic_load_explicit(&g_failures, memory_order_relaxed);
+
+  pthread_mutex_lock(&g_mutex);
+  stats_out->entries = g_entry_count;
+  pthread_mutex_unlock(&g_mutex);
+}
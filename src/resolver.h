@@ -0,0 +1,20 @@
+/**
+ * SquirrelDB C Client SDK - Resolver internals shared by the client and cache
+ */
+
+#ifndef SQUIRRELDB_SRC_RESOLVER_H
+#define SQUIRRELDB_SRC_RESOLVER_H
+
+#include "squirreldb/resolver.h"
+
+#include <stdint.h>
+
+/**
+ * Open a TCP connection to host:port with TCP_NODELAY set, trying each
+ * cached address in turn. A host none of whose addresses accept is
+ * dropped from the cache so the next attempt resolves it again.
+ * @return Connected socket, or -1
+ */
+int sqrl_resolver_connect(const char *host, uint16_t port);
+
+#endif /* SQUIRRELDB_SRC_RESOLVER_H */
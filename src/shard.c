@@ -0,0 +1,244 @@
+/**
+ * SquirrelDB C Client SDK - Sharded Client Implementation
+ */
+
+#include "squirreldb/shard.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+typedef struct shard_task {
+  sqrl_shard_task_t fn;
+  void *user_data;
+  struct shard_task *next;
+} shard_task_t;
+
+#define CACHE_LINE 64
+
+/* Only the owner submits on client and drains inbox; other threads only
+ * push to inbox, with a CAS, so nothing here takes a lock. Each shard has
+ * a cache line to itself so polling one inbox never bounces another's. */
+typedef struct {
+  _Alignas(CACHE_LINE) sqrl_client_t *client;
+  _Atomic(shard_task_t *) inbox;   /* Newest first */
+  atomic_bool owned;
+} shard_t;
+
+struct sqrl_shards {
+  shard_t *shards;
+  int count;
+};
+
+/* The calling thread's shard; one group per thread at a time */
+static _Thread_local const sqrl_shards_t *t_group;
+static _Thread_local int t_index = -1;
+
+/* Reverses the newest-first inbox so tasks run in posting order */
+static shard_task_t *take_inbox(shard_t *shard) {
+  shard_task_t *task = atomic_exchange_explicit(&shard->inbox, NULL, memory_order_acquire);
+  shard_task_t *ordered = NULL;
+  while (task) {
+    shard_task_t *next = task->next;
+    task->next = ordered;
+    ordered = task;
+    task = next;
+  }
+  return ordered;
+}
+
+static size_t run_tasks(shard_task_t *task, sqrl_client_t *client) {
+  size_t ran = 0;
+  while (task) {
+    shard_task_t *next = task->next;
+    task->fn(client, task->user_data);
+    free(task);
+    task = next;
+    ran++;
+  }
+  return ran;
+}
+
+/* Pins the thread to the n-th CPU of its current affinity mask. Only Linux
+ * exposes thread affinity; elsewhere this does nothing. */
+static void pin_thread(int n) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) != 0) return;
+  int cpus = CPU_COUNT(&allowed);
+  if (cpus <= 0) return;
+
+  int target = n % cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    if (target-- == 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      return;
+    }
+  }
+#else
+  (void)n;
+#endif
+}
+
+/* Public API */
+
+sqrl_error_t sqrl_shards_connect(sqrl_shards_t **shards_out, const char *host, uint16_t port,
+                                 const sqrl_options_t *options, int count) {
+  if (!shards_out || !host || count < 0) return SQRL_ERR_INVALID_ARG;
+  *shards_out = NULL;
+
+  if (count == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = cpus > 0 ? (int)cpus : 1;
+  }
+
+  sqrl_shards_t *group = calloc(1, sizeof(sqrl_shards_t));
+  if (!group) return SQRL_ERR_MEMORY;
+  /* calloc only guarantees max_align_t; sizeof(shard_t) is a multiple of
+   * the cache line, as aligned_alloc requires */
+  group->shards = aligned_alloc(CACHE_LINE, (size_t)count * sizeof(shard_t));
+  if (!group->shards) {
+    free(group);
+    return SQRL_ERR_MEMORY;
+  }
+  memset(group->shards, 0, (size_t)count * sizeof(shard_t));
+
+  for (int i = 0; i < count; i++) {
+    atomic_init(&group->shards[i].inbox, NULL);
+    atomic_init(&group->shards[i].owned, false);
+    sqrl_error_t err = sqrl_connect(&group->shards[i].client, host, port, options);
+    if (err != SQRL_OK) {
+      sqrl_shards_disconnect(group);
+      return err;
+    }
+    group->count = i + 1;
+  }
+
+  *shards_out = group;
+  return SQRL_OK;
+}
+
+void sqrl_shards_disconnect(sqrl_shards_t *shards) {
+  if (!shards) return;
+
+  for (int i = 0; i < shards->count; i++) {
+    run_tasks(take_inbox(&shards->shards[i]), NULL);
+    sqrl_disconnect(shards->shards[i].client);
+  }
+  if (t_group == shards) {
+    t_group = NULL;
+    t_index = -1;
+  }
+  free(shards->shards);
+  free(shards);
+}
+
+int sqrl_shards_count(const sqrl_shards_t *shards) {
+  return shards ? shards->count : 0;
+}
+
+sqrl_error_t sqrl_shards_attach(sqrl_shards_t *shards, int index, bool pin) {
+  if (!shards || index < 0 || index >= shards->count) return SQRL_ERR_INVALID_ARG;
+  if (t_group == shards && t_index == index) return SQRL_OK;
+  if (t_group) return SQRL_ERR_INVALID_ARG;
+
+  bool expected = false;
+  if (!atomic_compare_exchange_strong(&shards->shards[index].owned, &expected, true)) {
+    return SQRL_ERR_INVALID_ARG;
+  }
+  t_group = shards;
+  t_index = index;
+  if (pin) pin_thread(index);
+  return SQRL_OK;
+}
+
+void sqrl_shards_detach(sqrl_shards_t *shards) {
+  if (!shards || t_group != shards) return;
+  atomic_store(&shards->shards[t_index].owned, false);
+  t_group = NULL;
+  t_index = -1;
+}
+
+sqrl_client_t *sqrl_shard_client(const sqrl_shards_t *shards) {
+  if (!shards || t_group != shards) return NULL;
+  return shards->shards[t_index].client;
+}
+
+int sqrl_shard_index(const sqrl_shards_t *shards) {
+  return shards && t_group == shards ? t_index : -1;
+}
+
+sqrl_error_t sqrl_shards_post(sqrl_shards_t *shards, int index, sqrl_shard_task_t task, void *user_data) {
+  if (!shards || index < 0 || index >= shards->count || !task) return SQRL_ERR_INVALID_ARG;
+
+  shard_task_t *node = malloc(sizeof(shard_task_t));
+  if (!node) return SQRL_ERR_MEMORY;
+  node->fn = task;
+  node->user_data = user_data;
+
+  /* The owner only ever swaps the whole list out, so there is no ABA */
+  shard_t *shard = &shards->shards[index];
+  node->next = atomic_load_explicit(&shard->inbox, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&shard->inbox, &node->next, node,
+                                                memory_order_release, memory_order_relaxed)) {
+  }
+  return SQRL_OK;
+}
+
+size_t sqrl_shards_poll(sqrl_shards_t *shards) {
+  if (!shards || t_group != shards) return 0;
+  shard_t *shard = &shards->shards[t_index];
+  if (!atomic_load_explicit(&shard->inbox, memory_order_relaxed)) return 0;
+  return run_tasks(take_inbox(shard), shard->client);
+}
+
+void sqrl_shards_get_stats(const sqrl_shards_t *shards, sqrl_stats_t *stats_out) {
+  if (!stats_out) return;
+  memset(stats_out, 0, sizeof(*stats_out));
+  if (!shards) return;
+
+  double batch_frames = 0;
+  uint64_t batch_delay_us = 0;
+  for (int i = 0; i < shards->count; i++) {
+    sqrl_stats_t s;
+    sqrl_get_stats(shards->shards[i].client, &s);
+
+    stats_out->frames_sent += s.frames_sent;
+    stats_out->bytes_sent += s.bytes_sent;
+    stats_out->frames_received += s.frames_received;
+    stats_out->bytes_received += s.bytes_received;
+    stats_out->requests_completed += s.requests_completed;
+    stats_out->requests_timed_out += s.requests_timed_out;
+    for (int b = 0; b < SQRL_LATENCY_BUCKETS; b++) stats_out->latency_buckets[b] += s.latency_buckets[b];
+    stats_out->latency_count += s.latency_count;
+    stats_out->latency_sum_us += s.latency_sum_us;
+    stats_out->batches_flushed += s.batches_flushed;
+    batch_frames += s.avg_batch_frames * (double)s.batches_flushed;
+    batch_delay_us += s.avg_batch_delay_us * s.batches_flushed;
+    if (s.batch_window_us > stats_out->batch_window_us) stats_out->batch_window_us = s.batch_window_us;
+    stats_out->hedges_sent += s.hedges_sent;
+    stats_out->hedges_won += s.hedges_won;
+    stats_out->connections += s.connections;
+    stats_out->bulk_requests += s.bulk_requests;
+    stats_out->coalesced_queries += s.coalesced_queries;
+    stats_out->cache_hits += s.cache_hits;
+    stats_out->cache_misses += s.cache_misses;
+    stats_out->cache_invalidations += s.cache_invalidations;
+    stats_out->concurrency_limit += s.concurrency_limit;
+    stats_out->in_flight += s.in_flight;
+    stats_out->requests_rejected += s.requests_rejected;
+    stats_out->breaker_opens += s.breaker_opens;
+    stats_out->breaker_open |= s.breaker_open;
+  }
+  if (stats_out->batches_flushed > 0) {
+    stats_out->avg_batch_frames = batch_frames / (double)stats_out->batches_flushed;
+    stats_out->avg_batch_delay_us = batch_delay_us / stats_out->batches_flushed;
+  }
+}
@@ -5,6 +5,10 @@
  */
 
 #include "squirreldb.h"
+#include "squirreldb/query.h"
+#include "squirreldb/patch.h"
+#include "query.h"
+#include "resolver.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,10 +23,20 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <time.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <ctype.h>
+#include <sys/random.h>
 
 /* Protocol constants */
 static const uint8_t MAGIC[4] = {'S', 'Q', 'R', 'L'};
 
+/* Without MSG_NOSIGNAL (macOS) sockets get SO_NOSIGPIPE in the resolver */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 /* Message types */
 #define MSG_TYPE_REQUEST      0x01
 #define MSG_TYPE_RESPONSE     0x02
@@ -33,7 +47,49 @@ static const uint8_t MAGIC[4] = {'S', 'Q', 'R', 'L'};
 #define HANDSHAKE_VERSION_MISMATCH 0x01
 #define HANDSHAKE_AUTH_FAILED     0x02
 
+/* Write batching */
+#define BATCH_DEFAULT_MAX_BYTES (64 * 1024)
+#define BATCH_INITIAL_CAPACITY  4096
+
+/* Request hedging */
+#define LATENCY_DECAY_SAMPLES   1024   /* Halve the recent-latency window this often */
+#define HEDGE_MIN_SAMPLES       32
+
+/* Concurrency limiting */
+#define LIMIT_INITIAL           16
+#define LIMIT_RTT_TOLERANCE     2.0    /* RTT over min_rtt * this counts as queueing */
+#define LIMIT_BACKOFF           0.9
+#define LIMIT_RTT_WINDOW_NS     (10ull * 1000000000ull)  /* min_rtt is re-learned this often */
+
+/* Connection striping */
+#define MAX_CONNECTIONS         16
+#define BULK_KEY_SLOTS          64     /* Queries remembered as having large replies */
+
+/* Result cache */
+#define CACHE_DEFAULT_MAX_ENTRIES 256
+#define CACHE_DEFAULT_MAX_BYTES   (4 * 1024 * 1024)
+
+/* Feed sharing */
+#define TRACKED_MAX_BYTES       (1024 * 1024)  /* Larger result sets stop being shared */
+
+typedef enum {
+  BREAKER_CLOSED,
+  BREAKER_OPEN,
+  BREAKER_HALF_OPEN,
+} breaker_state_t;
+
+typedef enum {
+  OUTCOME_OK,
+  OUTCOME_FAILED,
+  OUTCOME_CANCELLED,
+} request_outcome_t;
+
 /* Internal structures */
+struct pending_request;
+
+/* Completes an async request; consumes response (NULL when err != SQRL_OK) */
+typedef void (*pending_done_t)(struct pending_request *req, sqrl_error_t err, char *response);
+
 typedef struct pending_request {
   char *id;
   char *response;
@@ -41,38 +97,299 @@ typedef struct pending_request {
   bool completed;
   pthread_cond_t cond;
   pthread_mutex_t mutex;
+  uint64_t sent_ns;
+  char op[16];               /* Request "type", for sqrl_debug_snapshot() */
+  size_t bytes;              /* Request payload size */
+  char *queued;              /* Frame held back until a lazy connect completes */
+  uint64_t bulk_key;         /* Hash of a query's text, 0 for other requests */
+  struct sqrl_client *client;
+  bool admitted;             /* Holds a concurrency slot */
+  bool blocking;             /* Completes async but a caller waits on it, so it may wait for a slot */
+  bool probe;                /* Half-open circuit breaker probe */
+
+  /* Async completion; NULL when a caller blocks on cond instead */
+  pending_done_t done;
+  union {
+    sqrl_result_callback_t result;
+    sqrl_document_callback_t document;
+  } callback;
+  void *user_data;
+
   struct pending_request *next;
 } pending_request_t;
 
+/* Latency histogram; bucket i counts samples in [2^i, 2^(i+1)) microseconds */
+typedef struct {
+  _Atomic uint64_t buckets[SQRL_LATENCY_BUCKETS];
+  _Atomic uint64_t count;
+  _Atomic uint64_t sum_us;
+} latency_hist_t;
+
+typedef enum {
+  FEED_PENDING,              /* Server subscribe in flight */
+  FEED_ACTIVE,
+  FEED_FAILED,
+} feed_status_t;
+
+/* One server-side subscription, shared by every sqrl_subscribe() call with
+ * the same canonical query. Fields are guarded by subs_mutex, except
+ * listeners and the tracked documents, which belong to deliver_mutex. */
 typedef struct subscription_entry {
-  char *id;
-  sqrl_change_callback_t callback;
-  void *user_data;
+  char *id;                  /* Server subscription id */
+  char *key;                 /* Canonical query */
+  int refs;                  /* Handles attached */
+  feed_status_t status;
+  sqrl_error_t error;
+  bool linked;               /* Still in client->subscriptions */
+  bool shareable;            /* Late joiners can be replayed the current results */
+  int dispatching;           /* Deliveries queued or running outside subs_mutex */
+  bool orphaned;             /* Released from a callback; the last delivery frees it */
+  int unacked;               /* Events delivered since credits were last granted */
+  uint64_t callback_start_ns;
+  uint64_t last_event_ns;
+  uint64_t events_delivered;
+
+  /* Change-feed lag, see sqrl_subscription_stats_t */
+  latency_hist_t lag_total;
+  latency_hist_t lag_network;
+  latency_hist_t lag_queue;
+  latency_hist_t lag_callback;
+
+  pthread_mutex_t deliver_mutex;
+  struct sqrl_subscription *listeners;
+
+  /* Current result set as id/document JSON pairs, kept from the start for
+   * feeds that send initial documents so late joiners get the same initial
+   * events. Other feeds have nothing to replay and keep nothing. */
+  bool tracking;
+  char **doc_ids;
+  char **docs;
+  size_t doc_count;
+  size_t doc_cap;
+  size_t tracked_bytes;
+
   struct subscription_entry *next;
 } subscription_entry_t;
 
+/* A change event waiting for the dispatcher thread */
+typedef struct change_item {
+  subscription_entry_t *entry;
+  char *json;
+  uint64_t received_ns;
+  int64_t received_us;       /* Wall clock, for lag against the commit time */
+  struct change_item *next;
+} change_item_t;
+
+/* An extra socket of a striped client. Its reader thread completes requests
+ * in the owning client's pending table; frames are written directly, without
+ * write batching. */
+typedef struct {
+  struct sqrl_client *client;
+  int fd;
+  pthread_mutex_t write_mutex;
+  pthread_t reader_thread;
+  bool reader_started;
+} stripe_t;
+
+/* A sqrl_query() in progress that identical concurrent queries wait on */
+typedef struct query_flight {
+  char *query;
+  int refs;                  /* Leader plus followers, guarded by flight_mutex */
+  bool done;
+  sqrl_error_t error;
+  char *result;              /* Copy of the leader's result for the followers */
+  pthread_cond_t cond;
+  struct query_flight *next;
+} query_flight_t;
+
+/* A cached sqrl_query() result */
+typedef struct cached_result {
+  char *key;                 /* Canonical query */
+  uint64_t hash;
+  char *table;
+  char *result;
+  size_t bytes;
+  uint64_t expires_ns;
+  uint64_t last_used_ns;
+  struct cached_result *next;
+} cached_result_t;
+
+/* Invalidation state for one table with cached results. Records are only
+ * freed with the client, so change callbacks may hold on to one. */
+typedef struct cache_feed {
+  struct sqrl_client *client;
+  char *table;
+  uint64_t generation;       /* Bumped by every change to the table */
+  sqrl_subscription_t *sub;  /* Change feed, NULL if it couldn't be opened */
+  struct cache_feed *next;
+} cache_feed_t;
+
+typedef struct interned_name {
+  struct interned_name *next;
+  uint64_t hash;
+  size_t len;
+  char name[];
+} interned_name_t;
+
 struct sqrl_client {
   int fd;
   char *session_id;
   sqrl_encoding_t encoding;
-  bool connected;
-  uint64_t request_id;
+  atomic_bool connected;
+  bool reader_started;
+  _Atomic uint64_t request_id;
   int request_timeout_ms;
 
   pthread_t reader_thread;
-  bool reader_running;
+  atomic_bool reader_running;
 
   pthread_mutex_t write_mutex;
   pthread_mutex_t pending_mutex;
   pending_request_t *pending_requests;
 
+  /* Lazy connect: connecting and connect_error are guarded by pending_mutex,
+   * ready_cond is signalled once the background connect settles */
+  bool connecting;
+  sqrl_error_t connect_error;
+  pthread_cond_t ready_cond;
+  pthread_t connect_thread;
+  bool connect_thread_started;
+  char *host;
+  uint16_t port;
+  sqrl_options_t options;    /* Copy with owned strings */
+
   pthread_mutex_t subs_mutex;
+  pthread_cond_t subs_cond;
   subscription_entry_t *subscriptions;
+
+  /* Write batching (enabled when batch_max_window_us > 0) */
+  int batch_max_window_us;
+  int batch_window_us;
+  size_t batch_max_bytes;
+  pthread_mutex_t flush_mutex;
+  pthread_cond_t batch_cond;
+  pthread_t writer_thread;
+  bool writer_running;
+  uint8_t *batch_buf;
+  uint8_t *batch_spare;
+  size_t batch_len;
+  size_t batch_cap;
+  size_t batch_spare_cap;
+  size_t batch_frames;
+  uint64_t batch_first_ns;
+  uint64_t batch_enqueue_sum_ns;
+
+  /* Hedged reads go to a second connection once a query outlives
+   * hedge_percentile of recent_latency. A lazy connect publishes it after
+   * the primary is up, so readers load it once per query */
+  _Atomic(sqrl_client_t *) hedge;
+  double hedge_percentile;
+  uint64_t hedge_min_delay_ns;
+  latency_hist_t recent_latency;
+
+  /* Striping: requests rotate over the primary socket and stripes[], except
+   * that requests, and queries whose last reply was, at least bulk_threshold
+   * bytes go to the bulk socket so they can't delay small replies */
+  stripe_t *stripes;
+  size_t stripe_count;
+  stripe_t *bulk;
+  size_t bulk_threshold;
+  _Atomic uint64_t next_stripe;
+  _Atomic uint64_t bulk_keys[BULK_KEY_SLOTS];
+
+  /* Flow-controlled change delivery (credits > 0): the reader queues
+   * events and the dispatcher thread runs the callbacks, guarded by
+   * dispatch_mutex */
+  int credits;
+  pthread_mutex_t dispatch_mutex;
+  pthread_cond_t dispatch_cond;
+  change_item_t *changes_head;
+  change_item_t *changes_tail;
+  pthread_t dispatcher_thread;
+  bool dispatcher_started;
+  bool dispatcher_stop;
+
+  /* Collection names shared by compact documents; append-only, readers
+   * walk it without a lock and intern_mutex serialises additions */
+  bool compact_documents;
+  pthread_mutex_t intern_mutex;
+  _Atomic(struct interned_name *) interned;
+
+  /* Single-flight reads (coalesce_reads), in flight list guarded by
+   * flight_mutex */
+  bool coalesce_reads;
+  pthread_mutex_t flight_mutex;
+  query_flight_t *flights;
+
+  /* Result cache (enabled when cache_ttl_ns > 0), guarded by cache_mutex;
+   * cache_feed_mutex serialises opening invalidation feeds */
+  uint64_t cache_ttl_ns;
+  size_t cache_max_entries;
+  size_t cache_max_bytes;
+  pthread_mutex_t cache_mutex;
+  pthread_mutex_t cache_feed_mutex;
+  cached_result_t *cache_entries;
+  size_t cache_entry_count;
+  size_t cache_bytes;
+  cache_feed_t *cache_feeds;
+
+  /* Adaptive concurrency limit (AIMD on round-trip latency) and circuit
+   * breaker, both guarded by limit_mutex */
+  pthread_mutex_t limit_mutex;
+  pthread_cond_t limit_cond;
+  int max_concurrency;
+  double limit;
+  int in_flight;
+  uint64_t min_rtt_ns;
+  uint64_t min_rtt_since_ns;
+  uint64_t last_backoff_ns;
+  int breaker_threshold;
+  uint64_t breaker_cooldown_ns;
+  breaker_state_t breaker;
+  int consecutive_failures;
+  uint64_t breaker_open_until;
+  bool probe_in_flight;
+
+  /* Statistics, updated without holding any lock */
+  _Atomic uint64_t stat_frames_sent;
+  _Atomic uint64_t stat_bytes_sent;
+  _Atomic uint64_t stat_frames_received;
+  _Atomic uint64_t stat_bytes_received;
+  _Atomic uint64_t stat_timeouts;
+  latency_hist_t request_latency;
+  _Atomic uint64_t stat_batches;
+  _Atomic uint64_t stat_batched_frames;
+  _Atomic uint64_t stat_batch_delay_ns;
+  _Atomic int stat_batch_window_us;
+  _Atomic uint64_t stat_hedges_sent;
+  _Atomic uint64_t stat_hedges_won;
+  _Atomic int stat_connections;
+  _Atomic uint64_t stat_bulk_requests;
+  _Atomic uint64_t stat_coalesced;
+  _Atomic uint64_t stat_cache_hits;
+  _Atomic uint64_t stat_cache_misses;
+  _Atomic uint64_t stat_cache_invalidations;
+  _Atomic int stat_limit;
+  _Atomic int stat_in_flight;
+  _Atomic uint64_t stat_rejected;
+  _Atomic uint64_t stat_breaker_opens;
+  _Atomic bool stat_breaker_open;
 };
 
 struct sqrl_subscription {
-  char *id;
   sqrl_client_t *client;
+  subscription_entry_t *entry;
+  sqrl_change_callback_t callback;
+  void *user_data;
+  atomic_bool removed;             /* Unsubscribed from a callback, not yet swept */
+
+  /* A late joiner is replayed outside deliver_mutex; live events that
+   * arrive meanwhile queue behind the replay. Guarded by deliver_mutex. */
+  bool replaying;
+  change_item_t *backlog;
+  change_item_t *backlog_tail;
+
+  struct sqrl_subscription *next;  /* In entry->listeners */
 };
 
 /* Global init flag */
@@ -104,6 +421,167 @@ static void write_u16_be(uint8_t *buf, uint16_t val) {
   buf[1] = val & 0xFF;
 }
 
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Wall clock in microseconds since the Unix epoch */
+static int64_t wall_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Days from 1970-01-01 to y-m-d in the proleptic Gregorian calendar */
+static int64_t days_from_civil(int64_t y, int m, int d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static int days_in_month(int y, int m) {
+  static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+  return m == 2 && leap ? 29 : days[m - 1];
+}
+
+/* Reads exactly n digits; -1 if any is missing */
+static int read_digits(const char **p, int n) {
+  int value = 0;
+  for (int i = 0; i < n; i++, (*p)++) {
+    if (!isdigit((unsigned char)**p)) return -1;
+    value = value * 10 + (**p - '0');
+  }
+  return value;
+}
+
+/* Parses an RFC 3339 timestamp such as 2024-01-01T00:00:00.123456789Z into
+ * nanoseconds since the Unix epoch; 0 if malformed. Doesn't allocate or
+ * consult the time zone, so it is cheap enough to run on every document. */
+static int64_t parse_timestamp_ns(const char *s) {
+  const char *p = s;
+  int year = read_digits(&p, 4);
+  if (year < 0 || *p++ != '-') return 0;
+  int month = read_digits(&p, 2);
+  if (month < 1 || month > 12 || *p++ != '-') return 0;
+  int day = read_digits(&p, 2);
+  if (day < 1 || day > days_in_month(year, month) || (*p != 'T' && *p != 't' && *p != ' ')) return 0;
+  p++;
+  int hour = read_digits(&p, 2);
+  if (hour < 0 || hour > 23 || *p++ != ':') return 0;
+  int minute = read_digits(&p, 2);
+  if (minute < 0 || minute > 59 || *p++ != ':') return 0;
+  int second = read_digits(&p, 2);
+  if (second < 0 || second > 60) return 0;  /* 60 is a leap second */
+
+  int64_t frac_ns = 0;
+  if (*p == '.') {
+    int digits = 0;
+    for (p++; isdigit((unsigned char)*p); p++) {
+      if (digits < 9) {
+        frac_ns = frac_ns * 10 + (*p - '0');
+        digits++;
+      }
+    }
+    while (digits++ < 9) frac_ns *= 10;
+  }
+
+  int64_t offset_s = 0;
+  if (*p == '+' || *p == '-') {
+    const char *q = p + 1;
+    int hours = read_digits(&q, 2);
+    if (hours < 0 || hours > 23 || *q++ != ':') return 0;
+    int minutes = read_digits(&q, 2);
+    if (minutes < 0 || minutes > 59) return 0;
+    offset_s = (int64_t)(hours * 3600 + minutes * 60) * (*p == '-' ? -1 : 1);
+  } else if (*p != 'Z' && *p != 'z') {
+    return 0;
+  }
+
+  int64_t secs = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset_s;
+  return secs * 1000000000 + frac_ns;
+}
+
+/* Absolute CLOCK_REALTIME deadline for pthread_cond_timedwait() */
+static struct timespec deadline_after_ns(uint64_t ns) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += (time_t)(ns / 1000000000ull);
+  ts.tv_nsec += (long)(ns % 1000000000ull);
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  return ts;
+}
+
+static int latency_bucket(uint64_t us) {
+  int bucket = 0;
+  while (us > 1 && bucket < SQRL_LATENCY_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+static void latency_record(latency_hist_t *hist, uint64_t ns) {
+  atomic_fetch_add_explicit(&hist->buckets[latency_bucket(ns / 1000)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum_us, ns / 1000, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+}
+
+static void copy_histogram(const latency_hist_t *hist, sqrl_histogram_t *out) {
+  for (int i = 0; i < SQRL_LATENCY_BUCKETS; i++) {
+    out->buckets[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+  }
+  out->count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+  out->sum_us = atomic_load_explicit(&hist->sum_us, memory_order_relaxed);
+}
+
+/* Records a sample, periodically halving the buckets so percentiles follow
+ * recent traffic. The decay races with concurrent recorders, which only
+ * costs a sample or two of accuracy. */
+static void latency_record_recent(latency_hist_t *hist, uint64_t ns) {
+  atomic_fetch_add_explicit(&hist->buckets[latency_bucket(ns / 1000)], 1, memory_order_relaxed);
+  uint64_t count = atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed) + 1;
+  if (count % LATENCY_DECAY_SAMPLES != 0) return;
+
+  for (int i = 0; i < SQRL_LATENCY_BUCKETS; i++) {
+    uint64_t n = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    atomic_store_explicit(&hist->buckets[i], n / 2, memory_order_relaxed);
+  }
+}
+
+/* Interpolated percentile in nanoseconds, 0 if there are too few samples */
+static uint64_t latency_percentile(latency_hist_t *hist, double percentile) {
+  uint64_t counts[SQRL_LATENCY_BUCKETS];
+  uint64_t total = 0;
+  for (int i = 0; i < SQRL_LATENCY_BUCKETS; i++) {
+    counts[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total < HEDGE_MIN_SAMPLES) return 0;
+
+  double rank = total * percentile / 100.0;
+  double seen = 0;
+  for (int i = 0; i < SQRL_LATENCY_BUCKETS; i++) {
+    if (counts[i] == 0) continue;
+    if (seen + counts[i] >= rank) {
+      double lo = i == 0 ? 0 : (double)(1ull << i);
+      double hi = (double)(1ull << (i + 1));
+      double us = lo + (hi - lo) * (rank - seen) / counts[i];
+      return (uint64_t)(us * 1000.0);
+    }
+    seen += counts[i];
+  }
+  return (uint64_t)(1ull << SQRL_LATENCY_BUCKETS) * 1000;
+}
+
 static void uuid_to_string(const uint8_t *bytes, char *out) {
   sprintf(out,
     "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
@@ -113,35 +591,122 @@ static void uuid_to_string(const uint8_t *bytes, char *out) {
     bytes[12], bytes[13], bytes[14], bytes[15]);
 }
 
-/* Simple JSON string extraction */
-static char *json_get_string(const char *json, const char *key) {
-  char search[256];
-  snprintf(search, sizeof(search), "\"%s\":\"", key);
-
-  const char *start = strstr(json, search);
-  if (!start) {
-    snprintf(search, sizeof(search), "\"%s\":", key);
-    start = strstr(json, search);
-    if (!start) return NULL;
-    start += strlen(search);
-    while (*start == ' ' || *start == '\t') start++;
-    if (*start == '"') {
-      start++;
-      const char *end = strchr(start, '"');
-      if (!end) return NULL;
-      size_t len = end - start;
-      char *result = malloc(len + 1);
-      if (!result) return NULL;
-      memcpy(result, start, len);
-      result[len] = '\0';
-      return result;
+/* Minimal JSON helpers
+ *
+ * Lookups only match keys of the outermost object, so fields nested inside
+ * a document's data never shadow the envelope's own fields.
+ */
+
+static const char *json_skip_ws(const char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
+  return p;
+}
+
+static const char *json_string_end(const char *p) {
+  /* p points at the opening quote; returns one past the closing quote */
+  for (p++; *p; p++) {
+    if (*p == '\\' && p[1]) p++;
+    else if (*p == '"') return p + 1;
+  }
+  return NULL;
+}
+
+static const char *json_value_end(const char *p) {
+  if (*p == '"') return json_string_end(p);
+
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (*p) {
+      if (*p == '"') {
+        p = json_string_end(p);
+        if (!p) return NULL;
+        continue;
+      }
+      if (*p == '{' || *p == '[') depth++;
+      else if (*p == '}' || *p == ']') {
+        if (--depth == 0) return p + 1;
+      }
+      p++;
     }
     return NULL;
   }
 
-  start += strlen(search);
-  const char *end = strchr(start, '"');
+  while (*p && *p != ',' && *p != '}' && *p != ']' &&
+         *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+  return p;
+}
+
+static const char *json_find_value(const char *json, const char *key) {
+  size_t key_len = strlen(key);
+  const char *p = json_skip_ws(json);
+  if (*p != '{') return NULL;
+  p++;
+
+  while (*(p = json_skip_ws(p)) == '"') {
+    const char *name = p + 1;
+    const char *name_end = json_string_end(p);
+    if (!name_end) return NULL;
+
+    p = json_skip_ws(name_end);
+    if (*p != ':') return NULL;
+    p = json_skip_ws(p + 1);
+
+    if ((size_t)(name_end - 1 - name) == key_len && memcmp(name, key, key_len) == 0) {
+      return p;
+    }
+
+    p = json_value_end(p);
+    if (!p) return NULL;
+    p = json_skip_ws(p);
+    if (*p == ',') p++;
+  }
+  return NULL;
+}
+
+static char *json_copy_string(const char *start, const char *end) {
+  /* Copies the body of a JSON string (quotes excluded), resolving escapes */
+  char *result = malloc(end - start + 1);
+  if (!result) return NULL;
+
+  char *out = result;
+  for (const char *p = start; p < end; p++) {
+    if (*p != '\\' || p + 1 >= end) {
+      *out++ = *p;
+      continue;
+    }
+    switch (*++p) {
+      case 'n': *out++ = '\n'; break;
+      case 't': *out++ = '\t'; break;
+      case 'r': *out++ = '\r'; break;
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'u':
+        /* Non-ASCII escapes are kept verbatim */
+        *out++ = '\\';
+        *out++ = 'u';
+        break;
+      default: *out++ = *p; break;
+    }
+  }
+  *out = '\0';
+  return result;
+}
+
+static char *json_get_string(const char *json, const char *key) {
+  const char *start = json_find_value(json, key);
+  if (!start || *start != '"') return NULL;
+
+  const char *end = json_string_end(start);
   if (!end) return NULL;
+  return json_copy_string(start + 1, end - 1);
+}
+
+static char *json_get_raw(const char *json, const char *key) {
+  const char *start = json_find_value(json, key);
+  if (!start) return NULL;
+
+  const char *end = json_value_end(start);
+  if (!end || end == start) return NULL;
 
   size_t len = end - start;
   char *result = malloc(len + 1);
@@ -151,32 +716,287 @@ static char *json_get_string(const char *json, const char *key) {
   return result;
 }
 
+/* Returns the integer value of key, or 0 if it is absent or not a number */
+static int64_t json_get_int64(const char *json, const char *key) {
+  const char *start = json_find_value(json, key);
+  if (!start || (*start != '-' && !isdigit((unsigned char)*start))) return 0;
+  return strtoll(start, NULL, 10);
+}
+
 static char *json_get_object(const char *json, const char *key) {
-  char search[256];
-  snprintf(search, sizeof(search), "\"%s\":", key);
+  const char *start = json_find_value(json, key);
+  if (!start || *start != '{') return NULL;
+  return json_get_raw(json, key);
+}
 
-  const char *start = strstr(json, search);
-  if (!start) return NULL;
-  start += strlen(search);
-  while (*start == ' ' || *start == '\t' || *start == '\n') start++;
-  if (*start != '{') return NULL;
+/* Moves the value of key to the front of json in place; frees json if absent */
+static char *json_take_value(char *json, const char *key) {
+  const char *start = json_find_value(json, key);
+  const char *end = start ? json_value_end(start) : NULL;
+  if (!end || end == start) {
+    free(json);
+    return NULL;
+  }
+
+  size_t len = end - start;
+  memmove(json, start, len);
+  json[len] = '\0';
+  return json;
+}
 
-  int depth = 1;
-  const char *end = start + 1;
-  while (*end && depth > 0) {
-    if (*end == '{') depth++;
-    else if (*end == '}') depth--;
-    end++;
+static char *json_escape(const char *s) {
+  size_t len = 0;
+  for (const char *p = s; *p; p++) {
+    unsigned char c = (unsigned char)*p;
+    if (c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t') len += 2;
+    else if (c < 0x20) len += 6;
+    else len++;
   }
 
-  if (depth != 0) return NULL;
+  char *out = malloc(len + 1);
+  if (!out) return NULL;
 
-  size_t len = end - start;
-  char *result = malloc(len + 1);
-  if (!result) return NULL;
-  memcpy(result, start, len);
-  result[len] = '\0';
-  return result;
+  char *o = out;
+  for (const char *p = s; *p; p++) {
+    unsigned char c = (unsigned char)*p;
+    switch (c) {
+      case '"': *o++ = '\\'; *o++ = '"'; break;
+      case '\\': *o++ = '\\'; *o++ = '\\'; break;
+      case '\n': *o++ = '\\'; *o++ = 'n'; break;
+      case '\r': *o++ = '\\'; *o++ = 'r'; break;
+      case '\t': *o++ = '\\'; *o++ = 't'; break;
+      default:
+        if (c < 0x20) {
+          snprintf(o, 7, "\\u%04x", c);
+          o += 6;
+        } else {
+          *o++ = (char)c;
+        }
+        break;
+    }
+  }
+  *o = '\0';
+  return out;
+}
+
+static char *json_printf(const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  if (len < 0) return NULL;
+
+  char *out = malloc((size_t)len + 1);
+  if (!out) return NULL;
+
+  va_start(ap, fmt);
+  vsnprintf(out, (size_t)len + 1, fmt, ap);
+  va_end(ap);
+  return out;
+}
+
+/* Splits a JSON array of strings into a NULL-free string vector */
+static sqrl_error_t json_string_array(const char *json, char ***items_out, size_t *count_out) {
+  const char *p = json_skip_ws(json);
+  if (*p != '[') return SQRL_ERR_DECODE;
+
+  size_t count = 0, cap = 8;
+  char **items = malloc(cap * sizeof(char *));
+  if (!items) return SQRL_ERR_MEMORY;
+
+  p = json_skip_ws(p + 1);
+  while (*p == '"') {
+    const char *end = json_string_end(p);
+    if (!end) break;
+
+    if (count == cap) {
+      cap *= 2;
+      char **grown = realloc(items, cap * sizeof(char *));
+      if (!grown) {
+        sqrl_string_array_free(items, count);
+        return SQRL_ERR_MEMORY;
+      }
+      items = grown;
+    }
+    items[count] = json_copy_string(p + 1, end - 1);
+    if (!items[count]) {
+      sqrl_string_array_free(items, count);
+      return SQRL_ERR_MEMORY;
+    }
+    count++;
+
+    p = json_skip_ws(end);
+    if (*p == ',') p = json_skip_ws(p + 1);
+  }
+
+  if (*p != ']') {
+    sqrl_string_array_free(items, count);
+    return SQRL_ERR_DECODE;
+  }
+
+  *items_out = items;
+  *count_out = count;
+  return SQRL_OK;
+}
+
+/* Query text */
+
+static bool is_ident_char(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+/* Drops whitespace outside string literals, keeping a single space only
+ * where it separates two identifier characters */
+static char *canonical_query(const char *query) {
+  char *out = malloc(strlen(query) + 1);
+  if (!out) return NULL;
+
+  size_t n = 0;
+  char quote = 0;
+  bool space = false;
+  for (const char *p = query; *p; p++) {
+    char c = *p;
+    if (quote) {
+      out[n++] = c;
+      if (c == '\\' && p[1]) out[n++] = *++p;
+      else if (c == quote) quote = 0;
+      continue;
+    }
+    if (isspace((unsigned char)c)) {
+      space = true;
+      continue;
+    }
+    if (space && n > 0 && is_ident_char(out[n - 1]) && is_ident_char(c)) out[n++] = ' ';
+    space = false;
+    if (c == '"' || c == '\'' || c == '`') quote = c;
+    out[n++] = c;
+  }
+  out[n] = '\0';
+  return out;
+}
+
+/* Whether a canonical query asks for initial documents, in the structured
+ * ("includeInitial":true) or the JS (includeInitial:true) form */
+static bool wants_initial(const char *key) {
+  const char *p = strstr(key, "includeInitial");
+  if (!p) return false;
+  p += strlen("includeInitial");
+  if (*p == '"') p++;
+  return strncmp(p, ":true", 5) == 0;
+}
+
+/* FNV-1a, never 0 so callers can use 0 for "none" */
+static uint64_t hash_text(const char *p, size_t len) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)p[i];
+    hash *= 1099511628211ull;
+  }
+  return hash ? hash : 1;
+}
+
+/* The table a query reads, from a structured query's "table" or the first
+ * table("...") of a JS query; NULL if there is none */
+static char *query_table(const char *query) {
+  query = json_skip_ws(query);
+  if (*query == '{') return json_get_string(query, "table");
+
+  const char *p = strstr(query, "table(");
+  if (!p) return NULL;
+  p = json_skip_ws(p + 6);
+  char quote = *p;
+  if (quote != '"' && quote != '\'') return NULL;
+  const char *end = strchr(p + 1, quote);
+  if (!end) return NULL;
+
+  char *table = malloc((size_t)(end - p));
+  if (!table) return NULL;
+  memcpy(table, p + 1, (size_t)(end - p) - 1);
+  table[end - p - 1] = '\0';
+  return table;
+}
+
+/* Documents
+ *
+ * With compact_documents set, a document's collection points into the
+ * client's table of interned names instead of being copied, and the
+ * timestamps are only decoded into created_ns/updated_ns.
+ */
+
+/* Returns the client's copy of the JSON string at value (quotes included),
+ * adding it on first sight; NULL if out of memory */
+static const char *intern_name(sqrl_client_t *client, const char *value, const char *end) {
+  const char *body = value + 1;
+  size_t len = (size_t)(end - 1 - body);
+  char *decoded = NULL;
+  if (memchr(body, '\\', len)) {
+    if (!(decoded = json_copy_string(body, end - 1))) return NULL;
+    body = decoded;
+    len = strlen(decoded);
+  }
+  uint64_t hash = hash_text(body, len);
+
+  const char *found = NULL;
+  interned_name_t *head = atomic_load_explicit(&client->interned, memory_order_acquire);
+  for (interned_name_t *n = head; n && !found; n = n->next) {
+    if (n->hash == hash && n->len == len && memcmp(n->name, body, len) == 0) found = n->name;
+  }
+
+  if (!found) {
+    pthread_mutex_lock(&client->intern_mutex);
+    /* Another thread may have added it since we looked */
+    for (interned_name_t *n = atomic_load_explicit(&client->interned, memory_order_relaxed); n != head && !found; n = n->next) {
+      if (n->hash == hash && n->len == len && memcmp(n->name, body, len) == 0) found = n->name;
+    }
+    interned_name_t *n = found ? NULL : malloc(sizeof(interned_name_t) + len + 1);
+    if (n) {
+      n->hash = hash;
+      n->len = len;
+      memcpy(n->name, body, len);
+      n->name[len] = '\0';
+      n->next = atomic_load_explicit(&client->interned, memory_order_relaxed);
+      atomic_store_explicit(&client->interned, n, memory_order_release);
+      found = n->name;
+    }
+    pthread_mutex_unlock(&client->intern_mutex);
+  }
+  free(decoded);
+  return found;
+}
+
+static int64_t document_time(const char *json, const char *key) {
+  const char *value = json_find_value(json, key);
+  return value && *value == '"' ? parse_timestamp_ns(value + 1) : 0;
+}
+
+/* client may be NULL, which always decodes a self-contained document */
+static sqrl_document_t *parse_document(sqrl_client_t *client, const char *json) {
+  sqrl_document_t *doc = calloc(1, sizeof(sqrl_document_t));
+  if (!doc) return NULL;
+
+  doc->id = json_get_string(json, "id");
+  doc->data = json_get_raw(json, "data");
+  doc->version = json_get_int64(json, "version");
+  doc->created_ns = document_time(json, "created_at");
+  doc->updated_ns = document_time(json, "updated_at");
+
+  if (client && client->compact_documents) {
+    const char *value = json_find_value(json, "collection");
+    const char *end = value && *value == '"' ? json_string_end(value) : NULL;
+    const char *name = end ? intern_name(client, value, end) : NULL;
+    doc->collection = (char *)name;
+    doc->shared_collection = name != NULL;
+  } else {
+    doc->collection = json_get_string(json, "collection");
+    doc->created_at = json_get_string(json, "created_at");
+    doc->updated_at = json_get_string(json, "updated_at");
+  }
+
+  if (!doc->id) {
+    sqrl_document_free(doc);
+    return NULL;
+  }
+  return doc;
 }
 
 /* Network I/O */
@@ -186,7 +1006,7 @@ static ssize_t send_all(int fd, const void *buf, size_t len) {
   size_t remaining = len;
 
   while (remaining > 0) {
-    ssize_t n = send(fd, p, remaining, 0);
+    ssize_t n = send(fd, p, remaining, MSG_NOSIGNAL);
     if (n < 0) {
       if (errno == EINTR) continue;
       return -1;
@@ -235,7 +1055,9 @@ static ssize_t recv_all(int fd, void *buf, size_t len, int timeout_ms) {
 
 /* Protocol implementation */
 
-static sqrl_error_t do_handshake(sqrl_client_t *client, const sqrl_options_t *opts) {
+/* The first handshake sets the client's session id and encoding; stripes
+ * open sessions of their own, which are not recorded */
+static sqrl_error_t do_handshake(sqrl_client_t *client, int fd, const sqrl_options_t *opts) {
   const char *token = opts && opts->auth_token ? opts->auth_token : "";
   size_t token_len = strlen(token);
 
@@ -256,14 +1078,14 @@ static sqrl_error_t do_handshake(sqrl_client_t *client, const sqrl_options_t *op
     memcpy(pkt + 8, token, token_len);
   }
 
-  if (send_all(client->fd, pkt, pkt_len) < 0) {
+  if (send_all(fd, pkt, pkt_len) < 0) {
     free(pkt);
     return SQRL_ERR_SEND;
   }
   free(pkt);
 
   uint8_t resp[19];
-  if (recv_all(client->fd, resp, 19, opts ? opts->connect_timeout_ms : 5000) < 0) {
+  if (recv_all(fd, resp, 19, opts ? opts->connect_timeout_ms : 5000) < 0) {
     return SQRL_ERR_RECV;
   }
 
@@ -273,6 +1095,7 @@ static sqrl_error_t do_handshake(sqrl_client_t *client, const sqrl_options_t *op
   if (status == HANDSHAKE_VERSION_MISMATCH) return SQRL_ERR_VERSION_MISMATCH;
   if (status == HANDSHAKE_AUTH_FAILED) return SQRL_ERR_AUTH_FAILED;
   if (status != HANDSHAKE_SUCCESS) return SQRL_ERR_HANDSHAKE;
+  if (client->session_id) return SQRL_OK;
 
   client->session_id = malloc(37);
   if (!client->session_id) return SQRL_ERR_MEMORY;
@@ -283,309 +1106,3236 @@ static sqrl_error_t do_handshake(sqrl_client_t *client, const sqrl_options_t *op
   return SQRL_OK;
 }
 
-static sqrl_error_t send_frame(sqrl_client_t *client, const char *json) {
-  size_t payload_len = strlen(json);
-  uint32_t length = (uint32_t)(payload_len + 2);
-
-  size_t frame_len = 6 + payload_len;
-  uint8_t *frame = malloc(frame_len);
-  if (!frame) return SQRL_ERR_MEMORY;
+/* Write batching
+ *
+ * With batching enabled, send_frame() appends the frame to batch_buf and the
+ * writer thread flushes it once the oldest queued frame has waited
+ * batch_window_us, or immediately when batch_max_bytes is reached. The window
+ * adapts to load: a flush that carried a single frame halves it (no one else
+ * was sending, so waiting only added latency), a flush that coalesced several
+ * frames doubles it, up to the configured maximum.
+ */
 
-  write_u32_be(frame, length);
-  frame[4] = MSG_TYPE_REQUEST;
-  frame[5] = SQRL_ENCODING_JSON;
-  memcpy(frame + 6, json, payload_len);
+static void adapt_batch_window(sqrl_client_t *client, size_t frames) {
+  int window = client->batch_window_us;
+  if (frames > 1) {
+    window = window ? window * 2 : client->batch_max_window_us / 16 + 1;
+    if (window > client->batch_max_window_us) window = client->batch_max_window_us;
+  } else {
+    window /= 2;
+  }
+  client->batch_window_us = window;
+  atomic_store_explicit(&client->stat_batch_window_us, window, memory_order_relaxed);
+}
 
+static sqrl_error_t flush_batch(sqrl_client_t *client) {
+  /* flush_mutex keeps batches on the wire in the order they were swapped out
+   * while letting senders keep appending to the other buffer. */
+  pthread_mutex_lock(&client->flush_mutex);
   pthread_mutex_lock(&client->write_mutex);
-  ssize_t sent = send_all(client->fd, frame, frame_len);
-  pthread_mutex_unlock(&client->write_mutex);
 
-  free(frame);
-  return (sent < 0) ? SQRL_ERR_SEND : SQRL_OK;
-}
+  if (client->batch_len == 0) {
+    pthread_mutex_unlock(&client->write_mutex);
+    pthread_mutex_unlock(&client->flush_mutex);
+    return SQRL_OK;
+  }
 
-static sqrl_error_t recv_frame(sqrl_client_t *client, uint8_t *msg_type, char **json_out) {
-  uint8_t header[6];
-  if (recv_all(client->fd, header, 6, 0) < 0) return SQRL_ERR_RECV;
+  uint8_t *buf = client->batch_buf;
+  size_t cap = client->batch_cap;
+  size_t len = client->batch_len;
+  size_t frames = client->batch_frames;
+  uint64_t enqueue_sum = client->batch_enqueue_sum_ns;
 
-  uint32_t length = read_u32_be(header);
-  *msg_type = header[4];
+  client->batch_buf = client->batch_spare;
+  client->batch_cap = client->batch_spare_cap;
+  client->batch_len = 0;
+  client->batch_frames = 0;
+  client->batch_enqueue_sum_ns = 0;
+  adapt_batch_window(client, frames);
 
-  if (length < 2 || length > SQRL_MAX_MESSAGE_SIZE) return SQRL_ERR_DECODE;
+  pthread_mutex_unlock(&client->write_mutex);
 
-  uint32_t payload_len = length - 2;
-  char *payload = malloc(payload_len + 1);
-  if (!payload) return SQRL_ERR_MEMORY;
+  ssize_t sent = send_all(client->fd, buf, len);
+  uint64_t flushed_at = now_ns();
 
-  if (recv_all(client->fd, payload, payload_len, 0) < 0) {
-    free(payload);
-    return SQRL_ERR_RECV;
+  pthread_mutex_lock(&client->write_mutex);
+  client->batch_spare = buf;
+  client->batch_spare_cap = cap;
+  pthread_mutex_unlock(&client->write_mutex);
+
+  pthread_mutex_unlock(&client->flush_mutex);
+
+  if (sent < 0) {
+    client->connected = false;
+    return SQRL_ERR_SEND;
   }
-  payload[payload_len] = '\0';
 
-  *json_out = payload;
+  atomic_fetch_add_explicit(&client->stat_frames_sent, frames, memory_order_relaxed);
+  atomic_fetch_add_explicit(&client->stat_bytes_sent, len, memory_order_relaxed);
+  atomic_fetch_add_explicit(&client->stat_batches, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&client->stat_batched_frames, frames, memory_order_relaxed);
+  atomic_fetch_add_explicit(&client->stat_batch_delay_ns,
+                            flushed_at * frames - enqueue_sum, memory_order_relaxed);
   return SQRL_OK;
 }
 
-/* Reader thread */
+static void *writer_thread_func(void *arg) {
+  sqrl_client_t *client = arg;
 
-static void dispatch_change(sqrl_client_t *client, const char *id, const char *json) {
-  pthread_mutex_lock(&client->subs_mutex);
+  pthread_mutex_lock(&client->write_mutex);
+  while (client->writer_running || client->batch_len > 0) {
+    if (client->batch_len == 0) {
+      pthread_cond_wait(&client->batch_cond, &client->write_mutex);
+      continue;
+    }
 
-  subscription_entry_t *entry = client->subscriptions;
-  while (entry) {
-    if (strcmp(entry->id, id) == 0) {
-      sqrl_change_event_t event = {0};
-      char *type_str = json_get_string(json, "type");
-      if (type_str) {
-        if (strcmp(type_str, "initial") == 0) event.type = SQRL_CHANGE_INITIAL;
-        else if (strcmp(type_str, "insert") == 0) event.type = SQRL_CHANGE_INSERT;
-        else if (strcmp(type_str, "update") == 0) event.type = SQRL_CHANGE_UPDATE;
-        else if (strcmp(type_str, "delete") == 0) event.type = SQRL_CHANGE_DELETE;
-        free(type_str);
-      }
-      entry->callback(&event, entry->user_data);
-      if (event.document) sqrl_document_free(event.document);
-      if (event.new_doc) sqrl_document_free(event.new_doc);
-      if (event.old_data) free(event.old_data);
-      break;
+    uint64_t due = client->batch_first_ns + (uint64_t)client->batch_window_us * 1000;
+    uint64_t now = now_ns();
+    if (client->writer_running && now < due && client->batch_len < client->batch_max_bytes) {
+      struct timespec ts = deadline_after_ns(due - now);
+      pthread_cond_timedwait(&client->batch_cond, &client->write_mutex, &ts);
+      continue;
     }
-    entry = entry->next;
+
+    pthread_mutex_unlock(&client->write_mutex);
+    flush_batch(client);
+    pthread_mutex_lock(&client->write_mutex);
   }
+  pthread_mutex_unlock(&client->write_mutex);
 
-  pthread_mutex_unlock(&client->subs_mutex);
+  return NULL;
 }
 
-static void dispatch_response(sqrl_client_t *client, const char *id, const char *json) {
-  pthread_mutex_lock(&client->pending_mutex);
+static sqrl_error_t enqueue_frame(sqrl_client_t *client, const char *json, size_t payload_len) {
+  size_t frame_len = 6 + payload_len;
 
-  pending_request_t *req = client->pending_requests;
-  while (req) {
-    if (strcmp(req->id, id) == 0) {
-      pthread_mutex_lock(&req->mutex);
-      req->response = strdup_safe(json);
-      req->completed = true;
-      pthread_cond_signal(&req->cond);
-      pthread_mutex_unlock(&req->mutex);
-      break;
+  pthread_mutex_lock(&client->write_mutex);
+
+  if (client->batch_len + frame_len > client->batch_cap) {
+    size_t cap = client->batch_cap ? client->batch_cap : BATCH_INITIAL_CAPACITY;
+    while (cap < client->batch_len + frame_len) cap *= 2;
+    uint8_t *buf = realloc(client->batch_buf, cap);
+    if (!buf) {
+      pthread_mutex_unlock(&client->write_mutex);
+      return SQRL_ERR_MEMORY;
     }
-    req = req->next;
+    client->batch_buf = buf;
+    client->batch_cap = cap;
   }
 
-  pthread_mutex_unlock(&client->pending_mutex);
+  uint8_t *frame = client->batch_buf + client->batch_len;
+  write_u32_be(frame, (uint32_t)(payload_len + 2));
+  frame[4] = MSG_TYPE_REQUEST;
+  frame[5] = SQRL_ENCODING_JSON;
+  memcpy(frame + 6, json, payload_len);
+
+  uint64_t now = now_ns();
+  if (client->batch_len == 0) {
+    client->batch_first_ns = now;
+    pthread_cond_signal(&client->batch_cond);
+  }
+  client->batch_len += frame_len;
+  client->batch_frames++;
+  client->batch_enqueue_sum_ns += now;
+
+  bool full = client->batch_len >= client->batch_max_bytes;
+  pthread_mutex_unlock(&client->write_mutex);
+
+  return full ? flush_batch(client) : SQRL_OK;
 }
 
-static void *reader_thread_func(void *arg) {
-  sqrl_client_t *client = arg;
+/* Writes one frame straight to fd; write_mutex keeps frames whole */
+static sqrl_error_t write_frame(sqrl_client_t *client, int fd, pthread_mutex_t *write_mutex, const char *json, size_t payload_len) {
+  uint32_t length = (uint32_t)(payload_len + 2);
 
-  while (client->reader_running) {
-    uint8_t msg_type;
-    char *json = NULL;
+  size_t frame_len = 6 + payload_len;
+  uint8_t *frame = malloc(frame_len);
+  if (!frame) return SQRL_ERR_MEMORY;
 
-    sqrl_error_t err = recv_frame(client, &msg_type, &json);
-    if (err != SQRL_OK) {
-      if (client->reader_running) client->connected = false;
-      break;
+  write_u32_be(frame, length);
+  frame[4] = MSG_TYPE_REQUEST;
+  frame[5] = SQRL_ENCODING_JSON;
+  memcpy(frame + 6, json, payload_len);
+
+  pthread_mutex_lock(write_mutex);
+  ssize_t sent = send_all(fd, frame, frame_len);
+  pthread_mutex_unlock(write_mutex);
+
+  free(frame);
+  if (sent < 0) return SQRL_ERR_SEND;
+
+  atomic_fetch_add_explicit(&client->stat_frames_sent, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&client->stat_bytes_sent, frame_len, memory_order_relaxed);
+  return SQRL_OK;
+}
+
+/* Sends on the primary socket */
+static sqrl_error_t send_frame(sqrl_client_t *client, const char *json) {
+  size_t payload_len = strlen(json);
+  if (client->writer_running) return enqueue_frame(client, json, payload_len);
+  return write_frame(client, client->fd, &client->write_mutex, json, payload_len);
+}
+
+static sqrl_error_t recv_frame(sqrl_client_t *client, int fd, uint8_t *msg_type, char **json_out) {
+  uint8_t header[6];
+  if (recv_all(fd, header, 6, 0) < 0) return SQRL_ERR_RECV;
+
+  uint32_t length = read_u32_be(header);
+  *msg_type = header[4];
+
+  if (length < 2 || length > SQRL_MAX_MESSAGE_SIZE) return SQRL_ERR_DECODE;
+
+  uint32_t payload_len = length - 2;
+  char *payload = malloc(payload_len + 1);
+  if (!payload) return SQRL_ERR_MEMORY;
+
+  if (recv_all(fd, payload, payload_len, 0) < 0) {
+    free(payload);
+    return SQRL_ERR_RECV;
+  }
+  payload[payload_len] = '\0';
+
+  atomic_fetch_add_explicit(&client->stat_frames_received, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&client->stat_bytes_received, 6 + payload_len, memory_order_relaxed);
+  *json_out = payload;
+  return SQRL_OK;
+}
+
+/* Concurrency limiting and circuit breaking
+ *
+ * Each request takes a slot before it is registered. The limit grows by
+ * 1/limit per reply that comes back within LIMIT_RTT_TOLERANCE of the best
+ * round trip seen in the last LIMIT_RTT_WINDOW_NS, backs off by LIMIT_BACKOFF (at most once per round
+ * trip) when replies queue, and halves on timeouts and dropped connections.
+ * Blocking callers wait for a slot; async callers fail with
+ * SQRL_ERR_OVERLOADED, since they may be running on the reader thread that
+ * would free one.
+ *
+ * breaker_threshold consecutive failures open the circuit: requests fail
+ * with SQRL_ERR_UNAVAILABLE until the cooldown elapses, then a single probe
+ * is let through and its outcome closes or reopens the circuit.
+ */
+
+static bool limiter_enabled(const sqrl_client_t *client) {
+  return client->max_concurrency > 0 || client->breaker_threshold > 0;
+}
+
+static void publish_limit_stats(sqrl_client_t *client) {
+  atomic_store_explicit(&client->stat_limit, client->max_concurrency ? (int)client->limit : 0, memory_order_relaxed);
+  atomic_store_explicit(&client->stat_in_flight, client->in_flight, memory_order_relaxed);
+  atomic_store_explicit(&client->stat_breaker_open, client->breaker != BREAKER_CLOSED, memory_order_relaxed);
+}
+
+static sqrl_error_t limiter_admit(sqrl_client_t *client, pending_request_t *req, bool wait) {
+  if (!limiter_enabled(client)) return SQRL_OK;
+
+  uint64_t deadline = now_ns() + (client->request_timeout_ms > 0
+    ? (uint64_t)client->request_timeout_ms * 1000000ull : UINT64_MAX / 2);
+  sqrl_error_t err = SQRL_OK;
+
+  pthread_mutex_lock(&client->limit_mutex);
+
+  if (client->breaker == BREAKER_OPEN && now_ns() >= client->breaker_open_until) {
+    client->breaker = BREAKER_HALF_OPEN;
+    client->probe_in_flight = false;
+  }
+  if (client->breaker == BREAKER_OPEN ||
+      (client->breaker == BREAKER_HALF_OPEN && client->probe_in_flight)) {
+    err = SQRL_ERR_UNAVAILABLE;
+    goto done;
+  }
+
+  if (client->max_concurrency > 0) {
+    while (client->in_flight >= (int)client->limit) {
+      uint64_t now = now_ns();
+      if (!wait) {
+        err = SQRL_ERR_OVERLOADED;
+        goto done;
+      }
+      if (now >= deadline) {
+        err = SQRL_ERR_TIMEOUT;
+        goto done;
+      }
+      struct timespec ts = deadline_after_ns(deadline - now);
+      pthread_cond_timedwait(&client->limit_cond, &client->limit_mutex, &ts);
     }
+    client->in_flight++;
+  }
 
-    char *msg_id = json_get_string(json, "id");
-    char *resp_type = json_get_string(json, "type");
+  if (client->breaker == BREAKER_HALF_OPEN) {
+    client->probe_in_flight = true;
+    req->probe = true;
+  }
+  req->admitted = true;
 
-    if (msg_id && resp_type) {
-      if (strcmp(resp_type, "change") == 0) {
-        char *change_json = json_get_object(json, "change");
-        if (change_json) {
-          dispatch_change(client, msg_id, change_json);
-          free(change_json);
+done:
+  publish_limit_stats(client);
+  pthread_mutex_unlock(&client->limit_mutex);
+
+  if (err == SQRL_ERR_OVERLOADED || err == SQRL_ERR_UNAVAILABLE) {
+    atomic_fetch_add_explicit(&client->stat_rejected, 1, memory_order_relaxed);
+  }
+  return err;
+}
+
+static void limiter_done(sqrl_client_t *client, pending_request_t *req, request_outcome_t outcome, uint64_t rtt_ns) {
+  if (!req->admitted) return;
+  req->admitted = false;
+
+  pthread_mutex_lock(&client->limit_mutex);
+
+  if (client->max_concurrency > 0) {
+    client->in_flight--;
+    pthread_cond_signal(&client->limit_cond);
+
+    if (outcome == OUTCOME_OK) {
+      uint64_t now = now_ns();
+      if (client->min_rtt_ns == 0 || rtt_ns < client->min_rtt_ns ||
+          now - client->min_rtt_since_ns > LIMIT_RTT_WINDOW_NS) {
+        client->min_rtt_ns = rtt_ns;
+        client->min_rtt_since_ns = now;
+      }
+
+      if (rtt_ns > client->min_rtt_ns * LIMIT_RTT_TOLERANCE) {
+        if (now - client->last_backoff_ns > client->min_rtt_ns) {
+          client->limit *= LIMIT_BACKOFF;
+          client->last_backoff_ns = now;
         }
       } else {
-        dispatch_response(client, msg_id, json);
+        client->limit += 1.0 / client->limit;
       }
+    } else if (outcome == OUTCOME_FAILED) {
+      client->limit /= 2;
     }
+    if (client->limit < 1.0) client->limit = 1.0;
+    if (client->limit > client->max_concurrency) client->limit = client->max_concurrency;
+  }
 
-    free(msg_id);
-    free(resp_type);
-    free(json);
+  if (client->breaker_threshold > 0 && outcome != OUTCOME_CANCELLED) {
+    if (req->probe) client->probe_in_flight = false;
+
+    if (outcome == OUTCOME_OK) {
+      client->consecutive_failures = 0;
+      if (req->probe) client->breaker = BREAKER_CLOSED;
+    } else {
+      client->consecutive_failures++;
+      if ((req->probe || client->consecutive_failures >= client->breaker_threshold) &&
+          client->breaker != BREAKER_OPEN) {
+        client->breaker = BREAKER_OPEN;
+        client->breaker_open_until = now_ns() + client->breaker_cooldown_ns;
+        atomic_fetch_add_explicit(&client->stat_breaker_opens, 1, memory_order_relaxed);
+      }
+    }
+  } else if (req->probe) {
+    client->probe_in_flight = false;
   }
 
-  return NULL;
+  publish_limit_stats(client);
+  pthread_mutex_unlock(&client->limit_mutex);
 }
 
-/* Public API */
+/* Connection striping
+ *
+ * Replies on one socket arrive in the order the server finishes them, so a
+ * large result set holds up every small reply queued behind it. A striped
+ * client spreads requests over several sockets sharing one pending table,
+ * and steers large traffic to a bulk socket of its own. Request sizes are
+ * known up front; reply sizes are learned per query text, so a query that
+ * returned at least bulk_threshold bytes is sent on the bulk socket next
+ * time, until it returns less. Subscriptions stay on the primary socket,
+ * where their change messages arrive.
+ */
 
-sqrl_error_t sqrl_init(void) {
-  if (g_initialized) return SQRL_OK;
-  g_initialized = true;
-  return SQRL_OK;
+static uint64_t query_key(const char *json) {
+  const char *query = json_find_value(json, "query");
+  const char *end = query && *query == '"' ? json_string_end(query) : NULL;
+  return end ? hash_text(query, (size_t)(end - query)) : 0;
 }
 
-void sqrl_cleanup(void) {
-  g_initialized = false;
+static void learn_reply_size(sqrl_client_t *client, uint64_t key, size_t reply_bytes) {
+  _Atomic uint64_t *slot = &client->bulk_keys[key % BULK_KEY_SLOTS];
+  if (reply_bytes >= client->bulk_threshold) {
+    atomic_store_explicit(slot, key, memory_order_relaxed);
+  } else {
+    uint64_t expected = key;
+    atomic_compare_exchange_strong_explicit(slot, &expected, 0, memory_order_relaxed, memory_order_relaxed);
+  }
 }
 
-const char *sqrl_error_string(sqrl_error_t err) {
-  switch (err) {
-    case SQRL_OK: return "Success";
-    case SQRL_ERR_CONNECT: return "Connection failed";
-    case SQRL_ERR_HANDSHAKE: return "Handshake failed";
-    case SQRL_ERR_VERSION_MISMATCH: return "Protocol version mismatch";
-    case SQRL_ERR_AUTH_FAILED: return "Authentication failed";
-    case SQRL_ERR_SEND: return "Send failed";
-    case SQRL_ERR_RECV: return "Receive failed";
-    case SQRL_ERR_TIMEOUT: return "Timeout";
-    case SQRL_ERR_CLOSED: return "Connection closed";
-    case SQRL_ERR_INVALID_ARG: return "Invalid argument";
-    case SQRL_ERR_MEMORY: return "Memory allocation failed";
-    case SQRL_ERR_ENCODE: return "Encoding failed";
-    case SQRL_ERR_DECODE: return "Decoding failed";
-    case SQRL_ERR_SERVER: return "Server error";
-    case SQRL_ERR_NOT_FOUND: return "Not found";
-    default: return "Unknown error";
+/* Picks the socket for a request, NULL meaning the primary one */
+static stripe_t *choose_stripe(sqrl_client_t *client, const pending_request_t *req) {
+  if (strcmp(req->op, "subscribe") == 0 || strcmp(req->op, "unsubscribe") == 0) return NULL;
+
+  if (client->bulk) {
+    if (req->bytes >= client->bulk_threshold ||
+        (req->bulk_key && atomic_load_explicit(&client->bulk_keys[req->bulk_key % BULK_KEY_SLOTS],
+                                               memory_order_relaxed) == req->bulk_key)) {
+      atomic_fetch_add_explicit(&client->stat_bulk_requests, 1, memory_order_relaxed);
+      return client->bulk;
+    }
   }
+
+  if (client->stripe_count == 0) return NULL;
+  uint64_t n = atomic_fetch_add_explicit(&client->next_stripe, 1, memory_order_relaxed) % (client->stripe_count + 1);
+  return n == 0 ? NULL : &client->stripes[n - 1];
 }
 
-sqrl_options_t sqrl_options_default(void) {
-  sqrl_options_t opts = {
-    .auth_token = NULL,
-    .use_msgpack = true,
-    .connect_timeout_ms = 5000,
-    .request_timeout_ms = 30000,
-  };
-  return opts;
+static sqrl_error_t stripe_send(stripe_t *stripe, const char *json) {
+  return write_frame(stripe->client, stripe->fd, &stripe->write_mutex, json, strlen(json));
 }
 
-sqrl_error_t sqrl_connect(sqrl_client_t **client_out, const char *host, uint16_t port, const sqrl_options_t *options) {
-  if (!client_out || !host) return SQRL_ERR_INVALID_ARG;
+/* Result cache invalidation
+ *
+ * Every table with cached results has a cache_feed_t whose generation is
+ * bumped, and whose cached results are dropped, on each change event from
+ * the table's server feed and on each local write to it. A result is only
+ * stored if its table's generation didn't move while the query ran.
+ */
 
-  sqrl_client_t *client = calloc(1, sizeof(sqrl_client_t));
-  if (!client) return SQRL_ERR_MEMORY;
+static void cache_unlink(sqrl_client_t *client, cached_result_t **link) {
+  cached_result_t *e = *link;
+  *link = e->next;
+  client->cache_entry_count--;
+  client->cache_bytes -= e->bytes;
+  free(e->key);
+  free(e->table);
+  free(e->result);
+  free(e);
+}
 
-  client->fd = -1;
-  client->request_timeout_ms = options ? options->request_timeout_ms : 30000;
-  pthread_mutex_init(&client->write_mutex, NULL);
-  pthread_mutex_init(&client->pending_mutex, NULL);
-  pthread_mutex_init(&client->subs_mutex, NULL);
+/* cache_mutex held */
+static cache_feed_t *cache_find_feed(sqrl_client_t *client, const char *table) {
+  for (cache_feed_t *f = client->cache_feeds; f; f = f->next) {
+    if (strcmp(f->table, table) == 0) return f;
+  }
+  return NULL;
+}
+
+static void cache_invalidate_table(sqrl_client_t *client, const char *table) {
+  pthread_mutex_lock(&client->cache_mutex);
+  cache_feed_t *feed = cache_find_feed(client, table);
+  if (feed) {
+    feed->generation++;
+    uint64_t dropped = 0;
+    cached_result_t **link = &client->cache_entries;
+    while (*link) {
+      if (strcmp((*link)->table, table) == 0) {
+        cache_unlink(client, link);
+        dropped++;
+      } else {
+        link = &(*link)->next;
+      }
+    }
+    atomic_fetch_add_explicit(&client->stat_cache_invalidations, dropped, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&client->cache_mutex);
+}
 
-  struct addrinfo hints = {0}, *res = NULL;
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
+static void cache_feed_changed(const sqrl_change_event_t *event, void *user_data) {
+  cache_feed_t *feed = user_data;
+  if (event->type != SQRL_CHANGE_INITIAL) cache_invalidate_table(feed->client, feed->table);
+}
 
-  char port_str[16];
-  snprintf(port_str, sizeof(port_str), "%u", port);
+/* Local writes invalidate as they are sent, without waiting for the feed */
+static void cache_note_write(sqrl_client_t *client, const pending_request_t *req, const char *json) {
+  static const char *const writes[] = {"insert", "update", "upsert", "patch", "delete", "update_many", "delete_many"};
+  bool is_write = false;
+  for (size_t i = 0; i < sizeof(writes) / sizeof(writes[0]) && !is_write; i++) is_write = strcmp(req->op, writes[i]) == 0;
+  if (!is_write) return;
 
-  if (getaddrinfo(host, port_str, &hints, &res) != 0) {
-    free(client);
-    return SQRL_ERR_CONNECT;
-  }
+  char *collection = json_get_string(json, "collection");
+  if (!collection) return;
+  cache_invalidate_table(client, collection);
+  free(collection);
+}
 
-  client->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-  if (client->fd < 0) {
-    freeaddrinfo(res);
-    free(client);
-    return SQRL_ERR_CONNECT;
+/* Unsubscribes the invalidation feeds and drops every cached result */
+static void cache_destroy(sqrl_client_t *client) {
+  while (client->cache_feeds) {
+    cache_feed_t *feed = client->cache_feeds;
+    client->cache_feeds = feed->next;
+    if (feed->sub) sqrl_unsubscribe(feed->sub);
+    free(feed->table);
+    free(feed);
   }
+  while (client->cache_entries) cache_unlink(client, &client->cache_entries);
+}
+
+/* Pending requests
+ *
+ * Every request registers a pending entry keyed by its id before the frame
+ * is sent. Synchronous callers block on the entry's condition variable;
+ * async entries carry a done hook the reader thread runs after unlinking
+ * them, so the reader never calls back into user code under pending_mutex.
+ */
 
-  int flag = 1;
-  setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+static void next_request_id(sqrl_client_t *client, char *buf, size_t size) {
+  uint64_t id = atomic_fetch_add_explicit(&client->request_id, 1, memory_order_relaxed) + 1;
+  snprintf(buf, size, "%llu", (unsigned long long)id);
+}
 
-  if (connect(client->fd, res->ai_addr, res->ai_addrlen) < 0) {
-    freeaddrinfo(res);
-    close(client->fd);
-    free(client);
-    return SQRL_ERR_CONNECT;
+static pending_request_t *pending_new(const char *id) {
+  pending_request_t *req = calloc(1, sizeof(pending_request_t));
+  if (!req) return NULL;
+
+  req->id = strdup_safe(id);
+  if (!req->id) {
+    free(req);
+    return NULL;
   }
-  freeaddrinfo(res);
+  pthread_mutex_init(&req->mutex, NULL);
+  pthread_cond_init(&req->cond, NULL);
+  return req;
+}
 
-  sqrl_error_t err = do_handshake(client, options);
-  if (err != SQRL_OK) {
-    close(client->fd);
-    free(client->session_id);
-    free(client);
-    return err;
+static void pending_free(pending_request_t *req) {
+  if (!req) return;
+  if (req->client) limiter_done(req->client, req, OUTCOME_CANCELLED, 0);
+  free(req->id);
+  free(req->response);
+  free(req->queued);
+  pthread_mutex_destroy(&req->mutex);
+  pthread_cond_destroy(&req->cond);
+  free(req);
+}
+
+/* Unlinks the request with this id; false if the reader or fail_pending()
+ * already took it. Matching by id rather than pointer stays safe when an
+ * async request may have been freed and its memory reused. */
+static bool pending_unlink(sqrl_client_t *client, const char *id) {
+  pthread_mutex_lock(&client->pending_mutex);
+  pending_request_t **link = &client->pending_requests;
+  while (*link && strcmp((*link)->id, id) != 0) link = &(*link)->next;
+  pending_request_t *req = *link;
+  if (req) *link = req->next;
+  pthread_mutex_unlock(&client->pending_mutex);
+  return req != NULL;
+}
+
+/* Drops an async request before its reply arrives, reporting outcome to
+ * the limiter (OUTCOME_FAILED for a timeout). Returns false if the reply
+ * already claimed it, in which case its done hook runs as usual. */
+static bool pending_cancel(sqrl_client_t *client, const char *id, request_outcome_t outcome) {
+  pthread_mutex_lock(&client->pending_mutex);
+  pending_request_t **link = &client->pending_requests;
+  while (*link && strcmp((*link)->id, id) != 0) link = &(*link)->next;
+  pending_request_t *req = *link;
+  if (req) *link = req->next;
+  pthread_mutex_unlock(&client->pending_mutex);
+
+  if (req) limiter_done(client, req, outcome, 0);
+  pending_free(req);
+  return req != NULL;
+}
+
+/* Fails every outstanding request, e.g. when the connection drops */
+static void fail_pending(sqrl_client_t *client, sqrl_error_t err) {
+  pending_request_t *async_reqs = NULL;
+
+  pthread_mutex_lock(&client->pending_mutex);
+  pending_request_t **link = &client->pending_requests;
+  while (*link) {
+    pending_request_t *req = *link;
+    limiter_done(client, req, OUTCOME_FAILED, 0);
+    if (req->done) {
+      *link = req->next;
+      req->next = async_reqs;
+      async_reqs = req;
+      continue;
+    }
+    pthread_mutex_lock(&req->mutex);
+    req->error = err;
+    req->completed = true;
+    pthread_cond_signal(&req->cond);
+    pthread_mutex_unlock(&req->mutex);
+    link = &req->next;
   }
+  pthread_mutex_unlock(&client->pending_mutex);
 
-  client->connected = true;
-  client->reader_running = true;
-  if (pthread_create(&client->reader_thread, NULL, reader_thread_func, client) != 0) {
-    close(client->fd);
-    free(client->session_id);
-    free(client);
-    return SQRL_ERR_CONNECT;
+  while (async_reqs) {
+    pending_request_t *next = async_reqs->next;
+    async_reqs->done(async_reqs, err, NULL);
+    pending_free(async_reqs);
+    async_reqs = next;
   }
+}
 
-  *client_out = client;
-  return SQRL_OK;
+/* Connected, or still connecting in the background */
+static bool client_usable(const sqrl_client_t *client) {
+  return client->connected || client->connecting;
 }
 
-void sqrl_disconnect(sqrl_client_t *client) {
-  if (!client) return;
+static sqrl_error_t submit_request(sqrl_client_t *client, pending_request_t *req, const char *json) {
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
 
-  client->reader_running = false;
-  client->connected = false;
+  req->client = client;
+  sqrl_error_t err = limiter_admit(client, req, req->done == NULL || req->blocking);
+  if (err != SQRL_OK) return err;
 
-  if (client->fd >= 0) {
-    shutdown(client->fd, SHUT_RDWR);
-    close(client->fd);
-    client->fd = -1;
+  req->sent_ns = now_ns();
+  req->bytes = strlen(json);
+  const char *type = json_find_value(json, "type");
+  const char *type_end = type && *type == '"' ? json_string_end(type) : NULL;
+  if (type_end) {
+    size_t n = (size_t)(type_end - type) - 2;
+    if (n >= sizeof(req->op)) n = sizeof(req->op) - 1;
+    memcpy(req->op, type + 1, n);
+    req->op[n] = '\0';
   }
+  if (client->bulk_threshold > 0 && strcmp(req->op, "query") == 0) req->bulk_key = query_key(json);
+  if (client->cache_ttl_ns > 0) cache_note_write(client, req, json);
 
-  pthread_join(client->reader_thread, NULL);
+  /* Once linked, an async req may be completed and freed by the reader at
+   * any time, so keep its id to find it again */
+  char id[32];
+  snprintf(id, sizeof(id), "%s", req->id);
 
-  pending_request_t *req = client->pending_requests;
-  while (req) {
-    pending_request_t *next = req->next;
-    free(req->id);
-    free(req->response);
-    pthread_mutex_destroy(&req->mutex);
-    pthread_cond_destroy(&req->cond);
-    free(req);
-    req = next;
+  /* Frames queued during a lazy connect all go out on the primary socket */
+  pthread_mutex_lock(&client->pending_mutex);
+  bool queue = client->connecting;
+  stripe_t *stripe = queue ? NULL : choose_stripe(client, req);
+  if (queue) req->queued = strdup_safe(json);
+  if ((!queue && !client->connected) || (queue && !req->queued)) {
+    pthread_mutex_unlock(&client->pending_mutex);
+    limiter_done(client, req, OUTCOME_FAILED, 0);
+    return queue ? SQRL_ERR_MEMORY : SQRL_ERR_CLOSED;
   }
+  req->next = client->pending_requests;
+  client->pending_requests = req;
+  pthread_mutex_unlock(&client->pending_mutex);
+  if (queue) return SQRL_OK;
 
-  subscription_entry_t *sub = client->subscriptions;
-  while (sub) {
-    subscription_entry_t *next = sub->next;
-    free(sub->id);
-    free(sub);
-    sub = next;
+  /* A failed send usually also resets the reader, whose fail_pending() may
+   * already have delivered the error. Only a req still linked is ours to
+   * fail. */
+  err = stripe ? stripe_send(stripe, json) : send_frame(client, json);
+  if (err != SQRL_OK) {
+    if (!pending_unlink(client, id)) return SQRL_OK;
+    limiter_done(client, req, OUTCOME_FAILED, 0);
   }
+  return err;
+}
 
-  pthread_mutex_destroy(&client->write_mutex);
-  pthread_mutex_destroy(&client->pending_mutex);
-  pthread_mutex_destroy(&client->subs_mutex);
+static sqrl_error_t wait_request(sqrl_client_t *client, pending_request_t *req, char **response_out) {
+  pthread_mutex_lock(&req->mutex);
+  if (client->request_timeout_ms > 0) {
+    struct timespec ts = deadline_after_ns((uint64_t)client->request_timeout_ms * 1000000ull);
+    while (!req->completed) {
+      if (pthread_cond_timedwait(&req->cond, &req->mutex, &ts) == ETIMEDOUT) break;
+    }
+  } else {
+    while (!req->completed) pthread_cond_wait(&req->cond, &req->mutex);
+  }
+  pthread_mutex_unlock(&req->mutex);
 
-  free(client->session_id);
-  free(client);
-}
+  /* After unlinking no one else can touch req */
+  pending_unlink(client, req->id);
+  if (!req->completed) {
+    limiter_done(client, req, OUTCOME_FAILED, 0);
+    atomic_fetch_add_explicit(&client->stat_timeouts, 1, memory_order_relaxed);
+  }
 
-const char *sqrl_session_id(const sqrl_client_t *client) {
-  return client ? client->session_id : NULL;
+  sqrl_error_t err = req->completed ? req->error : SQRL_ERR_TIMEOUT;
+  *response_out = req->response;
+  req->response = NULL;
+  pending_free(req);
+  return err;
 }
 
-bool sqrl_is_connected(const sqrl_client_t *client) {
-  return client && client->connected;
-}
+/* Checks a reply envelope and, if data_out is set, extracts its payload.
+ * Always consumes response. */
+static sqrl_error_t take_result(char *response, char **data_out) {
+  if (data_out) *data_out = NULL;
+  if (!response) return SQRL_ERR_DECODE;
 
-sqrl_error_t sqrl_ping(sqrl_client_t *client) {
-  if (!client || !client->connected) return SQRL_ERR_CLOSED;
+  char *type = json_get_string(response, "type");
+  if (!type) {
+    free(response);
+    return SQRL_ERR_DECODE;
+  }
+
+  if (strcmp(type, "error") == 0) {
+    char *message = json_get_string(response, "error");
+    sqrl_error_t err = SQRL_ERR_SERVER;
+    if (message && strstr(message, "not found")) err = SQRL_ERR_NOT_FOUND;
+    else if (message && strstr(message, "version conflict")) err = SQRL_ERR_CONFLICT;
+    free(message);
+    free(type);
+    free(response);
+    return err;
+  }
+  free(type);
 
-  char *id = malloc(32);
-  snprintf(id, 32, "%llu", (unsigned long long)++client->request_id);
+  if (!data_out) {
+    free(response);
+    return SQRL_OK;
+  }
 
-  char json[256];
-  snprintf(json, sizeof(json), "{\"type\":\"ping\",\"id\":\"%s\"}", id);
+  *data_out = json_take_value(response, "data");
+  return *data_out ? SQRL_OK : SQRL_ERR_DECODE;
+}
 
-  /* Simplified - just send ping, don't wait for pong in this template */
-  sqrl_error_t err = send_frame(client, json);
-  free(id);
+/* Sends json as request id and waits for the whole reply envelope */
+static sqrl_error_t call_raw(sqrl_client_t *client, const char *id, const char *json, char **response_out) {
+  *response_out = NULL;
+  pending_request_t *req = pending_new(id);
+  if (!req) return SQRL_ERR_MEMORY;
 
-  return err;
+  sqrl_error_t err = submit_request(client, req, json);
+  if (err != SQRL_OK) {
+    pending_free(req);
+    return err;
+  }
+
+  char *response = NULL;
+  err = wait_request(client, req, &response);
+  if (err != SQRL_OK) {
+    free(response);
+    return err;
+  }
+  *response_out = response;
+  return SQRL_OK;
+}
+
+/* Sends json as request id and waits for its reply payload */
+static sqrl_error_t call(sqrl_client_t *client, const char *id, const char *json, char **data_out) {
+  char *response = NULL;
+  sqrl_error_t err = call_raw(client, id, json, &response);
+  if (err != SQRL_OK) return err;
+  return take_result(response, data_out);
+}
+
+static sqrl_error_t call_async(sqrl_client_t *client, pending_request_t *req, const char *json) {
+  if (!json) {
+    pending_free(req);
+    return SQRL_ERR_MEMORY;
+  }
+
+  sqrl_error_t err = submit_request(client, req, json);
+  if (err != SQRL_OK) pending_free(req);
+  return err;
+}
+
+static void complete_result(pending_request_t *req, sqrl_error_t err, char *response) {
+  char *data = NULL;
+  if (err == SQRL_OK) err = take_result(response, &data);
+  req->callback.result(err, data, req->user_data);
+}
+
+static void complete_document(pending_request_t *req, sqrl_error_t err, char *response) {
+  char *data = NULL;
+  sqrl_document_t *doc = NULL;
+  if (err == SQRL_OK) err = take_result(response, &data);
+  if (err == SQRL_OK) {
+    doc = parse_document(req->client, data);
+    if (!doc) err = SQRL_ERR_DECODE;
+  }
+  free(data);
+  req->callback.document(err, doc, req->user_data);
+}
+
+/* Reader thread */
+
+static void decode_change(sqrl_client_t *client, const char *json, sqrl_change_event_t *event) {
+  char *type_str = json_get_string(json, "type");
+  if (type_str) {
+    if (strcmp(type_str, "initial") == 0) event->type = SQRL_CHANGE_INITIAL;
+    else if (strcmp(type_str, "insert") == 0) event->type = SQRL_CHANGE_INSERT;
+    else if (strcmp(type_str, "update") == 0) event->type = SQRL_CHANGE_UPDATE;
+    else if (strcmp(type_str, "delete") == 0) event->type = SQRL_CHANGE_DELETE;
+    free(type_str);
+  }
+
+  char *committed_at = json_get_string(json, "committed_at");
+  if (committed_at) {
+    event->commit_time_us = parse_timestamp_ns(committed_at) / 1000;
+    free(committed_at);
+  }
+
+  char *doc_json;
+  switch (event->type) {
+    case SQRL_CHANGE_INITIAL:
+      if ((doc_json = json_get_object(json, "document"))) {
+        event->document = parse_document(client, doc_json);
+        free(doc_json);
+      }
+      break;
+    case SQRL_CHANGE_INSERT:
+    case SQRL_CHANGE_UPDATE:
+      if ((doc_json = json_get_object(json, "new"))) {
+        event->new_doc = parse_document(client, doc_json);
+        free(doc_json);
+      }
+      if (event->type == SQRL_CHANGE_INSERT) break;
+      /* fall through */
+    case SQRL_CHANGE_DELETE:
+      if ((doc_json = json_get_object(json, "old"))) {
+        event->old_data = json_get_raw(doc_json, "data");
+        if (!event->collection) event->collection = json_get_string(doc_json, "collection");
+        free(doc_json);
+      }
+      break;
+  }
+
+  /* Prefer the change's own tag, else the document's */
+  char *collection = json_get_string(json, "collection");
+  if (collection) {
+    free(event->collection);
+    event->collection = collection;
+  } else if (!event->collection) {
+    const sqrl_document_t *doc = event->document ? event->document : event->new_doc;
+    if (doc) event->collection = strdup_safe(doc->collection);
+  }
+}
+
+static void tracked_clear(subscription_entry_t *entry) {
+  for (size_t i = 0; i < entry->doc_count; i++) {
+    free(entry->doc_ids[i]);
+    free(entry->docs[i]);
+  }
+  free(entry->doc_ids);
+  free(entry->docs);
+  entry->doc_ids = NULL;
+  entry->docs = NULL;
+  entry->doc_count = 0;
+  entry->doc_cap = 0;
+  entry->tracked_bytes = 0;
+}
+
+static void change_event_clear(sqrl_change_event_t *event) {
+  sqrl_document_free(event->document);
+  sqrl_document_free(event->new_doc);
+  free(event->old_data);
+  free(event->collection);
+}
+
+static void entry_free(subscription_entry_t *entry) {
+  /* Only handles unsubscribed from a callback can be left */
+  while (entry->listeners) {
+    sqrl_subscription_t *sub = entry->listeners;
+    entry->listeners = sub->next;
+    free(sub);
+  }
+  tracked_clear(entry);
+  pthread_mutex_destroy(&entry->deliver_mutex);
+  free(entry->id);
+  free(entry->key);
+  free(entry);
+}
+
+/* Tracked documents, deliver_mutex held */
+
+static ssize_t tracked_find(const subscription_entry_t *entry, const char *doc_id) {
+  for (size_t i = 0; i < entry->doc_count; i++) {
+    if (strcmp(entry->doc_ids[i], doc_id) == 0) return (ssize_t)i;
+  }
+  return -1;
+}
+
+/* Takes ownership of doc_json */
+static bool tracked_put(subscription_entry_t *entry, const char *doc_id, char *doc_json) {
+  ssize_t i = tracked_find(entry, doc_id);
+  if (i >= 0) {
+    entry->tracked_bytes += strlen(doc_json) - strlen(entry->docs[i]);
+    free(entry->docs[i]);
+    entry->docs[i] = doc_json;
+    return true;
+  }
+
+  if (entry->doc_count == entry->doc_cap) {
+    size_t cap = entry->doc_cap ? entry->doc_cap * 2 : 16;
+    char **ids = realloc(entry->doc_ids, cap * sizeof(char *));
+    if (ids) entry->doc_ids = ids;
+    char **docs = ids ? realloc(entry->docs, cap * sizeof(char *)) : NULL;
+    if (docs) entry->docs = docs;
+    if (!ids || !docs) {
+      free(doc_json);
+      return false;
+    }
+    entry->doc_cap = cap;
+  }
+
+  char *id_copy = strdup_safe(doc_id);
+  if (!id_copy) {
+    free(doc_json);
+    return false;
+  }
+  entry->doc_ids[entry->doc_count] = id_copy;
+  entry->docs[entry->doc_count] = doc_json;
+  entry->doc_count++;
+  entry->tracked_bytes += strlen(id_copy) + strlen(doc_json);
+  return true;
+}
+
+static void tracked_remove(subscription_entry_t *entry, const char *doc_id) {
+  ssize_t i = tracked_find(entry, doc_id);
+  if (i < 0) return;
+
+  entry->tracked_bytes -= strlen(entry->doc_ids[i]) + strlen(entry->docs[i]);
+  free(entry->doc_ids[i]);
+  free(entry->docs[i]);
+  size_t tail = entry->doc_count - (size_t)i - 1;
+  memmove(entry->doc_ids + i, entry->doc_ids + i + 1, tail * sizeof(char *));
+  memmove(entry->docs + i, entry->docs + i + 1, tail * sizeof(char *));
+  entry->doc_count--;
+}
+
+/* Applies a change to the tracked result set. If tracking fails or the set
+ * outgrows TRACKED_MAX_BYTES, the feed stops being shared rather than
+ * replaying a wrong snapshot, and the copy is dropped. */
+static void track_change(sqrl_client_t *client, subscription_entry_t *entry, const char *json,
+                         const sqrl_change_event_t *event) {
+  if (!entry->tracking) return;
+
+  bool ok = true;
+  if (event->type == SQRL_CHANGE_DELETE) {
+    char *old = json_get_object(json, "old");
+    char *doc_id = old ? json_get_string(old, "id") : NULL;
+    if (doc_id) tracked_remove(entry, doc_id);
+    else ok = false;
+    free(doc_id);
+    free(old);
+  } else {
+    const sqrl_document_t *doc = event->type == SQRL_CHANGE_INITIAL ? event->document : event->new_doc;
+    char *doc_json = json_get_object(json, event->type == SQRL_CHANGE_INITIAL ? "document" : "new");
+    if (doc && doc->id && doc_json) {
+      ok = tracked_put(entry, doc->id, doc_json);
+    } else {
+      free(doc_json);
+      ok = false;
+    }
+  }
+  if (!ok || entry->tracked_bytes > TRACKED_MAX_BYTES) {
+    entry->tracking = false;
+    tracked_clear(entry);
+    pthread_mutex_lock(&client->subs_mutex);
+    entry->shareable = false;
+    pthread_mutex_unlock(&client->subs_mutex);
+  }
+}
+
+/* Records how long an event took from commit to receipt, through any
+ * queue and through the callbacks */
+static void record_lag(subscription_entry_t *entry, const sqrl_change_event_t *event,
+                       int64_t received_us, uint64_t queue_ns, uint64_t callback_ns) {
+  latency_record(&entry->lag_queue, queue_ns);
+  latency_record(&entry->lag_callback, callback_ns);
+  if (event->commit_time_us <= 0) return;
+
+  /* Clock skew can put the commit after receipt; count that as no delay */
+  uint64_t network_ns = received_us > event->commit_time_us
+    ? (uint64_t)(received_us - event->commit_time_us) * 1000 : 0;
+  latency_record(&entry->lag_network, network_ns);
+  latency_record(&entry->lag_total, network_ns + queue_ns + callback_ns);
+}
+
+/* Nonzero while the calling thread runs change callbacks */
+static _Thread_local int t_delivering;
+
+/* Frees the handles unsubscribed from a callback; deliver_mutex held */
+static void sweep_listeners(subscription_entry_t *entry) {
+  sqrl_subscription_t **link = &entry->listeners;
+  while (*link) {
+    sqrl_subscription_t *sub = *link;
+    if (atomic_load(&sub->removed)) {
+      *link = sub->next;
+      free(sub);
+    } else {
+      link = &sub->next;
+    }
+  }
+}
+
+static sqrl_error_t close_feed(sqrl_client_t *client, subscription_entry_t *entry, bool wait);
+
+/* Queues a change for a replaying listener; takes ownership of json */
+static void backlog_push(sqrl_subscription_t *sub, char *json) {
+  change_item_t *item = json ? calloc(1, sizeof(change_item_t)) : NULL;
+  if (!item) {
+    free(json);
+    return;
+  }
+  item->entry = sub->entry;
+  item->json = json;
+  if (sub->backlog_tail) sub->backlog_tail->next = item;
+  else sub->backlog = item;
+  sub->backlog_tail = item;
+}
+
+/* Delivers to every listener without subs_mutex, so a slow consumer doesn't
+ * block sqrl_debug_snapshot(); deliver_mutex keeps listeners stable. The
+ * caller holds a dispatching count on entry, which this drops. */
+static void deliver_change(sqrl_client_t *client, subscription_entry_t *entry, const char *json,
+                           uint64_t received_ns, int64_t received_us) {
+  sqrl_change_event_t event = {0};
+  decode_change(client, json, &event);
+
+  pthread_mutex_lock(&entry->deliver_mutex);
+  track_change(client, entry, json, &event);
+  uint64_t start = now_ns();
+  t_delivering++;
+  for (sqrl_subscription_t *sub = entry->listeners; sub; sub = sub->next) {
+    if (atomic_load(&sub->removed)) continue;
+    if (sub->replaying) backlog_push(sub, strdup_safe(json));
+    else sub->callback(&event, sub->user_data);
+  }
+  t_delivering--;
+  uint64_t end = now_ns();
+  sweep_listeners(entry);
+  pthread_mutex_unlock(&entry->deliver_mutex);
+  record_lag(entry, &event, received_us, start - received_ns, end - start);
+  change_event_clear(&event);
+
+  /* Hand the server back credits in batches of half the window */
+  char grant[128] = "";
+  pthread_mutex_lock(&client->subs_mutex);
+  entry->dispatching--;
+  entry->events_delivered++;
+  entry->last_event_ns = now_ns();
+  if (client->credits > 0 && entry->linked && ++entry->unacked >= (client->credits + 1) / 2) {
+    snprintf(grant, sizeof(grant), "{\"type\":\"credit\",\"id\":\"%s\",\"credits\":%d}", entry->id, entry->unacked);
+    entry->unacked = 0;
+  }
+  bool orphaned = entry->orphaned && entry->dispatching == 0;
+  pthread_cond_broadcast(&client->subs_cond);
+  pthread_mutex_unlock(&client->subs_mutex);
+
+  if (grant[0]) send_frame(client, grant);
+  if (orphaned) close_feed(client, entry, false);
+}
+
+/* Flow-controlled delivery
+ *
+ * With subscription_credits set, each feed may have that many events
+ * outstanding: the server stops sending once they are used up, and the
+ * client grants more as callbacks return. Callbacks run on a dispatcher
+ * thread fed by the reader, so a slow consumer throttles its own feed at
+ * the server instead of stalling replies or growing an unbounded backlog.
+ */
+
+static void *dispatcher_thread_func(void *arg) {
+  sqrl_client_t *client = arg;
+
+  pthread_mutex_lock(&client->dispatch_mutex);
+  for (;;) {
+    change_item_t *item = client->changes_head;
+    if (!item) {
+      if (client->dispatcher_stop) break;
+      pthread_cond_wait(&client->dispatch_cond, &client->dispatch_mutex);
+      continue;
+    }
+    client->changes_head = item->next;
+    if (!client->changes_head) client->changes_tail = NULL;
+    pthread_mutex_unlock(&client->dispatch_mutex);
+
+    pthread_mutex_lock(&client->subs_mutex);
+    item->entry->callback_start_ns = now_ns();
+    pthread_mutex_unlock(&client->subs_mutex);
+
+    deliver_change(client, item->entry, item->json, item->received_ns, item->received_us);
+    free(item->json);
+    free(item);
+
+    pthread_mutex_lock(&client->dispatch_mutex);
+  }
+  pthread_mutex_unlock(&client->dispatch_mutex);
+  return NULL;
+}
+
+/* Queues an event for the dispatcher, starting it on first use; false if
+ * the event has to be delivered inline instead */
+static bool queue_change(sqrl_client_t *client, subscription_entry_t *entry, const char *json,
+                         uint64_t received_ns, int64_t received_us) {
+  change_item_t *item = malloc(sizeof(change_item_t));
+  if (item) item->json = strdup_safe(json);
+  if (!item || !item->json) {
+    free(item);
+    return false;
+  }
+  item->entry = entry;
+  item->received_ns = received_ns;
+  item->received_us = received_us;
+  item->next = NULL;
+
+  pthread_mutex_lock(&client->dispatch_mutex);
+  if (!client->dispatcher_started) {
+    client->dispatcher_started =
+      pthread_create(&client->dispatcher_thread, NULL, dispatcher_thread_func, client) == 0;
+  }
+  if (!client->dispatcher_started || client->dispatcher_stop) {
+    pthread_mutex_unlock(&client->dispatch_mutex);
+    free(item->json);
+    free(item);
+    return false;
+  }
+  if (client->changes_tail) client->changes_tail->next = item;
+  else client->changes_head = item;
+  client->changes_tail = item;
+  pthread_cond_signal(&client->dispatch_cond);
+  pthread_mutex_unlock(&client->dispatch_mutex);
+  return true;
+}
+
+/* Drops the undelivered events of entry; subs_mutex held */
+static void drop_queued_changes(sqrl_client_t *client, subscription_entry_t *entry) {
+  pthread_mutex_lock(&client->dispatch_mutex);
+  change_item_t **link = &client->changes_head;
+  client->changes_tail = NULL;
+  while (*link) {
+    change_item_t *item = *link;
+    if (entry && item->entry != entry) {
+      client->changes_tail = item;
+      link = &item->next;
+      continue;
+    }
+    *link = item->next;
+    item->entry->dispatching--;
+    free(item->json);
+    free(item);
+  }
+  pthread_mutex_unlock(&client->dispatch_mutex);
+}
+
+/* Stops the dispatcher once the readers are gone, discarding what's left */
+static void stop_dispatcher(sqrl_client_t *client) {
+  pthread_mutex_lock(&client->subs_mutex);
+  drop_queued_changes(client, NULL);
+  pthread_cond_broadcast(&client->subs_cond);
+  pthread_mutex_unlock(&client->subs_mutex);
+
+  pthread_mutex_lock(&client->dispatch_mutex);
+  client->dispatcher_stop = true;
+  pthread_cond_signal(&client->dispatch_cond);
+  bool started = client->dispatcher_started;
+  pthread_mutex_unlock(&client->dispatch_mutex);
+  if (started) pthread_join(client->dispatcher_thread, NULL);
+}
+
+static void dispatch_change(sqrl_client_t *client, const char *id, const char *json) {
+  uint64_t received_ns = now_ns();
+  int64_t received_us = wall_us();
+
+  pthread_mutex_lock(&client->subs_mutex);
+  subscription_entry_t *entry = client->subscriptions;
+  while (entry && strcmp(entry->id, id) != 0) entry = entry->next;
+  if (!entry) {
+    pthread_mutex_unlock(&client->subs_mutex);
+    return;
+  }
+  entry->dispatching++;
+  entry->callback_start_ns = now_ns();
+  pthread_mutex_unlock(&client->subs_mutex);
+
+  if (client->credits > 0 && queue_change(client, entry, json, received_ns, received_us)) return;
+  deliver_change(client, entry, json, received_ns, received_us);
+}
+
+/* Takes ownership of json */
+static void dispatch_response(sqrl_client_t *client, const char *id, char *json) {
+  pthread_mutex_lock(&client->pending_mutex);
+
+  pending_request_t **link = &client->pending_requests;
+  while (*link && strcmp((*link)->id, id) != 0) link = &(*link)->next;
+
+  pending_request_t *req = *link;
+  if (!req) {
+    pthread_mutex_unlock(&client->pending_mutex);
+    free(json);
+    return;
+  }
+
+  if (req->bulk_key) learn_reply_size(client, req->bulk_key, strlen(json));
+
+  uint64_t rtt = now_ns() - req->sent_ns;
+  latency_record(&client->request_latency, rtt);
+  latency_record_recent(&client->recent_latency, rtt);
+  limiter_done(client, req, OUTCOME_OK, rtt);
+
+  if (req->done) {
+    *link = req->next;
+    pthread_mutex_unlock(&client->pending_mutex);
+    req->done(req, SQRL_OK, json);
+    pending_free(req);
+    return;
+  }
+
+  pthread_mutex_lock(&req->mutex);
+  req->response = json;
+  req->completed = true;
+  pthread_cond_signal(&req->cond);
+  pthread_mutex_unlock(&req->mutex);
+
+  pthread_mutex_unlock(&client->pending_mutex);
+}
+
+/* Runs a reader thread for one socket; every socket completes requests in
+ * the same pending table, and losing any of them closes the client */
+static void read_frames(sqrl_client_t *client, int fd) {
+  while (client->reader_running) {
+    uint8_t msg_type;
+    char *json = NULL;
+
+    sqrl_error_t err = recv_frame(client, fd, &msg_type, &json);
+    if (err != SQRL_OK) {
+      if (client->reader_running) {
+        client->connected = false;
+        fail_pending(client, SQRL_ERR_CLOSED);
+      }
+      break;
+    }
+
+    char *msg_id = json_get_string(json, "id");
+    char *resp_type = json_get_string(json, "type");
+
+    if (msg_id && resp_type) {
+      if (strcmp(resp_type, "change") == 0) {
+        char *change_json = json_get_object(json, "change");
+        if (change_json) {
+          dispatch_change(client, msg_id, change_json);
+          free(change_json);
+        }
+      } else {
+        dispatch_response(client, msg_id, json);
+        json = NULL;
+      }
+    }
+
+    free(msg_id);
+    free(resp_type);
+    free(json);
+  }
+}
+
+static void *reader_thread_func(void *arg) {
+  sqrl_client_t *client = arg;
+  read_frames(client, client->fd);
+  return NULL;
+}
+
+static void *stripe_reader_func(void *arg) {
+  stripe_t *stripe = arg;
+  read_frames(stripe->client, stripe->fd);
+  return NULL;
+}
+
+/* Connection setup */
+
+static sqrl_client_t *client_new(const sqrl_options_t *options) {
+  sqrl_client_t *client = calloc(1, sizeof(sqrl_client_t));
+  if (!client) return NULL;
+
+  client->fd = -1;
+  client->request_timeout_ms = options ? options->request_timeout_ms : 30000;
+  client->batch_max_window_us = options && options->batch_window_us > 0 ? options->batch_window_us : 0;
+  client->batch_window_us = client->batch_max_window_us;
+  client->batch_max_bytes = options && options->batch_max_bytes > 0 ? options->batch_max_bytes : BATCH_DEFAULT_MAX_BYTES;
+  atomic_init(&client->stat_batch_window_us, client->batch_window_us);
+  client->hedge_percentile = options ? options->hedge_percentile : 0.0;
+  client->hedge_min_delay_ns = options && options->hedge_min_delay_ms > 0
+    ? (uint64_t)options->hedge_min_delay_ms * 1000000ull : 0;
+  client->bulk_threshold = options ? options->bulk_threshold : 0;
+  client->coalesce_reads = options && options->coalesce_reads;
+  client->compact_documents = options && options->compact_documents;
+  client->credits = options && options->subscription_credits > 0 ? options->subscription_credits : 0;
+  client->cache_ttl_ns = options && options->result_cache_ttl_ms > 0
+    ? (uint64_t)options->result_cache_ttl_ms * 1000000ull : 0;
+  client->cache_max_entries = options && options->result_cache_max_entries > 0
+    ? options->result_cache_max_entries : CACHE_DEFAULT_MAX_ENTRIES;
+  client->cache_max_bytes = options && options->result_cache_max_bytes > 0
+    ? options->result_cache_max_bytes : CACHE_DEFAULT_MAX_BYTES;
+  client->max_concurrency = options && options->max_concurrency > 0 ? options->max_concurrency : 0;
+  client->limit = client->max_concurrency < LIMIT_INITIAL ? client->max_concurrency : LIMIT_INITIAL;
+  client->breaker_threshold = options && options->breaker_threshold > 0 ? options->breaker_threshold : 0;
+  client->breaker_cooldown_ns = options && options->breaker_cooldown_ms > 0
+    ? (uint64_t)options->breaker_cooldown_ms * 1000000ull : 1000000000ull;
+  client->breaker = BREAKER_CLOSED;
+  atomic_init(&client->stat_limit, (int)client->limit);
+  pthread_mutex_init(&client->write_mutex, NULL);
+  pthread_mutex_init(&client->pending_mutex, NULL);
+  pthread_cond_init(&client->ready_cond, NULL);
+  pthread_mutex_init(&client->subs_mutex, NULL);
+  pthread_cond_init(&client->subs_cond, NULL);
+  pthread_mutex_init(&client->flush_mutex, NULL);
+  pthread_cond_init(&client->batch_cond, NULL);
+  pthread_mutex_init(&client->limit_mutex, NULL);
+  pthread_cond_init(&client->limit_cond, NULL);
+  pthread_mutex_init(&client->flight_mutex, NULL);
+  pthread_mutex_init(&client->dispatch_mutex, NULL);
+  pthread_cond_init(&client->dispatch_cond, NULL);
+  pthread_mutex_init(&client->cache_mutex, NULL);
+  pthread_mutex_init(&client->cache_feed_mutex, NULL);
+  pthread_mutex_init(&client->intern_mutex, NULL);
+  return client;
+}
+
+static void client_destroy(sqrl_client_t *client) {
+  pthread_mutex_destroy(&client->write_mutex);
+  pthread_mutex_destroy(&client->pending_mutex);
+  pthread_cond_destroy(&client->ready_cond);
+  pthread_mutex_destroy(&client->subs_mutex);
+  pthread_cond_destroy(&client->subs_cond);
+  pthread_mutex_destroy(&client->flush_mutex);
+  pthread_cond_destroy(&client->batch_cond);
+  pthread_mutex_destroy(&client->limit_mutex);
+  pthread_cond_destroy(&client->limit_cond);
+  pthread_mutex_destroy(&client->flight_mutex);
+  pthread_mutex_destroy(&client->dispatch_mutex);
+  pthread_cond_destroy(&client->dispatch_cond);
+  pthread_mutex_destroy(&client->cache_mutex);
+  pthread_mutex_destroy(&client->cache_feed_mutex);
+  pthread_mutex_destroy(&client->intern_mutex);
+
+  interned_name_t *name = atomic_load_explicit(&client->interned, memory_order_relaxed);
+  while (name) {
+    interned_name_t *next = name->next;
+    free(name);
+    name = next;
+  }
+
+  free(client->stripes);
+  free(client->batch_buf);
+  free(client->batch_spare);
+  free(client->session_id);
+  free(client->host);
+  free((char *)client->options.auth_token);
+  free((char *)client->options.hedge_host);
+  free(client);
+}
+
+static bool open_stripe(sqrl_client_t *client, stripe_t *stripe, const char *host, uint16_t port, const sqrl_options_t *options) {
+  stripe->client = client;
+  stripe->fd = sqrl_resolver_connect(host, port);
+  if (stripe->fd < 0) return false;
+
+  pthread_mutex_init(&stripe->write_mutex, NULL);
+  if (do_handshake(client, stripe->fd, options) != SQRL_OK ||
+      pthread_create(&stripe->reader_thread, NULL, stripe_reader_func, stripe) != 0) {
+    pthread_mutex_destroy(&stripe->write_mutex);
+    close(stripe->fd);
+    stripe->fd = -1;
+    return false;
+  }
+  stripe->reader_started = true;
+  return true;
+}
+
+/* Striping is best effort like hedging: a socket that fails to open just
+ * leaves one stripe fewer, or no bulk socket. Expects reader_running set. */
+static void open_stripes(sqrl_client_t *client, const char *host, uint16_t port, const sqrl_options_t *options) {
+  size_t extra = options && options->connections > 1 ? (size_t)options->connections - 1 : 0;
+  if (extra > MAX_CONNECTIONS - 1) extra = MAX_CONNECTIONS - 1;
+  size_t bulk = client->bulk_threshold > 0 ? 1 : 0;
+  if (extra + bulk == 0) return;
+
+  client->stripes = calloc(extra + bulk, sizeof(stripe_t));
+  if (!client->stripes) return;
+
+  for (size_t i = 0; i < extra; i++) {
+    if (open_stripe(client, &client->stripes[client->stripe_count], host, port, options)) client->stripe_count++;
+  }
+  /* The bulk socket sits past the round-robin ones */
+  if (bulk && open_stripe(client, &client->stripes[client->stripe_count], host, port, options)) {
+    client->bulk = &client->stripes[client->stripe_count];
+  }
+}
+
+/* Wakes the stripe readers with shutdown() and closes once they exit */
+static void close_stripes(sqrl_client_t *client) {
+  size_t count = client->stripe_count + (client->bulk ? 1 : 0);
+
+  for (size_t i = 0; i < count; i++) shutdown(client->stripes[i].fd, SHUT_RDWR);
+  for (size_t i = 0; i < count; i++) {
+    pthread_join(client->stripes[i].reader_thread, NULL);
+    close(client->stripes[i].fd);
+    pthread_mutex_destroy(&client->stripes[i].write_mutex);
+  }
+  client->stripe_count = 0;
+  client->bulk = NULL;
+}
+
+/* Connects via the resolver cache and handshakes, then starts the I/O threads */
+static sqrl_error_t open_connection(sqrl_client_t *client, const char *host, uint16_t port, const sqrl_options_t *options) {
+  client->fd = sqrl_resolver_connect(host, port);
+  if (client->fd < 0) return SQRL_ERR_CONNECT;
+
+  sqrl_error_t err = do_handshake(client, client->fd, options);
+  if (err != SQRL_OK) {
+    close(client->fd);
+    client->fd = -1;
+    return err;
+  }
+
+  if (client->batch_max_window_us > 0) {
+    client->writer_running = true;
+    if (pthread_create(&client->writer_thread, NULL, writer_thread_func, client) != 0) {
+      client->writer_running = false;
+      close(client->fd);
+      client->fd = -1;
+      return SQRL_ERR_CONNECT;
+    }
+  }
+
+  client->connected = true;
+  client->reader_running = true;
+  if (pthread_create(&client->reader_thread, NULL, reader_thread_func, client) != 0) {
+    client->connected = false;
+    client->reader_running = false;
+    if (client->writer_running) {
+      pthread_mutex_lock(&client->write_mutex);
+      client->writer_running = false;
+      pthread_cond_signal(&client->batch_cond);
+      pthread_mutex_unlock(&client->write_mutex);
+      pthread_join(client->writer_thread, NULL);
+    }
+    close(client->fd);
+    client->fd = -1;
+    return SQRL_ERR_CONNECT;
+  }
+  client->reader_started = true;
+
+  open_stripes(client, host, port, options);
+  atomic_store_explicit(&client->stat_connections, 1 + (int)client->stripe_count + (client->bulk ? 1 : 0),
+                        memory_order_relaxed);
+  return SQRL_OK;
+}
+
+/* Hedging is best effort: without a second connection reads just aren't hedged */
+static sqrl_client_t *connect_hedge(const char *host, uint16_t port, const sqrl_options_t *options) {
+  if (!options || !(options->hedge_percentile > 0.0 && options->hedge_percentile < 100.0)) return NULL;
+
+  sqrl_options_t hedge_opts = *options;
+  hedge_opts.hedge_percentile = 0.0;
+  hedge_opts.lazy_connect = false;
+  hedge_opts.connections = 1;
+  hedge_opts.bulk_threshold = 0;
+  hedge_opts.result_cache_ttl_ms = 0;
+  hedge_opts.subscription_credits = 0;
+
+  sqrl_client_t *hedge = NULL;
+  sqrl_connect(&hedge,
+               options->hedge_host ? options->hedge_host : host,
+               options->hedge_port ? options->hedge_port : port,
+               &hedge_opts);
+  return hedge;
+}
+
+/* Lazy connect
+ *
+ * While connecting, submit_request() parks each frame on its pending entry
+ * instead of sending it. Once the handshake is done the connect thread sends
+ * the parked frames oldest first and only then clears connecting, so requests
+ * submitted afterwards can't overtake them. The hedge connection comes last:
+ * parked requests shouldn't wait on a second handshake.
+ */
+
+static void finish_connect(sqrl_client_t *client, sqrl_error_t err) {
+  if (err != SQRL_OK) {
+    pthread_mutex_lock(&client->pending_mutex);
+    client->connecting = false;
+    client->connect_error = err;
+    pthread_cond_broadcast(&client->ready_cond);
+    pthread_mutex_unlock(&client->pending_mutex);
+
+    fail_pending(client, err);
+    return;
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&client->pending_mutex);
+    size_t queued = 0;
+    for (pending_request_t *req = client->pending_requests; req; req = req->next) {
+      if (req->queued) queued++;
+    }
+    if (queued == 0) break;
+
+    /* Newest entries come first; without memory, send just the oldest per pass */
+    char *oldest = NULL;
+    size_t count = queued;
+    char **frames = malloc(count * sizeof(char *));
+    if (!frames) {
+      frames = &oldest;
+      count = 1;
+    }
+    size_t slot = queued;
+    uint64_t now = now_ns();
+    for (pending_request_t *req = client->pending_requests; req; req = req->next) {
+      if (!req->queued || --slot >= count) continue;
+      frames[slot] = req->queued;
+      req->queued = NULL;
+      req->sent_ns = now;
+    }
+    pthread_mutex_unlock(&client->pending_mutex);
+
+    for (size_t i = 0; i < count; i++) {
+      send_frame(client, frames[i]);
+      free(frames[i]);
+    }
+    if (frames != &oldest) free(frames);
+  }
+
+  /* Still holding pending_mutex */
+  client->connecting = false;
+  pthread_cond_broadcast(&client->ready_cond);
+  pthread_mutex_unlock(&client->pending_mutex);
+}
+
+static void *connect_thread_func(void *arg) {
+  sqrl_client_t *client = arg;
+
+  sqrl_error_t err = open_connection(client, client->host, client->port, &client->options);
+  finish_connect(client, err);
+  if (err != SQRL_OK) return NULL;
+
+  sqrl_client_t *hedge = connect_hedge(client->host, client->port, &client->options);
+  pthread_mutex_lock(&client->pending_mutex);
+  atomic_store_explicit(&client->hedge, hedge, memory_order_release);
+  pthread_mutex_unlock(&client->pending_mutex);
+  return NULL;
+}
+
+/* Public API */
+
+sqrl_error_t sqrl_init(void) {
+  if (g_initialized) return SQRL_OK;
+  g_initialized = true;
+  return SQRL_OK;
+}
+
+void sqrl_cleanup(void) {
+  sqrl_resolver_flush();
+  g_initialized = false;
+}
+
+const char *sqrl_error_string(sqrl_error_t err) {
+  switch (err) {
+    case SQRL_OK: return "Success";
+    case SQRL_ERR_CONNECT: return "Connection failed";
+    case SQRL_ERR_HANDSHAKE: return "Handshake failed";
+    case SQRL_ERR_VERSION_MISMATCH: return "Protocol version mismatch";
+    case SQRL_ERR_AUTH_FAILED: return "Authentication failed";
+    case SQRL_ERR_SEND: return "Send failed";
+    case SQRL_ERR_RECV: return "Receive failed";
+    case SQRL_ERR_TIMEOUT: return "Timeout";
+    case SQRL_ERR_CLOSED: return "Connection closed";
+    case SQRL_ERR_INVALID_ARG: return "Invalid argument";
+    case SQRL_ERR_MEMORY: return "Memory allocation failed";
+    case SQRL_ERR_ENCODE: return "Encoding failed";
+    case SQRL_ERR_DECODE: return "Decoding failed";
+    case SQRL_ERR_SERVER: return "Server error";
+    case SQRL_ERR_NOT_FOUND: return "Not found";
+    case SQRL_ERR_OVERLOADED: return "Too many requests in flight";
+    case SQRL_ERR_UNAVAILABLE: return "Circuit breaker open";
+    case SQRL_ERR_CONFLICT: return "Version conflict";
+    default: return "Unknown error";
+  }
+}
+
+sqrl_options_t sqrl_options_default(void) {
+  sqrl_options_t opts = {
+    .auth_token = NULL,
+    .use_msgpack = true,
+    .connect_timeout_ms = 5000,
+    .request_timeout_ms = 30000,
+    .batch_window_us = 0,
+    .batch_max_bytes = BATCH_DEFAULT_MAX_BYTES,
+    .hedge_percentile = 0.0,
+    .hedge_min_delay_ms = 1,
+    .hedge_host = NULL,
+    .hedge_port = 0,
+    .max_concurrency = 0,
+    .breaker_threshold = 0,
+    .breaker_cooldown_ms = 1000,
+    .lazy_connect = false,
+    .connections = 1,
+    .bulk_threshold = 0,
+    .coalesce_reads = false,
+    .result_cache_ttl_ms = 0,
+    .result_cache_max_entries = CACHE_DEFAULT_MAX_ENTRIES,
+    .result_cache_max_bytes = CACHE_DEFAULT_MAX_BYTES,
+    .subscription_credits = 0,
+    .compact_documents = false,
+  };
+  return opts;
+}
+
+sqrl_error_t sqrl_connect(sqrl_client_t **client_out, const char *host, uint16_t port, const sqrl_options_t *options) {
+  if (!client_out || !host) return SQRL_ERR_INVALID_ARG;
+
+  sqrl_client_t *client = client_new(options);
+  if (!client) return SQRL_ERR_MEMORY;
+
+  if (options && options->lazy_connect) {
+    client->host = strdup_safe(host);
+    client->port = port;
+    client->options = *options;
+    client->options.auth_token = strdup_safe(options->auth_token);
+    client->options.hedge_host = strdup_safe(options->hedge_host);
+    if (!client->host || (options->auth_token && !client->options.auth_token) ||
+        (options->hedge_host && !client->options.hedge_host)) {
+      client_destroy(client);
+      return SQRL_ERR_MEMORY;
+    }
+
+    client->connecting = true;
+    if (pthread_create(&client->connect_thread, NULL, connect_thread_func, client) != 0) {
+      client_destroy(client);
+      return SQRL_ERR_CONNECT;
+    }
+    client->connect_thread_started = true;
+
+    *client_out = client;
+    return SQRL_OK;
+  }
+
+  sqrl_error_t err = open_connection(client, host, port, options);
+  if (err != SQRL_OK) {
+    client_destroy(client);
+    return err;
+  }
+  atomic_store_explicit(&client->hedge, connect_hedge(host, port, options), memory_order_relaxed);
+
+  *client_out = client;
+  return SQRL_OK;
+}
+
+void sqrl_disconnect(sqrl_client_t *client) {
+  if (!client) return;
+
+  /* A lazy connect has to settle before there is anything to tear down */
+  if (client->connect_thread_started) pthread_join(client->connect_thread, NULL);
+
+  sqrl_disconnect(atomic_load_explicit(&client->hedge, memory_order_relaxed));
+  cache_destroy(client);
+
+  /* Let the writer flush whatever is still queued before the socket closes */
+  if (client->writer_running) {
+    pthread_mutex_lock(&client->write_mutex);
+    client->writer_running = false;
+    pthread_cond_signal(&client->batch_cond);
+    pthread_mutex_unlock(&client->write_mutex);
+    pthread_join(client->writer_thread, NULL);
+  }
+
+  client->reader_running = false;
+  client->connected = false;
+
+  /* Wake the reader with shutdown() and only close once it has exited */
+  if (client->fd >= 0) shutdown(client->fd, SHUT_RDWR);
+  close_stripes(client);
+
+  if (client->reader_started) pthread_join(client->reader_thread, NULL);
+  stop_dispatcher(client);
+
+  if (client->fd >= 0) {
+    close(client->fd);
+    client->fd = -1;
+  }
+
+  fail_pending(client, SQRL_ERR_CLOSED);
+
+  pending_request_t *req = client->pending_requests;
+  while (req) {
+    pending_request_t *next = req->next;
+    pending_free(req);
+    req = next;
+  }
+
+  subscription_entry_t *entry = client->subscriptions;
+  while (entry) {
+    subscription_entry_t *next = entry->next;
+    entry_free(entry);
+    entry = next;
+  }
+  client->subscriptions = NULL;
+
+  client_destroy(client);
+}
+
+sqrl_error_t sqrl_wait_connected(sqrl_client_t *client, int timeout_ms) {
+  if (!client) return SQRL_ERR_INVALID_ARG;
+
+  pthread_mutex_lock(&client->pending_mutex);
+  if (timeout_ms > 0) {
+    struct timespec ts = deadline_after_ns((uint64_t)timeout_ms * 1000000ull);
+    while (client->connecting) {
+      if (pthread_cond_timedwait(&client->ready_cond, &client->pending_mutex, &ts) == ETIMEDOUT) break;
+    }
+  } else {
+    while (client->connecting) pthread_cond_wait(&client->ready_cond, &client->pending_mutex);
+  }
+  sqrl_error_t err = client->connecting ? SQRL_ERR_TIMEOUT
+                   : client->connected ? SQRL_OK
+                   : client->connect_error != SQRL_OK ? client->connect_error : SQRL_ERR_CLOSED;
+  pthread_mutex_unlock(&client->pending_mutex);
+  return err;
+}
+
+sqrl_error_t sqrl_warmup(sqrl_client_t *const *clients, size_t count) {
+  if (!clients && count > 0) return SQRL_ERR_INVALID_ARG;
+
+  pending_request_t **reqs = calloc(count ? count : 1, sizeof(pending_request_t *));
+  if (!reqs) return SQRL_ERR_MEMORY;
+
+  /* Queue a ping on every client first so connects and round trips overlap */
+  sqrl_error_t result = SQRL_OK;
+  for (size_t i = 0; i < count; i++) {
+    sqrl_client_t *client = clients[i];
+    if (!client) {
+      result = SQRL_ERR_INVALID_ARG;
+      continue;
+    }
+
+    char id[32], json[64];
+    next_request_id(client, id, sizeof(id));
+    snprintf(json, sizeof(json), "{\"type\":\"ping\",\"id\":\"%s\"}", id);
+
+    reqs[i] = pending_new(id);
+    sqrl_error_t err = reqs[i] ? submit_request(client, reqs[i], json) : SQRL_ERR_MEMORY;
+    if (err != SQRL_OK) {
+      pending_free(reqs[i]);
+      reqs[i] = NULL;
+      if (result == SQRL_OK) result = err;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (!reqs[i]) continue;
+    char *response = NULL;
+    sqrl_error_t err = wait_request(clients[i], reqs[i], &response);
+    if (err == SQRL_OK) err = take_result(response, NULL);
+    else free(response);
+    if (result == SQRL_OK) result = err;
+  }
+
+  free(reqs);
+  return result;
+}
+
+const char *sqrl_session_id(const sqrl_client_t *client) {
+  return client ? client->session_id : NULL;
+}
+
+bool sqrl_is_connected(const sqrl_client_t *client) {
+  return client && client->connected;
+}
+
+sqrl_error_t sqrl_ping(sqrl_client_t *client) {
+  if (!client || !client->connected) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char json[256];
+  snprintf(json, sizeof(json), "{\"type\":\"ping\",\"id\":\"%s\"}", id);
+
+  /* Simplified - just send ping, don't wait for pong in this template */
+  return send_frame(client, json);
+}
+
+/* Document operations */
+
+static char *query_json(const char *id, const char *query) {
+  char *escaped = json_escape(query);
+  char *json = escaped ? json_printf("{\"type\":\"query\",\"id\":\"%s\",\"query\":\"%s\"}", id, escaped) : NULL;
+  free(escaped);
+  return json;
+}
+
+/* Hedged reads
+ *
+ * The query goes out on the primary connection; if it is still unanswered
+ * after the hedge delay a duplicate goes out on client->hedge. The first
+ * successful reply wins and the other leg is cancelled locally (its reply,
+ * if any, is discarded on arrival). hedge_state_t is shared by the waiting
+ * caller and each leg still registered in a pending table.
+ */
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int refs;
+  int outstanding;
+  bool done;
+  bool hedge_won;
+  sqrl_error_t err;
+  char *result;
+} hedge_state_t;
+
+static void hedge_release(hedge_state_t *h) {
+  pthread_mutex_lock(&h->mutex);
+  int refs = --h->refs;
+  pthread_mutex_unlock(&h->mutex);
+  if (refs > 0) return;
+
+  free(h->result);
+  pthread_mutex_destroy(&h->mutex);
+  pthread_cond_destroy(&h->cond);
+  free(h);
+}
+
+static void hedge_finish(hedge_state_t *h, sqrl_error_t err, char *response, bool is_hedge) {
+  char *data = NULL;
+  if (err == SQRL_OK) err = take_result(response, &data);
+
+  pthread_mutex_lock(&h->mutex);
+  h->outstanding--;
+  /* A failed leg only decides the outcome if nothing else is in flight */
+  if (!h->done && (err == SQRL_OK || h->outstanding == 0)) {
+    h->done = true;
+    h->err = err;
+    h->result = data;
+    h->hedge_won = is_hedge;
+    data = NULL;
+    pthread_cond_signal(&h->cond);
+  }
+  pthread_mutex_unlock(&h->mutex);
+
+  free(data);
+  hedge_release(h);
+}
+
+static void complete_hedge_primary(pending_request_t *req, sqrl_error_t err, char *response) {
+  hedge_finish(req->user_data, err, response, false);
+}
+
+static void complete_hedge_backup(pending_request_t *req, sqrl_error_t err, char *response) {
+  hedge_finish(req->user_data, err, response, true);
+}
+
+/* The primary leg may wait for a concurrency slot like any blocking
+ * query; the backup is only worth sending if it gets one at once */
+static sqrl_error_t hedge_leg(sqrl_client_t *client, const char *query, pending_done_t done, hedge_state_t *h, char *id,
+                              bool blocking) {
+  next_request_id(client, id, 32);
+
+  pending_request_t *req = pending_new(id);
+  if (!req) return SQRL_ERR_MEMORY;
+  req->done = done;
+  req->user_data = h;
+  req->blocking = blocking;
+
+  pthread_mutex_lock(&h->mutex);
+  h->refs++;
+  h->outstanding++;
+  pthread_mutex_unlock(&h->mutex);
+
+  char *json = query_json(id, query);
+  sqrl_error_t err = call_async(client, req, json);
+  free(json);
+
+  if (err != SQRL_OK) {
+    pthread_mutex_lock(&h->mutex);
+    h->refs--;
+    h->outstanding--;
+    pthread_mutex_unlock(&h->mutex);
+  }
+  return err;
+}
+
+/* Waits for h->done until deadline_ns (CLOCK_MONOTONIC); h->mutex held */
+static void hedge_wait(hedge_state_t *h, uint64_t deadline_ns) {
+  while (!h->done) {
+    uint64_t now = now_ns();
+    if (now >= deadline_ns) break;
+    struct timespec ts = deadline_after_ns(deadline_ns - now);
+    pthread_cond_timedwait(&h->cond, &h->mutex, &ts);
+  }
+}
+
+static sqrl_error_t hedged_query(sqrl_client_t *client, sqrl_client_t *hedge, const char *query, char **result_out) {
+  hedge_state_t *h = calloc(1, sizeof(hedge_state_t));
+  if (!h) return SQRL_ERR_MEMORY;
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->cond, NULL);
+  h->refs = 1;
+
+  uint64_t start = now_ns();
+  uint64_t timeout_ns = client->request_timeout_ms > 0
+    ? (uint64_t)client->request_timeout_ms * 1000000ull : UINT64_MAX / 2;
+  uint64_t delay_ns = latency_percentile(&client->recent_latency, client->hedge_percentile);
+  if (delay_ns > 0 && delay_ns < client->hedge_min_delay_ns) delay_ns = client->hedge_min_delay_ns;
+
+  char primary_id[32], backup_id[32];
+  bool hedged = false;
+
+  sqrl_error_t err = hedge_leg(client, query, complete_hedge_primary, h, primary_id, true);
+  if (err != SQRL_OK) {
+    hedge_release(h);
+    return err;
+  }
+
+  pthread_mutex_lock(&h->mutex);
+  if (delay_ns > 0 && delay_ns < timeout_ns) {
+    hedge_wait(h, start + delay_ns);
+    if (!h->done && hedge->connected) {
+      pthread_mutex_unlock(&h->mutex);
+      hedged = hedge_leg(hedge, query, complete_hedge_backup, h, backup_id, false) == SQRL_OK;
+      if (hedged) atomic_fetch_add_explicit(&client->stat_hedges_sent, 1, memory_order_relaxed);
+      pthread_mutex_lock(&h->mutex);
+    }
+  }
+  hedge_wait(h, start + timeout_ns);
+
+  bool timed_out = !h->done;
+  if (h->done) {
+    err = h->err;
+    *result_out = h->result;
+    h->result = NULL;
+    if (h->hedge_won) atomic_fetch_add_explicit(&client->stat_hedges_won, 1, memory_order_relaxed);
+  } else {
+    h->done = true;
+    err = SQRL_ERR_TIMEOUT;
+    atomic_fetch_add_explicit(&client->stat_timeouts, 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&h->mutex);
+
+  /* Cancelled legs never run their done hook, so drop their references
+   * here. Legs still out at the deadline count as timeouts, the loser of a
+   * race as merely cancelled. */
+  request_outcome_t outcome = timed_out ? OUTCOME_FAILED : OUTCOME_CANCELLED;
+  if (pending_cancel(client, primary_id, outcome)) hedge_release(h);
+  if (hedged && pending_cancel(hedge, backup_id, outcome)) hedge_release(h);
+  hedge_release(h);
+  return err;
+}
+
+static sqrl_error_t run_query(sqrl_client_t *client, const char *query, char **result_out) {
+  sqrl_client_t *hedge = atomic_load_explicit(&client->hedge, memory_order_acquire);
+  if (hedge) return hedged_query(client, hedge, query, result_out);
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = query_json(id, query);
+  if (!json) return SQRL_ERR_MEMORY;
+
+  sqrl_error_t err = call(client, id, json, result_out);
+  free(json);
+  return err;
+}
+
+/* Single-flight reads
+ *
+ * The first sqrl_query() for a query string becomes the leader and sends
+ * it; identical queries arriving before its reply wait for that reply
+ * instead of sending their own. The flight is unlinked as soon as the reply
+ * is in, so a query issued afterwards always goes to the server: this only
+ * merges concurrent round trips and never serves an older result.
+ */
+
+static void flight_release(query_flight_t *flight) {
+  free(flight->query);
+  free(flight->result);
+  pthread_cond_destroy(&flight->cond);
+  free(flight);
+}
+
+static sqrl_error_t follow_flight(sqrl_client_t *client, query_flight_t *flight, char **result_out) {
+  flight->refs++;
+  atomic_fetch_add_explicit(&client->stat_coalesced, 1, memory_order_relaxed);
+  while (!flight->done) pthread_cond_wait(&flight->cond, &client->flight_mutex);
+
+  /* The last follower takes the shared copy instead of duplicating it */
+  sqrl_error_t err = flight->error;
+  bool last = --flight->refs == 0;
+  if (err == SQRL_OK) {
+    *result_out = last ? flight->result : strdup_safe(flight->result);
+    if (last) flight->result = NULL;
+    if (!*result_out) err = SQRL_ERR_MEMORY;
+  }
+  pthread_mutex_unlock(&client->flight_mutex);
+
+  if (last) flight_release(flight);
+  return err;
+}
+
+static sqrl_error_t coalesced_query(sqrl_client_t *client, const char *query, char **result_out) {
+  pthread_mutex_lock(&client->flight_mutex);
+  for (query_flight_t *f = client->flights; f; f = f->next) {
+    if (strcmp(f->query, query) == 0) return follow_flight(client, f, result_out);
+  }
+
+  query_flight_t *flight = calloc(1, sizeof(query_flight_t));
+  if (flight) flight->query = strdup_safe(query);
+  if (!flight || !flight->query) {
+    pthread_mutex_unlock(&client->flight_mutex);
+    free(flight);
+    return run_query(client, query, result_out);
+  }
+  flight->refs = 1;
+  pthread_cond_init(&flight->cond, NULL);
+  flight->next = client->flights;
+  client->flights = flight;
+  pthread_mutex_unlock(&client->flight_mutex);
+
+  sqrl_error_t err = run_query(client, query, result_out);
+
+  pthread_mutex_lock(&client->flight_mutex);
+  query_flight_t **link = &client->flights;
+  while (*link != flight) link = &(*link)->next;
+  *link = flight->next;
+
+  bool last = --flight->refs == 0;
+  if (!last) {
+    flight->error = err;
+    if (err == SQRL_OK && !(flight->result = strdup_safe(*result_out))) flight->error = SQRL_ERR_MEMORY;
+    flight->done = true;
+    pthread_cond_broadcast(&flight->cond);
+  }
+  pthread_mutex_unlock(&client->flight_mutex);
+
+  if (last) flight_release(flight);
+  return err;
+}
+
+static sqrl_error_t fetch_query(sqrl_client_t *client, const char *query, char **result_out) {
+  if (client->coalesce_reads) return coalesced_query(client, query, result_out);
+  return run_query(client, query, result_out);
+}
+
+/* Result cache
+ *
+ * Results are keyed by the canonical query text and kept for the TTL, or
+ * until the table they read changes. Change events arrive asynchronously,
+ * so a change made by another client may go unnoticed for a round trip;
+ * the TTL bounds staleness if a table's change feed couldn't be opened.
+ */
+
+/* Returns the table's invalidation record, subscribing to its changes the
+ * first time; NULL only if out of memory */
+static cache_feed_t *cache_open_feed(sqrl_client_t *client, const char *table) {
+  pthread_mutex_lock(&client->cache_feed_mutex);
+  pthread_mutex_lock(&client->cache_mutex);
+  cache_feed_t *feed = cache_find_feed(client, table);
+  pthread_mutex_unlock(&client->cache_mutex);
+
+  if (!feed && (feed = calloc(1, sizeof(cache_feed_t)))) {
+    feed->client = client;
+    feed->table = strdup_safe(table);
+    sqrl_query_t *q = feed->table ? sqrl_table(table) : NULL;
+    if (!q) {
+      free(feed->table);
+      free(feed);
+      pthread_mutex_unlock(&client->cache_feed_mutex);
+      return NULL;
+    }
+    if (sqrl_subscribe_query(client, q, cache_feed_changed, feed, &feed->sub) != SQRL_OK) feed->sub = NULL;
+    sqrl_query_free(q);
+
+    pthread_mutex_lock(&client->cache_mutex);
+    feed->next = client->cache_feeds;
+    client->cache_feeds = feed;
+    pthread_mutex_unlock(&client->cache_mutex);
+  }
+  pthread_mutex_unlock(&client->cache_feed_mutex);
+  return feed;
+}
+
+/* Evicts least recently used results until one of size bytes fits */
+static void cache_make_room(sqrl_client_t *client, size_t bytes) {
+  while (client->cache_entries &&
+         (client->cache_entry_count >= client->cache_max_entries ||
+          client->cache_bytes + bytes > client->cache_max_bytes)) {
+    cached_result_t **victim = &client->cache_entries;
+    for (cached_result_t **link = &client->cache_entries; *link; link = &(*link)->next) {
+      if ((*link)->last_used_ns < (*victim)->last_used_ns) victim = link;
+    }
+    cache_unlink(client, victim);
+  }
+}
+
+static void cache_store(sqrl_client_t *client, cache_feed_t *feed, uint64_t generation,
+                        const char *key, uint64_t hash, const char *result) {
+  size_t bytes = strlen(key) + strlen(result);
+  if (bytes > client->cache_max_bytes) return;
+
+  cached_result_t *e = calloc(1, sizeof(cached_result_t));
+  if (!e) return;
+  e->key = strdup_safe(key);
+  e->table = strdup_safe(feed->table);
+  e->result = strdup_safe(result);
+  if (!e->key || !e->table || !e->result) {
+    free(e->key);
+    free(e->table);
+    free(e->result);
+    free(e);
+    return;
+  }
+  e->hash = hash;
+  e->bytes = bytes;
+
+  pthread_mutex_lock(&client->cache_mutex);
+  if (feed->generation != generation) {
+    pthread_mutex_unlock(&client->cache_mutex);
+    free(e->key);
+    free(e->table);
+    free(e->result);
+    free(e);
+    return;
+  }
+  for (cached_result_t **link = &client->cache_entries; *link; link = &(*link)->next) {
+    if ((*link)->hash == hash && strcmp((*link)->key, key) == 0) {
+      cache_unlink(client, link);
+      break;
+    }
+  }
+  cache_make_room(client, bytes);
+  e->last_used_ns = now_ns();
+  e->expires_ns = e->last_used_ns + client->cache_ttl_ns;
+  e->next = client->cache_entries;
+  client->cache_entries = e;
+  client->cache_entry_count++;
+  client->cache_bytes += bytes;
+  pthread_mutex_unlock(&client->cache_mutex);
+}
+
+static sqrl_error_t cached_query(sqrl_client_t *client, const char *query, char **result_out) {
+  char *key = canonical_query(query);
+  char *table = key ? query_table(key) : NULL;
+  if (!table) {
+    free(key);
+    return fetch_query(client, query, result_out);
+  }
+  uint64_t hash = hash_text(key, strlen(key));
+
+  pthread_mutex_lock(&client->cache_mutex);
+  uint64_t now = now_ns();
+  for (cached_result_t **link = &client->cache_entries; *link; link = &(*link)->next) {
+    cached_result_t *e = *link;
+    if (e->hash != hash || strcmp(e->key, key) != 0) continue;
+    if (now >= e->expires_ns) {
+      cache_unlink(client, link);
+      break;
+    }
+    e->last_used_ns = now;
+    *result_out = strdup_safe(e->result);
+    pthread_mutex_unlock(&client->cache_mutex);
+    atomic_fetch_add_explicit(&client->stat_cache_hits, 1, memory_order_relaxed);
+    free(key);
+    free(table);
+    return *result_out ? SQRL_OK : SQRL_ERR_MEMORY;
+  }
+  pthread_mutex_unlock(&client->cache_mutex);
+  atomic_fetch_add_explicit(&client->stat_cache_misses, 1, memory_order_relaxed);
+
+  cache_feed_t *feed = cache_open_feed(client, table);
+  pthread_mutex_lock(&client->cache_mutex);
+  uint64_t generation = feed ? feed->generation : 0;
+  pthread_mutex_unlock(&client->cache_mutex);
+
+  sqrl_error_t err = fetch_query(client, query, result_out);
+  if (err == SQRL_OK && feed) cache_store(client, feed, generation, key, hash, *result_out);
+
+  free(key);
+  free(table);
+  return err;
+}
+
+sqrl_error_t sqrl_query(sqrl_client_t *client, const char *query, char **result_out) {
+  if (!client || !query || !result_out) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  if (client->cache_ttl_ns > 0) return cached_query(client, query, result_out);
+  return fetch_query(client, query, result_out);
+}
+
+sqrl_error_t sqrl_result_cache_flush(sqrl_client_t *client) {
+  if (!client) return SQRL_ERR_INVALID_ARG;
+
+  pthread_mutex_lock(&client->cache_mutex);
+  while (client->cache_entries) cache_unlink(client, &client->cache_entries);
+  pthread_mutex_unlock(&client->cache_mutex);
+  return SQRL_OK;
+}
+
+static char *query_many_json(const char *id, const char *const *queries, size_t count) {
+  size_t size = 64;
+  for (size_t i = 0; i < count; i++) size += strlen(queries[i]) * 6 + 3;
+
+  char *json = malloc(size);
+  if (!json) return NULL;
+  size_t len = (size_t)snprintf(json, size, "{\"type\":\"batch\",\"id\":\"%s\",\"queries\":[", id);
+  for (size_t i = 0; i < count; i++) {
+    char *escaped = json_escape(queries[i]);
+    if (!escaped) {
+      free(json);
+      return NULL;
+    }
+    len += (size_t)snprintf(json + len, size - len, "%s\"%s\"", i ? "," : "", escaped);
+    free(escaped);
+  }
+  snprintf(json + len, size - len, "]}");
+  return json;
+}
+
+/* Splits the batch reply, an array of per-query reply envelopes in query
+ * order, into results */
+static sqrl_error_t split_results(const char *data, sqrl_query_result_t *results, size_t count) {
+  const char *p = json_skip_ws(data);
+  if (*p != '[') return SQRL_ERR_DECODE;
+  p = json_skip_ws(p + 1);
+
+  for (size_t i = 0; i < count; i++) {
+    const char *end = *p == '{' ? json_value_end(p) : NULL;
+    if (!end) return SQRL_ERR_DECODE;
+
+    char *envelope = strndup(p, (size_t)(end - p));
+    results[i].error = envelope ? take_result(envelope, &results[i].result) : SQRL_ERR_MEMORY;
+
+    p = json_skip_ws(end);
+    if (*p == ',') p = json_skip_ws(p + 1);
+  }
+  return *p == ']' ? SQRL_OK : SQRL_ERR_DECODE;
+}
+
+sqrl_error_t sqrl_query_many(sqrl_client_t *client, const char *const *queries, size_t count, sqrl_query_result_t *results_out) {
+  if (!client || (!queries && count > 0) || (!results_out && count > 0)) return SQRL_ERR_INVALID_ARG;
+  for (size_t i = 0; i < count; i++) {
+    if (!queries[i]) return SQRL_ERR_INVALID_ARG;
+  }
+  if (count == 0) return SQRL_OK;
+
+  memset(results_out, 0, count * sizeof(sqrl_query_result_t));
+  sqrl_error_t err = client_usable(client) ? SQRL_OK : SQRL_ERR_CLOSED;
+
+  char *data = NULL;
+  if (err == SQRL_OK) {
+    char id[32];
+    next_request_id(client, id, sizeof(id));
+    char *json = query_many_json(id, queries, count);
+    err = json ? call(client, id, json, &data) : SQRL_ERR_MEMORY;
+    free(json);
+  }
+  if (err == SQRL_OK) err = split_results(data, results_out, count);
+  free(data);
+
+  if (err != SQRL_OK) {
+    sqrl_query_results_free(results_out, count);
+    for (size_t i = 0; i < count; i++) results_out[i].error = err;
+  }
+  return err;
+}
+
+void sqrl_query_results_free(sqrl_query_result_t *results, size_t count) {
+  if (!results) return;
+  for (size_t i = 0; i < count; i++) {
+    free(results[i].result);
+    results[i].result = NULL;
+  }
+}
+
+static sqrl_error_t call_document(sqrl_client_t *client, const char *id, const char *json, sqrl_document_t **doc_out) {
+  if (!json) return SQRL_ERR_MEMORY;
+
+  char *data = NULL;
+  sqrl_error_t err = call(client, id, json, doc_out ? &data : NULL);
+  if (err != SQRL_OK || !doc_out) return err;
+
+  *doc_out = parse_document(client, data);
+  free(data);
+  return *doc_out ? SQRL_OK : SQRL_ERR_DECODE;
+}
+
+/* Document ids
+ *
+ * UUIDv7: 48 bits of Unix milliseconds, a 12-bit counter and 62 random
+ * bits. The counter starts at a random point below 2048 each millisecond,
+ * so ids from one thread sort in generation order; when it runs out the
+ * thread borrows the next millisecond. State is per thread and reseeded
+ * after fork(), so parent and child never share a random stream.
+ */
+
+typedef struct {
+  uint64_t rng;
+  uint64_t last_ms;
+  uint32_t counter;
+  unsigned generation;
+  bool seeded;
+} id_state_t;
+
+static _Thread_local id_state_t t_ids;
+static atomic_uint g_fork_generation;
+static pthread_once_t g_fork_once = PTHREAD_ONCE_INIT;
+
+static void id_after_fork(void) {
+  atomic_fetch_add_explicit(&g_fork_generation, 1, memory_order_relaxed);
+}
+
+static void id_register_fork(void) {
+  pthread_atfork(NULL, NULL, id_after_fork);
+}
+
+/* splitmix64 */
+static uint64_t id_random(id_state_t *st) {
+  uint64_t z = (st->rng += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+static void id_seed(id_state_t *st, unsigned generation) {
+  uint64_t seed = 0;
+  /* getentropy() exists on both Linux (glibc 2.25+) and macOS */
+  if (getentropy(&seed, sizeof(seed)) != 0) {
+    seed = now_ns() ^ ((uint64_t)(uintptr_t)st << 16) ^ (uint64_t)getpid();
+  }
+  st->rng = seed;
+  st->last_ms = 0;
+  st->generation = generation;
+  st->seeded = true;
+}
+
+void sqrl_generate_id(char id_out[SQRL_ID_SIZE]) {
+  if (!id_out) return;
+
+  pthread_once(&g_fork_once, id_register_fork);
+  id_state_t *st = &t_ids;
+  unsigned generation = atomic_load_explicit(&g_fork_generation, memory_order_relaxed);
+  if (!st->seeded || st->generation != generation) id_seed(st, generation);
+
+  uint64_t ms = (uint64_t)wall_us() / 1000;
+  if (ms > st->last_ms) {
+    st->last_ms = ms;
+    st->counter = (uint32_t)(id_random(st) & 0x7ff);
+  } else if (++st->counter > 0xfff) {
+    st->last_ms++;
+    st->counter = (uint32_t)(id_random(st) & 0x7ff);
+  }
+
+  uint64_t rand = id_random(st);
+  uint8_t b[16];
+  for (int i = 0; i < 6; i++) b[i] = (uint8_t)(st->last_ms >> (40 - 8 * i));
+  b[6] = (uint8_t)(0x70 | (st->counter >> 8));
+  b[7] = (uint8_t)st->counter;
+  b[8] = (uint8_t)(0x80 | ((rand >> 56) & 0x3f));
+  for (int i = 9; i < 16; i++) b[i] = (uint8_t)(rand >> (8 * (15 - i)));
+
+  static const char hex[] = "0123456789abcdef";
+  char *out = id_out;
+  for (int i = 0; i < 16; i++) {
+    if (i == 4 || i == 6 || i == 8 || i == 10) *out++ = '-';
+    *out++ = hex[b[i] >> 4];
+    *out++ = hex[b[i] & 0x0f];
+  }
+  *out = '\0';
+}
+
+static char *insert_json(const char *id, const char *collection, const char *data) {
+  char *coll = json_escape(collection);
+  char *json = coll ? json_printf("{\"type\":\"insert\",\"id\":\"%s\",\"collection\":\"%s\",\"data\":%s}",
+                                  id, coll, data) : NULL;
+  free(coll);
+  return json;
+}
+
+static char *update_json(const char *id, const char *collection, const char *document_id, const char *data) {
+  char *coll = json_escape(collection);
+  char *doc_id = json_escape(document_id);
+  char *json = (coll && doc_id)
+    ? json_printf("{\"type\":\"update\",\"id\":\"%s\",\"collection\":\"%s\",\"document_id\":\"%s\",\"data\":%s}",
+                  id, coll, doc_id, data)
+    : NULL;
+  free(coll);
+  free(doc_id);
+  return json;
+}
+
+static char *delete_json(const char *id, const char *collection, const char *document_id) {
+  char *coll = json_escape(collection);
+  char *doc_id = json_escape(document_id);
+  char *json = (coll && doc_id)
+    ? json_printf("{\"type\":\"delete\",\"id\":\"%s\",\"collection\":\"%s\",\"document_id\":\"%s\"}",
+                  id, coll, doc_id)
+    : NULL;
+  free(coll);
+  free(doc_id);
+  return json;
+}
+
+sqrl_error_t sqrl_insert(sqrl_client_t *client, const char *collection, const char *data, sqrl_document_t **doc_out) {
+  if (!client || !collection || !data) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = insert_json(id, collection, data);
+  sqrl_error_t err = call_document(client, id, json, doc_out);
+  free(json);
+  return err;
+}
+
+static const char *ack_name(sqrl_ack_t ack) {
+  switch (ack) {
+    case SQRL_ACK_NONE: return "none";
+    case SQRL_ACK_QUEUED: return "queued";
+    default: return "durable";
+  }
+}
+
+static char *insert_ack_json(const char *id, const char *collection, const char *document_id, const char *ack, const char *data) {
+  char *coll = json_escape(collection);
+  char *json = coll
+    ? json_printf("{\"type\":\"insert\",\"id\":\"%s\",\"collection\":\"%s\",\"document_id\":\"%s\",\"ack\":\"%s\",\"data\":%s}",
+                  id, coll, document_id, ack, data)
+    : NULL;
+  free(coll);
+  return json;
+}
+
+static void complete_discard(pending_request_t *req, sqrl_error_t err, char *response) {
+  (void)req;
+  (void)err;
+  free(response);
+}
+
+/* Unacknowledged inserts skip the pending table: the server sends no reply.
+ * While a lazy connect is still running the frame can't be written yet, so
+ * it is queued like any request, asking for a queued ack nobody waits on. */
+static sqrl_error_t send_unacked(sqrl_client_t *client, const char *collection, const char *document_id, const char *data) {
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  /* connected is set before the parked frames are flushed; connecting is
+   * only cleared after, under pending_mutex */
+  pthread_mutex_lock(&client->pending_mutex);
+  bool connecting = client->connecting;
+  pthread_mutex_unlock(&client->pending_mutex);
+
+  if (connecting) {
+    pending_request_t *req = pending_new(id);
+    if (!req) return SQRL_ERR_MEMORY;
+    req->done = complete_discard;
+    char *json = insert_ack_json(id, collection, document_id, ack_name(SQRL_ACK_QUEUED), data);
+    sqrl_error_t err = call_async(client, req, json);
+    free(json);
+    return err;
+  }
+
+  char *json = insert_ack_json(id, collection, document_id, ack_name(SQRL_ACK_NONE), data);
+  if (!json) return SQRL_ERR_MEMORY;
+  if (client->cache_ttl_ns > 0) cache_invalidate_table(client, collection);
+  sqrl_error_t err = send_frame(client, json);
+  free(json);
+  return err;
+}
+
+sqrl_error_t sqrl_insert_ack(sqrl_client_t *client, const char *collection, const char *data, sqrl_ack_t ack, char id_out[SQRL_ID_SIZE]) {
+  if (!client || !collection || !data || !id_out) return SQRL_ERR_INVALID_ARG;
+  if (ack != SQRL_ACK_DURABLE && ack != SQRL_ACK_QUEUED && ack != SQRL_ACK_NONE) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  sqrl_generate_id(id_out);
+  if (ack == SQRL_ACK_NONE) return send_unacked(client, collection, id_out, data);
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = insert_ack_json(id, collection, id_out, ack_name(ack), data);
+  if (!json) return SQRL_ERR_MEMORY;
+  sqrl_error_t err = call(client, id, json, NULL);
+  free(json);
+  return err;
+}
+
+sqrl_error_t sqrl_update(sqrl_client_t *client, const char *collection, const char *document_id, const char *data, sqrl_document_t **doc_out) {
+  if (!client || !collection || !document_id || !data) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = update_json(id, collection, document_id, data);
+  sqrl_error_t err = call_document(client, id, json, doc_out);
+  free(json);
+  return err;
+}
+
+static char *update_if_json(const char *id, const char *collection, const char *document_id, const char *data, uint64_t version) {
+  char *coll = json_escape(collection);
+  char *doc_id = json_escape(document_id);
+  char *json = (coll && doc_id)
+    ? json_printf("{\"type\":\"update\",\"id\":\"%s\",\"collection\":\"%s\",\"document_id\":\"%s\",\"if_version\":%llu,\"data\":%s}",
+                  id, coll, doc_id, (unsigned long long)version, data)
+    : NULL;
+  free(coll);
+  free(doc_id);
+  return json;
+}
+
+/* A version conflict reply may carry the document as it is now, which
+ * saves the caller re-reading it before retrying */
+sqrl_error_t sqrl_update_if(sqrl_client_t *client, const char *collection, const char *document_id, const char *data, uint64_t version, sqrl_document_t **doc_out) {
+  if (!client || !collection || !document_id || !data) return SQRL_ERR_INVALID_ARG;
+  if (doc_out) *doc_out = NULL;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = update_if_json(id, collection, document_id, data, version);
+  if (!json) return SQRL_ERR_MEMORY;
+  char *response = NULL;
+  sqrl_error_t err = call_raw(client, id, json, &response);
+  free(json);
+  if (err != SQRL_OK) return err;
+
+  char *current = doc_out ? json_get_object(response, "document") : NULL;
+  char *payload = NULL;
+  err = take_result(response, doc_out ? &payload : NULL);
+  if (err == SQRL_OK && doc_out) {
+    *doc_out = parse_document(client, payload);
+    if (!*doc_out) err = SQRL_ERR_DECODE;
+  } else if (err == SQRL_ERR_CONFLICT && current) {
+    *doc_out = parse_document(client, current);
+  }
+  free(payload);
+  free(current);
+  return err;
+}
+
+static char *upsert_json(const char *id, const char *collection, const char *document_id, const char *data) {
+  char *coll = json_escape(collection);
+  char *doc_id = json_escape(document_id);
+  char *json = (coll && doc_id)
+    ? json_printf("{\"type\":\"upsert\",\"id\":\"%s\",\"collection\":\"%s\",\"document_id\":\"%s\",\"data\":%s}",
+                  id, coll, doc_id, data)
+    : NULL;
+  free(coll);
+  free(doc_id);
+  return json;
+}
+
+sqrl_error_t sqrl_upsert(sqrl_client_t *client, const char *collection, const char *document_id, const char *data, sqrl_document_t **doc_out) {
+  if (!client || !collection || !document_id || !data) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = upsert_json(id, collection, document_id, data);
+  sqrl_error_t err = call_document(client, id, json, doc_out);
+  free(json);
+  return err;
+}
+
+static char *patch_json(const char *id, const char *collection, const char *document_id, const char *ops) {
+  char *coll = json_escape(collection);
+  char *doc_id = json_escape(document_id);
+  char *json = (coll && doc_id)
+    ? json_printf("{\"type\":\"patch\",\"id\":\"%s\",\"collection\":\"%s\",\"document_id\":\"%s\",\"ops\":%s}",
+                  id, coll, doc_id, ops)
+    : NULL;
+  free(coll);
+  free(doc_id);
+  return json;
+}
+
+sqrl_error_t sqrl_update_patch(sqrl_client_t *client, const char *collection, const char *document_id, const sqrl_patch_t *patch, sqrl_document_t **doc_out) {
+  if (!client || !collection || !document_id || !patch) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char *ops = sqrl_patch_compile(patch);
+  if (!ops) return SQRL_ERR_ENCODE;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = patch_json(id, collection, document_id, ops);
+  free(ops);
+  sqrl_error_t err = call_document(client, id, json, doc_out);
+  free(json);
+  return err;
+}
+
+sqrl_error_t sqrl_delete(sqrl_client_t *client, const char *collection, const char *document_id, sqrl_document_t **doc_out) {
+  if (!client || !collection || !document_id) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = delete_json(id, collection, document_id);
+  sqrl_error_t err = call_document(client, id, json, doc_out);
+  free(json);
+  return err;
+}
+
+/* Bulk writes
+ *
+ * The filter travels in its structured form; the affected table is also
+ * sent as "collection" so the request is routed and invalidates the result
+ * cache like a single-document write.
+ */
+
+/* Fails with SQRL_ERR_INVALID_ARG for a builder without a table name */
+static sqrl_error_t many_json(const char *type, const char *id, sqrl_query_t *query, const char *ops, char **json_out) {
+  *json_out = NULL;
+  char *filter = sqrl_query_compile_structured(query);
+  if (!filter) return SQRL_ERR_ENCODE;
+
+  char *table = query_table(filter);
+  if (!table || !*table) {
+    free(table);
+    free(filter);
+    return SQRL_ERR_INVALID_ARG;
+  }
+
+  char *coll = json_escape(table);
+  if (coll && ops) {
+    *json_out = json_printf("{\"type\":\"%s\",\"id\":\"%s\",\"collection\":\"%s\",\"query\":%s,\"ops\":%s}",
+                            type, id, coll, filter, ops);
+  } else if (coll) {
+    *json_out = json_printf("{\"type\":\"%s\",\"id\":\"%s\",\"collection\":\"%s\",\"query\":%s}",
+                            type, id, coll, filter);
+  }
+  free(filter);
+  free(table);
+  free(coll);
+  return *json_out ? SQRL_OK : SQRL_ERR_MEMORY;
+}
+
+/* Reads a count reply's data: the count itself, an object holding
+ * "count", or a boolean for exists */
+static sqrl_error_t parse_count(const char *data, size_t *count_out) {
+  const char *p = json_skip_ws(data);
+  const char *count = *p == '{' ? json_find_value(p, "count") : p;
+  if (!count) return SQRL_ERR_DECODE;
+
+  if (isdigit((unsigned char)*count)) {
+    *count_out = (size_t)strtoull(count, NULL, 10);
+  } else if (strncmp(count, "true", 4) == 0 || strncmp(count, "false", 5) == 0) {
+    *count_out = *count == 't';
+  } else {
+    return SQRL_ERR_DECODE;
+  }
+  return SQRL_OK;
+}
+
+static sqrl_error_t call_count(sqrl_client_t *client, const char *id, const char *json, size_t *count_out) {
+  if (!json) return SQRL_ERR_MEMORY;
+
+  char *data = NULL;
+  sqrl_error_t err = call(client, id, json, &data);
+  if (err != SQRL_OK) return err;
+
+  size_t count = 0;
+  err = parse_count(data, &count);
+  if (err == SQRL_OK && count_out) *count_out = count;
+  free(data);
+  return err;
+}
+
+sqrl_error_t sqrl_delete_where(sqrl_client_t *client, sqrl_query_t *query, size_t *count_out) {
+  if (!client || !query) return SQRL_ERR_INVALID_ARG;
+  if (count_out) *count_out = 0;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = NULL;
+  sqrl_error_t err = many_json("delete_many", id, query, NULL, &json);
+  if (err == SQRL_OK) err = call_count(client, id, json, count_out);
+  free(json);
+  return err;
+}
+
+sqrl_error_t sqrl_update_where(sqrl_client_t *client, sqrl_query_t *query, const sqrl_patch_t *patch, size_t *count_out) {
+  if (!client || !query || !patch) return SQRL_ERR_INVALID_ARG;
+  if (count_out) *count_out = 0;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char *ops = sqrl_patch_compile(patch);
+  if (!ops) return SQRL_ERR_ENCODE;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char *json = NULL;
+  sqrl_error_t err = many_json("update_many", id, query, ops, &json);
+  free(ops);
+  if (err == SQRL_OK) err = call_count(client, id, json, count_out);
+  free(json);
+  return err;
+}
+
+/* Runs a count-mode query through sqrl_query(), so counts are coalesced
+ * and cached like any other read. Compiles in the given mode rather than
+ * changing the caller's builder. */
+static sqrl_error_t query_count(sqrl_client_t *client, const sqrl_query_t *query, sqrl_result_mode_t mode,
+                                size_t *count_out) {
+  if (sqrl_query_is_changes(query)) return SQRL_ERR_INVALID_ARG;
+  char *compiled = sqrl_query_compile_mode(query, mode);
+  if (!compiled) return SQRL_ERR_ENCODE;
+
+  char *data = NULL;
+  sqrl_error_t err = sqrl_query(client, compiled, &data);
+  free(compiled);
+  if (err != SQRL_OK) return err;
+
+  err = parse_count(data, count_out);
+  free(data);
+  return err;
+}
+
+sqrl_error_t sqrl_count(sqrl_client_t *client, sqrl_query_t *query, size_t *count_out) {
+  if (!client || !query || !count_out) return SQRL_ERR_INVALID_ARG;
+  *count_out = 0;
+
+  return query_count(client, query, SQRL_RESULT_COUNT, count_out);
+}
+
+sqrl_error_t sqrl_exists(sqrl_client_t *client, sqrl_query_t *query, bool *found_out) {
+  if (!client || !query || !found_out) return SQRL_ERR_INVALID_ARG;
+  *found_out = false;
+
+  size_t count = 0;
+  sqrl_error_t err = query_count(client, query, SQRL_RESULT_EXISTS, &count);
+  *found_out = err == SQRL_OK && count > 0;
+  return err;
+}
+
+sqrl_error_t sqrl_list_collections(sqrl_client_t *client, char ***names_out, size_t *count_out) {
+  if (!client || !names_out || !count_out) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  char json[128];
+  snprintf(json, sizeof(json), "{\"type\":\"listcollections\",\"id\":\"%s\"}", id);
+
+  char *data = NULL;
+  sqrl_error_t err = call(client, id, json, &data);
+  if (err != SQRL_OK) return err;
+
+  err = json_string_array(data, names_out, count_out);
+  free(data);
+  return err;
+}
+
+/* Async document operations */
+
+sqrl_error_t sqrl_query_async(sqrl_client_t *client, const char *query, sqrl_result_callback_t callback, void *user_data) {
+  if (!client || !query || !callback) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  pending_request_t *req = pending_new(id);
+  if (!req) return SQRL_ERR_MEMORY;
+  req->done = complete_result;
+  req->callback.result = callback;
+  req->user_data = user_data;
+
+  char *json = query_json(id, query);
+  sqrl_error_t err = call_async(client, req, json);
+  free(json);
+  return err;
+}
+
+static pending_request_t *pending_document(const char *id, sqrl_document_callback_t callback, void *user_data) {
+  pending_request_t *req = pending_new(id);
+  if (!req) return NULL;
+  req->done = complete_document;
+  req->callback.document = callback;
+  req->user_data = user_data;
+  return req;
+}
+
+sqrl_error_t sqrl_insert_async(sqrl_client_t *client, const char *collection, const char *data, sqrl_document_callback_t callback, void *user_data) {
+  if (!client || !collection || !data || !callback) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  pending_request_t *req = pending_document(id, callback, user_data);
+  if (!req) return SQRL_ERR_MEMORY;
+
+  char *json = insert_json(id, collection, data);
+  sqrl_error_t err = call_async(client, req, json);
+  free(json);
+  return err;
+}
+
+sqrl_error_t sqrl_update_async(sqrl_client_t *client, const char *collection, const char *document_id, const char *data, sqrl_document_callback_t callback, void *user_data) {
+  if (!client || !collection || !document_id || !data || !callback) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  pending_request_t *req = pending_document(id, callback, user_data);
+  if (!req) return SQRL_ERR_MEMORY;
+
+  char *json = update_json(id, collection, document_id, data);
+  sqrl_error_t err = call_async(client, req, json);
+  free(json);
+  return err;
+}
+
+sqrl_error_t sqrl_delete_async(sqrl_client_t *client, const char *collection, const char *document_id, sqrl_document_callback_t callback, void *user_data) {
+  if (!client || !collection || !document_id || !callback) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  pending_request_t *req = pending_document(id, callback, user_data);
+  if (!req) return SQRL_ERR_MEMORY;
+
+  char *json = delete_json(id, collection, document_id);
+  sqrl_error_t err = call_async(client, req, json);
+  free(json);
+  return err;
+}
+
+/* Subscriptions
+ *
+ * Subscribing to a query another handle already follows attaches to the
+ * existing server feed instead of opening a second one. A joiner is first
+ * replayed the feed's current result set as initial events, then shares the
+ * live stream. Only feeds that send initial documents keep that result set,
+ * and one larger than TRACKED_MAX_BYTES is dropped and the feed no longer
+ * shared. The server feed is unsubscribed when its last handle goes.
+ */
+
+/* Delivers a joiner's backlog on the subscribing thread, without
+ * deliver_mutex so its callbacks may block, until it has caught up with the
+ * live feed */
+static void replay_backlog(sqrl_client_t *client, sqrl_subscription_t *sub) {
+  subscription_entry_t *entry = sub->entry;
+  for (;;) {
+    pthread_mutex_lock(&entry->deliver_mutex);
+    change_item_t *item = sub->backlog;
+    if (item) {
+      sub->backlog = item->next;
+      if (!sub->backlog) sub->backlog_tail = NULL;
+    } else {
+      sub->replaying = false;
+    }
+    pthread_mutex_unlock(&entry->deliver_mutex);
+    if (!item) return;
+
+    sqrl_change_event_t event = {0};
+    decode_change(client, item->json, &event);
+    sub->callback(&event, sub->user_data);
+    change_event_clear(&event);
+    free(item->json);
+    free(item);
+  }
+}
+
+/* Drops one handle's reference; the last one unlinks the feed and returns
+ * true once no delivery is still using it. Caller frees it. From inside a
+ * callback it can't wait for the deliveries, so the last of them frees it. */
+static bool entry_release(sqrl_client_t *client, subscription_entry_t *entry) {
+  pthread_mutex_lock(&client->subs_mutex);
+  bool last = --entry->refs == 0;
+  if (last) {
+    if (entry->linked) {
+      subscription_entry_t **link = &client->subscriptions;
+      while (*link && *link != entry) link = &(*link)->next;
+      if (*link) *link = entry->next;
+      entry->linked = false;
+    }
+    if (client->credits > 0) drop_queued_changes(client, entry);
+    if (t_delivering > 0 && entry->dispatching > 0) {
+      entry->orphaned = true;
+      last = false;
+    } else {
+      while (entry->dispatching > 0) pthread_cond_wait(&client->subs_cond, &client->subs_mutex);
+    }
+  }
+  pthread_mutex_unlock(&client->subs_mutex);
+  return last;
+}
+
+static void detach_listener(subscription_entry_t *entry, sqrl_subscription_t *sub) {
+  pthread_mutex_lock(&entry->deliver_mutex);
+  sqrl_subscription_t **link = &entry->listeners;
+  while (*link && *link != sub) link = &(*link)->next;
+  if (*link) *link = sub->next;
+  pthread_mutex_unlock(&entry->deliver_mutex);
+}
+
+/* Attaches to a live feed for the same query, waiting out a subscribe that
+ * is still in flight. Returns NULL (with *err set if it failed) when there
+ * is no feed to share. */
+static subscription_entry_t *join_feed(sqrl_client_t *client, const char *key, sqrl_subscription_t *sub, sqrl_error_t *err) {
+  pthread_mutex_lock(&client->subs_mutex);
+  subscription_entry_t *entry = client->subscriptions;
+  while (entry && !(entry->shareable && strcmp(entry->key, key) == 0)) entry = entry->next;
+  if (!entry) {
+    pthread_mutex_unlock(&client->subs_mutex);
+    return NULL;
+  }
+  entry->refs++;
+  while (entry->status == FEED_PENDING) pthread_cond_wait(&client->subs_cond, &client->subs_mutex);
+  feed_status_t status = entry->status;
+  *err = entry->error;
+  pthread_mutex_unlock(&client->subs_mutex);
+
+  if (status == FEED_ACTIVE) {
+    /* Snapshot and attach in one step, so no event is missed or repeated */
+    sub->entry = entry;
+    pthread_mutex_lock(&entry->deliver_mutex);
+    for (size_t i = 0; i < entry->doc_count; i++) {
+      backlog_push(sub, json_printf("{\"type\":\"initial\",\"document\":%s}", entry->docs[i]));
+    }
+    sub->replaying = true;
+    sub->next = entry->listeners;
+    entry->listeners = sub;
+    pthread_mutex_unlock(&entry->deliver_mutex);
+    replay_backlog(client, sub);
+    *err = SQRL_OK;
+    return entry;
+  }
+
+  if (entry_release(client, entry)) entry_free(entry);
+  return NULL;
+}
+
+sqrl_error_t sqrl_subscribe(sqrl_client_t *client, const char *query, sqrl_change_callback_t callback, void *user_data, sqrl_subscription_t **sub_out) {
+  if (!client || !query || !callback || !sub_out) return SQRL_ERR_INVALID_ARG;
+  if (!client_usable(client)) return SQRL_ERR_CLOSED;
+
+  sqrl_subscription_t *sub = calloc(1, sizeof(sqrl_subscription_t));
+  char *key = canonical_query(query);
+  if (!sub || !key) {
+    free(sub);
+    free(key);
+    return SQRL_ERR_MEMORY;
+  }
+  sub->client = client;
+  sub->callback = callback;
+  sub->user_data = user_data;
+
+  sqrl_error_t err = SQRL_OK;
+  sub->entry = join_feed(client, key, sub, &err);
+  if (sub->entry || err != SQRL_OK) {
+    free(key);
+    if (err != SQRL_OK) {
+      free(sub);
+      return err;
+    }
+    *sub_out = sub;
+    return SQRL_OK;
+  }
+
+  char id[32];
+  next_request_id(client, id, sizeof(id));
+
+  subscription_entry_t *entry = calloc(1, sizeof(subscription_entry_t));
+  char *escaped = json_escape(query);
+  if (!entry || !escaped || !(entry->id = strdup_safe(id))) {
+    free(entry);
+    free(escaped);
+    free(key);
+    free(sub);
+    return SQRL_ERR_MEMORY;
+  }
+  entry->key = key;
+  entry->refs = 1;
+  entry->status = FEED_PENDING;
+  entry->shareable = true;
+  entry->tracking = wants_initial(key);
+  entry->linked = true;
+  entry->listeners = sub;
+  pthread_mutex_init(&entry->deliver_mutex, NULL);
+  sub->entry = entry;
+
+  /* Register before subscribing so initial events are not dropped */
+  pthread_mutex_lock(&client->subs_mutex);
+  entry->next = client->subscriptions;
+  client->subscriptions = entry;
+  pthread_mutex_unlock(&client->subs_mutex);
+
+  char *json = client->credits > 0
+    ? json_printf("{\"type\":\"subscribe\",\"id\":\"%s\",\"query\":\"%s\",\"credits\":%d}", id, escaped, client->credits)
+    : json_printf("{\"type\":\"subscribe\",\"id\":\"%s\",\"query\":\"%s\"}", id, escaped);
+  free(escaped);
+  err = json ? call(client, id, json, NULL) : SQRL_ERR_MEMORY;
+  free(json);
+
+  pthread_mutex_lock(&client->subs_mutex);
+  entry->status = err == SQRL_OK ? FEED_ACTIVE : FEED_FAILED;
+  entry->error = err;
+  if (err != SQRL_OK) entry->shareable = false;
+  pthread_cond_broadcast(&client->subs_cond);
+  pthread_mutex_unlock(&client->subs_mutex);
+
+  if (err != SQRL_OK) {
+    detach_listener(entry, sub);
+    if (entry_release(client, entry)) entry_free(entry);
+    free(sub);
+    return err;
+  }
+
+  *sub_out = sub;
+  return SQRL_OK;
+}
+
+sqrl_error_t sqrl_subscribe_query(sqrl_client_t *client, sqrl_query_t *query, sqrl_change_callback_t callback, void *user_data, sqrl_subscription_t **sub_out) {
+  if (!client || !query || !callback || !sub_out) return SQRL_ERR_INVALID_ARG;
+
+  /* The compiled form is deterministic, so equal builders share a feed */
+  char *compiled = sqrl_query_compile_changes(query);
+  if (!compiled) return SQRL_ERR_ENCODE;
+
+  sqrl_error_t err = sqrl_subscribe(client, compiled, callback, user_data, sub_out);
+  free(compiled);
+  return err;
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* Builds {"tables":[...],"changes":{...}} with the names sorted, so equal
+ * sets of collections share a feed whatever order they were given in */
+static char *collections_query(const char *const *collections, size_t count) {
+  const char **names = malloc((count ? count : 1) * sizeof(char *));
+  if (!names) return NULL;
+  if (count == 0) {
+    names[0] = "*";
+    count = 1;
+  } else {
+    memcpy(names, collections, count * sizeof(char *));
+    qsort(names, count, sizeof(char *), compare_names);
+  }
+
+  size_t cap = 64;
+  for (size_t i = 0; i < count; i++) cap += 6 * strlen(names[i]) + 3;  /* Worst case \u00XX escapes */
+  char *query = malloc(cap);
+  if (!query) {
+    free(names);
+    return NULL;
+  }
+
+  size_t len = (size_t)snprintf(query, cap, "{\"tables\":[");
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0 && strcmp(names[i], names[i - 1]) == 0) continue;
+    char *escaped = json_escape(names[i]);
+    if (!escaped) {
+      free(query);
+      free(names);
+      return NULL;
+    }
+    len += (size_t)snprintf(query + len, cap - len, "%s\"%s\"", query[len - 1] == '[' ? "" : ",", escaped);
+    free(escaped);
+  }
+  snprintf(query + len, cap - len, "],\"changes\":{\"includeInitial\":false}}");
+  free(names);
+  return query;
+}
+
+sqrl_error_t sqrl_subscribe_collections(sqrl_client_t *client, const char *const *collections, size_t count, sqrl_change_callback_t callback, void *user_data, sqrl_subscription_t **sub_out) {
+  if (!client || (!collections && count > 0) || !callback || !sub_out) return SQRL_ERR_INVALID_ARG;
+  for (size_t i = 0; i < count; i++) {
+    if (!collections[i]) return SQRL_ERR_INVALID_ARG;
+  }
+
+  char *query = collections_query(collections, count);
+  if (!query) return SQRL_ERR_MEMORY;
+
+  sqrl_error_t err = sqrl_subscribe(client, query, callback, user_data, sub_out);
+  free(query);
+  return err;
+}
+
+/* Unsubscribes a released feed at the server and frees it. Without wait
+ * the reply is not waited for: on the reader thread nobody else could read
+ * it. */
+static sqrl_error_t close_feed(sqrl_client_t *client, subscription_entry_t *entry, bool wait) {
+  sqrl_error_t err = SQRL_OK;
+  if (client_usable(client)) {
+    char json[128];
+    snprintf(json, sizeof(json), "{\"type\":\"unsubscribe\",\"id\":\"%s\"}", entry->id);
+    err = wait ? call(client, entry->id, json, NULL) : send_frame(client, json);
+  }
+  entry_free(entry);
+  return err;
+}
+
+sqrl_error_t sqrl_unsubscribe(sqrl_subscription_t *sub) {
+  if (!sub) return SQRL_ERR_INVALID_ARG;
+
+  sqrl_client_t *client = sub->client;
+  subscription_entry_t *entry = sub->entry;
+
+  /* A callback may hold this or another feed's deliver_mutex: leave the
+   * handle for a sweep and close the feed without blocking */
+  if (t_delivering > 0) {
+    atomic_store(&sub->removed, true);
+    if (entry_release(client, entry)) close_feed(client, entry, false);
+    return SQRL_OK;
+  }
+
+  detach_listener(entry, sub);
+  free(sub);
+
+  if (!entry_release(client, entry)) return SQRL_OK;
+  return close_feed(client, entry, true);
+}
+
+sqrl_error_t sqrl_subscription_get_stats(const sqrl_subscription_t *sub, sqrl_subscription_stats_t *stats_out) {
+  if (!sub || !stats_out) return SQRL_ERR_INVALID_ARG;
+
+  const subscription_entry_t *entry = sub->entry;
+  memset(stats_out, 0, sizeof(*stats_out));
+  stats_out->events = atomic_load_explicit(&entry->lag_callback.count, memory_order_relaxed);
+  copy_histogram(&entry->lag_total, &stats_out->total);
+  copy_histogram(&entry->lag_network, &stats_out->network);
+  copy_histogram(&entry->lag_queue, &stats_out->queue);
+  copy_histogram(&entry->lag_callback, &stats_out->callback);
+  return SQRL_OK;
+}
+
+const char *sqrl_subscription_id(const sqrl_subscription_t *sub) {
+  return sub ? sub->entry->id : NULL;
+}
+
+sqrl_error_t sqrl_get_stats(const sqrl_client_t *client, sqrl_stats_t *stats_out) {
+  if (!client || !stats_out) return SQRL_ERR_INVALID_ARG;
+
+  /* Relaxed loads: counters may be mutually off by an in-progress flush */
+  uint64_t batches = atomic_load_explicit(&client->stat_batches, memory_order_relaxed);
+  uint64_t batched = atomic_load_explicit(&client->stat_batched_frames, memory_order_relaxed);
+  uint64_t delay_ns = atomic_load_explicit(&client->stat_batch_delay_ns, memory_order_relaxed);
+
+  memset(stats_out, 0, sizeof(*stats_out));
+  stats_out->frames_sent = atomic_load_explicit(&client->stat_frames_sent, memory_order_relaxed);
+  stats_out->bytes_sent = atomic_load_explicit(&client->stat_bytes_sent, memory_order_relaxed);
+  stats_out->frames_received = atomic_load_explicit(&client->stat_frames_received, memory_order_relaxed);
+  stats_out->bytes_received = atomic_load_explicit(&client->stat_bytes_received, memory_order_relaxed);
+  stats_out->requests_completed = atomic_load_explicit(&client->request_latency.count, memory_order_relaxed);
+  stats_out->requests_timed_out = atomic_load_explicit(&client->stat_timeouts, memory_order_relaxed);
+  for (int i = 0; i < SQRL_LATENCY_BUCKETS; i++) {
+    stats_out->latency_buckets[i] = atomic_load_explicit(&client->request_latency.buckets[i], memory_order_relaxed);
+    stats_out->latency_count += stats_out->latency_buckets[i];
+  }
+  stats_out->latency_sum_us = atomic_load_explicit(&client->request_latency.sum_us, memory_order_relaxed);
+  stats_out->batches_flushed = batches;
+  stats_out->avg_batch_frames = batches ? (double)batched / (double)batches : 0.0;
+  stats_out->avg_batch_delay_us = batched ? delay_ns / batched / 1000 : 0;
+  stats_out->batch_window_us = atomic_load_explicit(&client->stat_batch_window_us, memory_order_relaxed);
+  stats_out->hedges_sent = atomic_load_explicit(&client->stat_hedges_sent, memory_order_relaxed);
+  stats_out->hedges_won = atomic_load_explicit(&client->stat_hedges_won, memory_order_relaxed);
+  stats_out->connections = atomic_load_explicit(&client->stat_connections, memory_order_relaxed);
+  stats_out->bulk_requests = atomic_load_explicit(&client->stat_bulk_requests, memory_order_relaxed);
+  stats_out->coalesced_queries = atomic_load_explicit(&client->stat_coalesced, memory_order_relaxed);
+  stats_out->cache_hits = atomic_load_explicit(&client->stat_cache_hits, memory_order_relaxed);
+  stats_out->cache_misses = atomic_load_explicit(&client->stat_cache_misses, memory_order_relaxed);
+  stats_out->cache_invalidations = atomic_load_explicit(&client->stat_cache_invalidations, memory_order_relaxed);
+  stats_out->concurrency_limit = atomic_load_explicit(&client->stat_limit, memory_order_relaxed);
+  stats_out->in_flight = atomic_load_explicit(&client->stat_in_flight, memory_order_relaxed);
+  stats_out->requests_rejected = atomic_load_explicit(&client->stat_rejected, memory_order_relaxed);
+  stats_out->breaker_opens = atomic_load_explicit(&client->stat_breaker_opens, memory_order_relaxed);
+  stats_out->breaker_open = atomic_load_explicit(&client->stat_breaker_open, memory_order_relaxed);
+  return SQRL_OK;
+}
+
+/* Debug introspection
+ *
+ * Both tables are copied under their own mutex, which is only ever held for
+ * list updates, so a snapshot never waits on the network or on a callback.
+ */
+
+static uint64_t age_us(uint64_t now, uint64_t then) {
+  return then && now > then ? (now - then) / 1000 : 0;
+}
+
+sqrl_error_t sqrl_debug_snapshot(sqrl_client_t *client, sqrl_debug_snapshot_t *snapshot_out) {
+  if (!client || !snapshot_out) return SQRL_ERR_INVALID_ARG;
+  memset(snapshot_out, 0, sizeof(*snapshot_out));
+
+  pthread_mutex_lock(&client->pending_mutex);
+  uint64_t now = now_ns();
+  size_t count = 0;
+  for (pending_request_t *req = client->pending_requests; req; req = req->next) count++;
+  sqrl_pending_info_t *pending = count ? calloc(count, sizeof(sqrl_pending_info_t)) : NULL;
+  if (count && !pending) {
+    pthread_mutex_unlock(&client->pending_mutex);
+    return SQRL_ERR_MEMORY;
+  }
+  size_t i = 0;
+  for (pending_request_t *req = client->pending_requests; req; req = req->next, i++) {
+    snprintf(pending[i].id, sizeof(pending[i].id), "%s", req->id);
+    snprintf(pending[i].op, sizeof(pending[i].op), "%s", req->op);
+    pending[i].age_us = age_us(now, req->sent_ns);
+    pending[i].bytes = req->bytes;
+    pending[i].async = req->done != NULL;
+  }
+  pthread_mutex_unlock(&client->pending_mutex);
+  snapshot_out->pending = pending;
+  snapshot_out->pending_count = count;
+
+  pthread_mutex_lock(&client->subs_mutex);
+  now = now_ns();
+  count = 0;
+  for (subscription_entry_t *e = client->subscriptions; e; e = e->next) count++;
+  sqrl_subscription_info_t *subs = count ? calloc(count, sizeof(sqrl_subscription_info_t)) : NULL;
+  if (count && !subs) {
+    pthread_mutex_unlock(&client->subs_mutex);
+    sqrl_debug_snapshot_free(snapshot_out);
+    return SQRL_ERR_MEMORY;
+  }
+  i = 0;
+  for (subscription_entry_t *e = client->subscriptions; e; e = e->next, i++) {
+    snprintf(subs[i].id, sizeof(subs[i].id), "%s", e->id);
+    subs[i].listeners = e->refs;
+    subs[i].events_delivered = e->events_delivered;
+    subs[i].queue_depth = (size_t)e->dispatching;
+    subs[i].last_event_age_us = age_us(now, e->last_event_ns);
+    subs[i].callback_age_us = e->dispatching ? age_us(now, e->callback_start_ns) : 0;
+  }
+  pthread_mutex_unlock(&client->subs_mutex);
+  snapshot_out->subscriptions = subs;
+  snapshot_out->subscription_count = count;
+
+  return SQRL_OK;
+}
+
+void sqrl_debug_snapshot_free(sqrl_debug_snapshot_t *snapshot) {
+  if (!snapshot) return;
+  free(snapshot->pending);
+  free(snapshot->subscriptions);
+  memset(snapshot, 0, sizeof(*snapshot));
+}
+
+sqrl_error_t sqrl_debug_dump(sqrl_client_t *client, FILE *out) {
+  if (!client || !out) return SQRL_ERR_INVALID_ARG;
+
+  sqrl_debug_snapshot_t snap;
+  sqrl_error_t err = sqrl_debug_snapshot(client, &snap);
+  if (err != SQRL_OK) return err;
+
+  fprintf(out, "pending requests: %zu\n", snap.pending_count);
+  for (size_t i = 0; i < snap.pending_count; i++) {
+    const sqrl_pending_info_t *p = &snap.pending[i];
+    fprintf(out, "  id=%s op=%s age_us=%llu bytes=%zu%s\n", p->id, p->op[0] ? p->op : "?",
+            (unsigned long long)p->age_us, p->bytes, p->async ? " async" : "");
+  }
+  fprintf(out, "subscriptions: %zu\n", snap.subscription_count);
+  for (size_t i = 0; i < snap.subscription_count; i++) {
+    const sqrl_subscription_info_t *s = &snap.subscriptions[i];
+    fprintf(out, "  id=%s listeners=%d events=%llu queue_depth=%zu last_event_age_us=%llu callback_age_us=%llu\n",
+            s->id, s->listeners, (unsigned long long)s->events_delivered, s->queue_depth,
+            (unsigned long long)s->last_event_age_us, (unsigned long long)s->callback_age_us);
+  }
+
+  sqrl_debug_snapshot_free(&snap);
+  return SQRL_OK;
 }
 
 void sqrl_document_free(sqrl_document_t *doc) {
   if (!doc) return;
   free(doc->id);
-  free(doc->collection);
+  if (!doc->shared_collection) free(doc->collection);
   free(doc->data);
   free(doc->created_at);
   free(doc->updated_at);
@@ -597,6 +4347,7 @@ void sqrl_change_event_free(sqrl_change_event_t *event) {
   sqrl_document_free(event->document);
   sqrl_document_free(event->new_doc);
   free(event->old_data);
+  free(event->collection);
   free(event);
 }
 
@@ -0,0 +1,308 @@
+/**
+ * In-process loopback server for the tests and benchmarks
+ */
+
+#include "loopback.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+struct loopback_conn {
+  loopback_t *server;
+  int fd;
+  pthread_mutex_t write_mutex;
+  struct loopback_conn *next;
+};
+
+struct loopback {
+  int listen_fd;
+  uint16_t port;
+  loopback_handler_t handler;
+  void *user_data;
+  pthread_t accept_thread;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool stopping;
+  int handshake_delay_ms;
+  int accepted;
+  loopback_conn_t *conns;    /* Open connections */
+};
+
+static int read_full(int fd, void *buf, size_t len) {
+  size_t off = 0;
+  while (off < len) {
+    ssize_t n = recv(fd, (char *)buf + off, len - off, 0);
+    if (n <= 0) return -1;
+    off += (size_t)n;
+  }
+  return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+  size_t off = 0;
+  while (off < len) {
+    ssize_t n = send(fd, (const char *)buf + off, len - off, MSG_NOSIGNAL);
+    if (n <= 0) return -1;
+    off += (size_t)n;
+  }
+  return 0;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+void loopback_request_id(const char *json, char *buf, size_t size) {
+  const char *p = strstr(json, "\"id\":\"");
+  buf[0] = '\0';
+  if (!p) return;
+  p += 6;
+  size_t n = 0;
+  while (p[n] && p[n] != '"' && n + 1 < size) n++;
+  memcpy(buf, p, n);
+  buf[n] = '\0';
+}
+
+int loopback_send(loopback_conn_t *conn, const char *json) {
+  size_t len = strlen(json);
+  uint8_t header[6];
+  uint32_t frame_len = (uint32_t)len + 2;
+  header[0] = (uint8_t)(frame_len >> 24);
+  header[1] = (uint8_t)(frame_len >> 16);
+  header[2] = (uint8_t)(frame_len >> 8);
+  header[3] = (uint8_t)frame_len;
+  header[4] = 0x02;  /* Response */
+  header[5] = 0x02;  /* JSON */
+
+  pthread_mutex_lock(&conn->write_mutex);
+  int rc = write_full(conn->fd, header, sizeof(header));
+  if (rc == 0) rc = write_full(conn->fd, json, len);
+  pthread_mutex_unlock(&conn->write_mutex);
+  return rc;
+}
+
+void loopback_drop(loopback_conn_t *conn) {
+  shutdown(conn->fd, SHUT_RDWR);
+}
+
+void loopback_reply_canned(loopback_conn_t *conn, const char *request) {
+  char id[32];
+  char out[512];
+  loopback_request_id(request, id, sizeof(id));
+
+  if (strstr(request, "\"type\":\"ping\"")) {
+    snprintf(out, sizeof(out), "{\"type\":\"pong\",\"id\":\"%s\"}", id);
+  } else if (strstr(request, "\"type\":\"query\"")) {
+    snprintf(out, sizeof(out), "{\"type\":\"result\",\"id\":\"%s\",\"data\":[{\"id\":\"a\",\"n\":1}]}", id);
+  } else {
+    snprintf(out, sizeof(out),
+             "{\"type\":\"result\",\"id\":\"%s\",\"data\":{\"id\":\"a\",\"collection\":\"bench\","
+             "\"data\":{\"n\":1},\"created_at\":\"2024-01-01T00:00:00Z\",\"updated_at\":\"2024-01-01T00:00:00Z\"}}", id);
+  }
+  loopback_send(conn, out);
+}
+
+static void *serve_connection(void *arg) {
+  loopback_conn_t *conn = arg;
+  loopback_t *server = conn->server;
+  int fd = conn->fd;
+  uint8_t handshake[8];
+  char token[65536];
+
+  if (read_full(fd, handshake, sizeof(handshake)) < 0) goto done;
+  size_t token_len = ((size_t)handshake[6] << 8) | handshake[7];
+  if (token_len && read_full(fd, token, token_len) < 0) goto done;
+
+  pthread_mutex_lock(&server->mutex);
+  int delay_ms = server->handshake_delay_ms;
+  pthread_mutex_unlock(&server->mutex);
+  if (delay_ms > 0) sleep_ms(delay_ms);
+
+  uint8_t accept_resp[19] = {0x00, 0x01, 0x02};
+  for (int i = 3; i < 19; i++) accept_resp[i] = (uint8_t)i;
+  if (write_full(fd, accept_resp, sizeof(accept_resp)) < 0) goto done;
+
+  char *payload = NULL;
+  size_t payload_cap = 0;
+  for (;;) {
+    uint8_t header[6];
+    if (read_full(fd, header, sizeof(header)) < 0) break;
+    size_t len = (((size_t)header[0] << 24) | ((size_t)header[1] << 16) |
+                  ((size_t)header[2] << 8) | header[3]) - 2;
+    if (len + 1 > payload_cap) {
+      payload_cap = len + 1;
+      char *grown = realloc(payload, payload_cap);
+      if (!grown) break;
+      payload = grown;
+    }
+    if (read_full(fd, payload, len) < 0) break;
+    payload[len] = '\0';
+
+    if (server->handler) server->handler(conn, payload, server->user_data);
+    else loopback_reply_canned(conn, payload);
+  }
+  free(payload);
+
+done:
+  pthread_mutex_lock(&server->mutex);
+  loopback_conn_t **link = &server->conns;
+  while (*link && *link != conn) link = &(*link)->next;
+  if (*link) *link = conn->next;
+  pthread_cond_broadcast(&server->cond);
+  pthread_mutex_unlock(&server->mutex);
+
+  close(fd);
+  /* Wait out a loopback_send() that raced the close */
+  pthread_mutex_lock(&conn->write_mutex);
+  pthread_mutex_unlock(&conn->write_mutex);
+  pthread_mutex_destroy(&conn->write_mutex);
+  free(conn);
+  return NULL;
+}
+
+static void *accept_loop(void *arg) {
+  loopback_t *server = arg;
+  for (;;) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) break;
+
+    pthread_mutex_lock(&server->mutex);
+    bool stopping = server->stopping;
+    pthread_mutex_unlock(&server->mutex);
+    if (stopping) {
+      close(fd);
+      break;
+    }
+
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    loopback_conn_t *conn = calloc(1, sizeof(loopback_conn_t));
+    if (!conn) {
+      close(fd);
+      continue;
+    }
+    conn->server = server;
+    conn->fd = fd;
+    pthread_mutex_init(&conn->write_mutex, NULL);
+
+    pthread_mutex_lock(&server->mutex);
+    conn->next = server->conns;
+    server->conns = conn;
+    server->accepted++;
+    pthread_mutex_unlock(&server->mutex);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_connection, conn) != 0) {
+      pthread_mutex_lock(&server->mutex);
+      server->conns = conn->next;
+      pthread_mutex_unlock(&server->mutex);
+      pthread_mutex_destroy(&conn->write_mutex);
+      free(conn);
+      close(fd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return NULL;
+}
+
+loopback_t *loopback_start(loopback_handler_t handler, void *user_data) {
+  loopback_t *server = calloc(1, sizeof(loopback_t));
+  if (!server) return NULL;
+  server->handler = handler;
+  server->user_data = user_data;
+  pthread_mutex_init(&server->mutex, NULL);
+  pthread_cond_init(&server->cond, NULL);
+
+  server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (server->listen_fd < 0) goto fail;
+
+  int flag = 1;
+  setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server->listen_fd, 64) < 0 ||
+      getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+    close(server->listen_fd);
+    goto fail;
+  }
+  server->port = ntohs(addr.sin_port);
+
+  if (pthread_create(&server->accept_thread, NULL, accept_loop, server) != 0) {
+    close(server->listen_fd);
+    goto fail;
+  }
+  return server;
+
+fail:
+  pthread_cond_destroy(&server->cond);
+  pthread_mutex_destroy(&server->mutex);
+  free(server);
+  return NULL;
+}
+
+uint16_t loopback_port(const loopback_t *server) {
+  return server->port;
+}
+
+void loopback_delay_handshake(loopback_t *server, int delay_ms) {
+  pthread_mutex_lock(&server->mutex);
+  server->handshake_delay_ms = delay_ms;
+  pthread_mutex_unlock(&server->mutex);
+}
+
+int loopback_connections(loopback_t *server) {
+  pthread_mutex_lock(&server->mutex);
+  int accepted = server->accepted;
+  pthread_mutex_unlock(&server->mutex);
+  return accepted;
+}
+
+void loopback_stop(loopback_t *server) {
+  if (!server) return;
+
+  /* accept() doesn't wake for close() everywhere, so connect to it instead */
+  pthread_mutex_lock(&server->mutex);
+  server->stopping = true;
+  pthread_mutex_unlock(&server->mutex);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd >= 0) {
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(server->port);
+    connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  pthread_join(server->accept_thread, NULL);
+  if (fd >= 0) close(fd);
+  close(server->listen_fd);
+
+  pthread_mutex_lock(&server->mutex);
+  for (loopback_conn_t *conn = server->conns; conn; conn = conn->next) shutdown(conn->fd, SHUT_RDWR);
+  while (server->conns) pthread_cond_wait(&server->cond, &server->mutex);
+  pthread_mutex_unlock(&server->mutex);
+
+  pthread_cond_destroy(&server->cond);
+  pthread_mutex_destroy(&server->mutex);
+  free(server);
+}
@@ -0,0 +1,68 @@
+/**
+ * In-process loopback server for the tests and benchmarks
+ *
+ * Speaks the wire protocol on 127.0.0.1, one thread per connection. With no
+ * handler every request is answered at once with a canned reply, so the
+ * benchmarks measure SDK overhead rather than a database. Tests pass their
+ * own handler to script replies, and push change notifications to a
+ * connection from any thread with loopback_send().
+ */
+
+#ifndef SQUIRRELDB_TESTS_LOOPBACK_H
+#define SQUIRRELDB_TESTS_LOOPBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct loopback loopback_t;
+typedef struct loopback_conn loopback_conn_t;
+
+/* Runs on the connection's thread for every request frame, in order */
+typedef void (*loopback_handler_t)(loopback_conn_t *conn, const char *request, void *user_data);
+
+/**
+ * Start listening on an ephemeral loopback port
+ * @param handler Request handler, NULL for loopback_reply_canned()
+ * @return Server, NULL if it could not listen
+ */
+loopback_t *loopback_start(loopback_handler_t handler, void *user_data);
+
+uint16_t loopback_port(const loopback_t *server);
+
+/* Hold every later handshake back this long, e.g. to observe a lazy connect */
+void loopback_delay_handshake(loopback_t *server, int delay_ms);
+
+/* Number of connections accepted so far */
+int loopback_connections(loopback_t *server);
+
+/**
+ * Close the listener and every open connection, then free the server once
+ * their threads are gone. No conn may be used afterwards.
+ */
+void loopback_stop(loopback_t *server);
+
+/**
+ * Write one JSON frame to a connection; safe from any thread while the
+ * connection is open
+ * @return 0, or -1 once the client has gone
+ */
+int loopback_send(loopback_conn_t *conn, const char *json);
+
+/* Close a connection as if the server had dropped it */
+void loopback_drop(loopback_conn_t *conn);
+
+/* Canned reply: pong, a one-row query result, or a document */
+void loopback_reply_canned(loopback_conn_t *conn, const char *request);
+
+/* Copy a request's "id" into buf; the SDK always sends it as a string */
+void loopback_request_id(const char *json, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SQUIRRELDB_TESTS_LOOPBACK_H */
@@ -0,0 +1,139 @@
+/**
+ * Tests for the header-only C++ wrapper
+ *
+ * Builds against the same loopback server as tests/test_protocol.c, so the
+ * awaitables complete on a real reader thread.
+ */
+
+#include "squirreldb.hpp"
+#include "loopback.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+#define RUN_TEST(test_func) do { \
+  tests_run++; \
+  printf("  Running %s... ", #test_func); \
+  fflush(stdout); \
+  if (test_func()) { \
+    tests_passed++; \
+    printf("PASS\n"); \
+  } else { \
+    printf("FAIL\n"); \
+  } \
+} while(0)
+
+static uint16_t g_port;
+
+/* Set by a coroutine once it has run to the end */
+struct done_flag {
+  std::mutex mutex;
+  std::condition_variable cond;
+  bool done = false;
+
+  void set() {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    cond.notify_all();
+  }
+
+  bool wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cond.wait_for(lock, std::chrono::seconds(2), [this] { return done; });
+  }
+};
+
+/* Test RAII builders compile their queries and patches */
+static int test_builders() {
+  sqrl::query q("users");
+  q.find_gt("age", 21.0).find_eq("status", "active").sort("name", SQRL_DESC).limit(10).select("name");
+  sqrl::result compiled = q.compile_structured();
+
+  sqrl::patch p;
+  p.set("name", "Carol").inc("visits").push("tags", "new").unset("legacy");
+
+  sqrl::query moved = std::move(q);
+  return compiled && compiled.json().find("\"age\"") != std::string_view::npos && moved.get() && !q.get() && p.get();
+}
+
+/* Test blocking calls and a subscription handle against the loopback */
+static int test_blocking_calls() {
+  sqrl::client db = sqrl::client::connect("127.0.0.1", g_port);
+  sqrl::result rows = db.query("db.table(\"users\").run()");
+  sqrl::document doc = db.insert("users", "{\"name\":\"Alice\"}");
+  sqrl::subscription sub = db.subscribe("db.table(\"users\").changes()", [](const sqrl_change_event_t &) {});
+  bool ok = db.connected() && rows.json().find("\"id\":\"a\"") != std::string_view::npos &&
+            doc.id() == "a" && doc.collection() == "bench" && doc.created_ns() > 0 && sub;
+  sub.reset();
+  return ok && !sub;
+}
+
+/* Test every awaitable resumes with its reply, and a rejected submit
+ * throws at the co_await instead of suspending */
+struct await_results {
+  std::string rows;
+  std::string inserted, updated, removed;
+  sqrl_error_t rejected = SQRL_OK;
+  done_flag finished;
+};
+
+static sqrl::task run_awaitables(sqrl::client &db, await_results &out) {
+  sqrl::result rows = co_await db.query_async("db.table(\"users\").run()");
+  out.rows = rows.json();
+  sqrl::document doc = co_await db.insert_async("users", "{\"name\":\"Alice\"}");
+  out.inserted = doc.id();
+  doc = co_await db.update_async("users", "a", "{\"name\":\"Bob\"}");
+  out.updated = doc.id();
+  doc = co_await db.remove_async("users", "a");
+  out.removed = doc.id();
+  try {
+    co_await db.query_async(nullptr);
+  } catch (const sqrl::error &e) {
+    out.rejected = e.code();
+  }
+  out.finished.set();
+}
+
+static int test_co_await() {
+  sqrl::client db = sqrl::client::connect("127.0.0.1", g_port);
+  bool ok = true;
+  /* Repeat so completions race the submitting thread both ways */
+  for (int i = 0; ok && i < 50; i++) {
+    await_results out;
+    run_awaitables(db, out);
+    ok = out.finished.wait() && out.rows.find("\"id\":\"a\"") != std::string::npos && out.inserted == "a" &&
+         out.updated == "a" && out.removed == "a" && out.rejected == SQRL_ERR_INVALID_ARG;
+  }
+  return ok;
+}
+
+int main() {
+  printf("SquirrelDB C++ Wrapper Tests\n");
+  printf("============================\n\n");
+
+  loopback_t *server = loopback_start(nullptr, nullptr);
+  if (!server) {
+    fprintf(stderr, "failed to start loopback server\n");
+    return 1;
+  }
+  g_port = loopback_port(server);
+  sqrl_init();
+
+  RUN_TEST(test_builders);
+  RUN_TEST(test_blocking_calls);
+  RUN_TEST(test_co_await);
+
+  sqrl_cleanup();
+  loopback_stop(server);
+
+  printf("\n============================\n");
+  printf("Results: %d/%d tests passed\n", tests_passed, tests_run);
+
+  return (tests_passed == tests_run) ? 0 : 1;
+}
@@ -2,15 +2,24 @@
  * Tests for SquirrelDB C SDK
  *
  * A simple test framework using assertions.
- * Compile: cc -I../include test_protocol.c -o test_protocol
- * Run: ./test_protocol
+ * Build and run: make test
  */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 #include "squirreldb.h"
+#include "squirreldb/metrics.h"
+#include "squirreldb/query.h"
+#include "squirreldb/patch.h"
+#include "squirreldb/resolver.h"
+#include "squirreldb/shard.h"
+#include "loopback.h"
 
 static int tests_run = 0;
 static int tests_passed = 0;
@@ -30,9 +39,9 @@ static int tests_passed = 0;
 /* Test protocol constants */
 static int test_version_constants(void) {
   if (SQRL_VERSION_MAJOR != 0) return 0;
-  if (SQRL_VERSION_MINOR != 1) return 0;
+  if (SQRL_VERSION_MINOR != 3) return 0;
   if (SQRL_VERSION_PATCH != 0) return 0;
-  if (strcmp(SQRL_VERSION_STRING, "0.1.0") != 0) return 0;
+  if (strcmp(SQRL_VERSION_STRING, "0.3.0") != 0) return 0;
   return 1;
 }
 
@@ -60,6 +69,9 @@ static int test_error_codes(void) {
   if (SQRL_ERR_DECODE != 12) return 0;
   if (SQRL_ERR_SERVER != 13) return 0;
   if (SQRL_ERR_NOT_FOUND != 14) return 0;
+  if (SQRL_ERR_OVERLOADED != 15) return 0;
+  if (SQRL_ERR_UNAVAILABLE != 16) return 0;
+  if (SQRL_ERR_CONFLICT != 17) return 0;
   return 1;
 }
 
@@ -73,6 +85,12 @@ static int test_error_strings(void) {
   err = sqrl_error_string(SQRL_ERR_CONNECT);
   if (err == NULL || strlen(err) == 0) return 0;
 
+  err = sqrl_error_string(SQRL_ERR_UNAVAILABLE);
+  if (err == NULL || strcmp(err, "Unknown error") == 0) return 0;
+
+  err = sqrl_error_string(SQRL_ERR_CONFLICT);
+  if (err == NULL || strcmp(err, "Unknown error") == 0) return 0;
+
   err = sqrl_error_string(SQRL_ERR_AUTH_FAILED);
   if (err == NULL || strlen(err) == 0) return 0;
 
@@ -110,6 +128,18 @@ static int test_default_options(void) {
   if (!opts.use_msgpack) return 0;
   if (opts.connect_timeout_ms <= 0) return 0;
   if (opts.request_timeout_ms <= 0) return 0;
+  if (opts.batch_window_us != 0) return 0; /* Batching is opt-in */
+  if (opts.batch_max_bytes == 0) return 0;
+  if (opts.hedge_percentile != 0.0) return 0; /* Hedging is opt-in */
+  if (opts.max_concurrency != 0) return 0;
+  if (opts.breaker_threshold != 0) return 0;
+  if (opts.lazy_connect) return 0;
+  if (opts.connections != 1) return 0;
+  if (opts.bulk_threshold != 0) return 0;
+  if (opts.coalesce_reads) return 0;
+  if (opts.result_cache_ttl_ms != 0) return 0;
+  if (opts.subscription_credits != 0) return 0;
+  if (opts.compact_documents) return 0;
 
   return 1;
 }
@@ -193,6 +223,40 @@ static int test_connect_refused(void) {
   return 1;
 }
 
+/* Test lazy connect to a closed port: returns at once, then fails */
+static int test_lazy_connect_refused(void) {
+  sqrl_client_t *client = NULL;
+  sqrl_options_t opts = sqrl_options_default();
+  opts.lazy_connect = true;
+
+  if (sqrl_connect(&client, "127.0.0.1", 59999, &opts) != SQRL_OK) return 0;
+
+  sqrl_error_t err = sqrl_wait_connected(client, 0);
+  int ok = err == SQRL_ERR_CONNECT && !sqrl_is_connected(client);
+  ok = ok && sqrl_warmup(&client, 1) == SQRL_ERR_CLOSED;
+
+  sqrl_disconnect(client);
+  return ok && sqrl_wait_connected(NULL, 0) == SQRL_ERR_INVALID_ARG;
+}
+
+/* Test that repeated connects to one host share a cached lookup */
+static int test_resolver_cache(void) {
+  sqrl_resolver_options_t opts = sqrl_resolver_options_default();
+  if (opts.ttl_ms <= 0 || opts.max_entries == 0) return 0;
+
+  sqrl_resolver_flush();
+  sqrl_resolver_stats_t before, after;
+  sqrl_resolver_get_stats(&before);
+
+  sqrl_client_t *client = NULL;
+  for (int i = 0; i < 3; i++) {
+    if (sqrl_connect(&client, "127.0.0.1", 59999, NULL) == SQRL_OK) sqrl_disconnect(client);
+  }
+
+  sqrl_resolver_get_stats(&after);
+  return after.lookups - before.lookups == 1 && after.entries == 1;
+}
+
 /* Test document free with NULL */
 static int test_document_free_null(void) {
   /* Should not crash */
@@ -236,6 +300,1782 @@ static int test_session_id_null(void) {
   return 1;
 }
 
+/* Test stats with NULL arguments */
+static int test_get_stats_null(void) {
+  sqrl_stats_t stats;
+  if (sqrl_get_stats(NULL, &stats) != SQRL_ERR_INVALID_ARG) return 0;
+  return 1;
+}
+
+/* Test async operations reject missing arguments */
+static void ignore_result(sqrl_error_t err, char *result, void *user_data) {
+  (void)err;
+  (void)user_data;
+  sqrl_string_free(result);
+}
+
+static int test_async_null_args(void) {
+  if (sqrl_query_async(NULL, "q", ignore_result, NULL) != SQRL_ERR_INVALID_ARG) return 0;
+  if (sqrl_insert_async(NULL, "users", "{}", NULL, NULL) != SQRL_ERR_INVALID_ARG) return 0;
+  if (sqrl_update_async(NULL, "users", "id", "{}", NULL, NULL) != SQRL_ERR_INVALID_ARG) return 0;
+  if (sqrl_delete_async(NULL, "users", "id", NULL, NULL) != SQRL_ERR_INVALID_ARG) return 0;
+  return 1;
+}
+
+/* Test debug snapshot argument checks */
+static int test_debug_snapshot_null_args(void) {
+  sqrl_debug_snapshot_t snap = {0};
+
+  if (sqrl_debug_snapshot(NULL, &snap) != SQRL_ERR_INVALID_ARG) return 0;
+  if (sqrl_debug_dump(NULL, stdout) != SQRL_ERR_INVALID_ARG) return 0;
+
+  /* Freeing an empty snapshot is a no-op */
+  sqrl_debug_snapshot_free(&snap);
+  sqrl_debug_snapshot_free(NULL);
+  return snap.pending == NULL && snap.subscription_count == 0;
+}
+
+/* Test metrics rendering without any sources */
+static int test_metrics_render_empty(void) {
+  char buf[64];
+  size_t len = 0;
+
+  if (sqrl_metrics_render(NULL, NULL, NULL, buf, sizeof(buf), &len) != SQRL_OK) return 0;
+  if (strcmp(buf, "# EOF\n") != 0 || len != 6) return 0;
+
+  /* Too small: reports the size needed */
+  if (sqrl_metrics_render(NULL, NULL, NULL, buf, 4, &len) != SQRL_ERR_ENCODE) return 0;
+  if (len != 6) return 0;
+
+  return 1;
+}
+
+/* Test projection and includeInitial in compiled subscription queries */
+static int test_query_select_changes(void) {
+  sqrl_query_t *q = sqrl_table("users");
+  sqrl_find_eq_str(q, "status", "active");
+  sqrl_select(q, "name");
+  sqrl_select(q, "email");
+  sqrl_include_initial(sqrl_changes(q), true);
+
+  char *structured = sqrl_query_compile_structured(q);
+  char *legacy = sqrl_query_compile(q);
+  sqrl_query_free(q);
+
+  int ok = structured && legacy &&
+           strstr(structured, "\"projection\":[\"name\",\"email\"]") &&
+           strstr(structured, "\"changes\":{\"includeInitial\":true}") &&
+           strstr(legacy, ".pluck(\"name\", \"email\").changes({includeInitial: true})");
+  free(structured);
+  free(legacy);
+  return ok;
+}
+
+/* Test a full projection compiles whole and over-long fields are rejected */
+static int test_query_select_limits(void) {
+  char field[129];
+  memset(field, 'f', 127);
+  field[127] = '\0';
+
+  sqrl_query_t *q = sqrl_table("users");
+  for (int i = 0; i < 32; i++) sqrl_select(q, field);
+  char *structured = sqrl_query_compile_structured(q);
+  char *legacy = sqrl_query_compile(q);
+
+  /* Every field made it, the last one intact */
+  char tail[160];
+  snprintf(tail, sizeof(tail), "\"%s\"]}", field);
+  size_t len = structured ? strlen(structured) : 0;
+  int ok = structured && legacy && len > 32 * 130 &&
+           strcmp(structured + len - strlen(tail), tail) == 0 &&
+           strlen(legacy) > 32 * 130;
+  snprintf(tail, sizeof(tail), "\"%s\").run()", field);
+  ok = ok && strcmp(legacy + strlen(legacy) - strlen(tail), tail) == 0;
+  free(structured);
+  free(legacy);
+
+  /* One more field, or one byte more, no longer fits */
+  sqrl_select(q, "extra");
+  ok = ok && sqrl_query_compile(q) == NULL && sqrl_query_compile_structured(q) == NULL;
+  sqrl_query_free(q);
+
+  field[127] = 'f';
+  field[128] = '\0';
+  q = sqrl_table("users");
+  sqrl_select(q, field);
+  ok = ok && sqrl_query_compile_structured(q) == NULL;
+  sqrl_query_free(q);
+  return ok;
+}
+
+/* Test builder subscriptions reject missing arguments */
+static void ignore_change(const sqrl_change_event_t *event, void *user_data) {
+  (void)event;
+  (void)user_data;
+}
+
+static int test_subscribe_query_null_args(void) {
+  sqrl_subscription_t *sub = NULL;
+  sqrl_query_t *q = sqrl_table("users");
+
+  int ok = sqrl_subscribe_query(NULL, q, ignore_change, NULL, &sub) == SQRL_ERR_INVALID_ARG &&
+           sub == NULL;
+  sqrl_query_free(q);
+  return ok;
+}
+
+/* Test subscription stats argument checks */
+static int test_subscription_stats_null(void) {
+  sqrl_subscription_stats_t stats;
+  if (sqrl_subscription_get_stats(NULL, &stats) != SQRL_ERR_INVALID_ARG) return 0;
+  return 1;
+}
+
+/* Test multi-collection subscriptions reject missing arguments */
+static int test_subscribe_collections_null_args(void) {
+  const char *names[] = {"orders", "users"};
+  sqrl_subscription_t *sub = NULL;
+
+  if (sqrl_subscribe_collections(NULL, names, 2, ignore_change, NULL, &sub) != SQRL_ERR_INVALID_ARG) return 0;
+  return sub == NULL;
+}
+
+/* Test shard groups reject bad arguments and report connect failures */
+static int test_shards_errors(void) {
+  sqrl_shards_t *shards = (sqrl_shards_t *)1;
+
+  if (sqrl_shards_connect(NULL, "127.0.0.1", 1, NULL, 2) != SQRL_ERR_INVALID_ARG) return 0;
+  if (sqrl_shards_connect(&shards, "127.0.0.1", 1, NULL, 2) != SQRL_ERR_CONNECT || shards != NULL) return 0;
+  if (sqrl_shard_client(NULL) != NULL || sqrl_shard_index(NULL) != -1) return 0;
+  if (sqrl_shards_post(NULL, 0, NULL, NULL) != SQRL_ERR_INVALID_ARG) return 0;
+  return sqrl_shards_poll(NULL) == 0 && sqrl_shards_count(NULL) == 0;
+}
+
+/* Test multi-query argument checks */
+static int test_query_many_null_args(void) {
+  const char *queries[] = {"db.table(\"a\").run()", NULL};
+  sqrl_query_result_t results[2];
+
+  if (sqrl_query_many(NULL, queries, 1, results) != SQRL_ERR_INVALID_ARG) return 0;
+  sqrl_query_results_free(NULL, 2);
+  return 1;
+}
+
+/* Test generated ids are UUIDv7 and sort in generation order */
+static int test_generate_id(void) {
+  char prev[SQRL_ID_SIZE], id[SQRL_ID_SIZE];
+  sqrl_generate_id(prev);
+
+  for (int i = 0; i < 10000; i++) {
+    sqrl_generate_id(id);
+    if (strlen(id) != 36 || id[8] != '-' || id[13] != '-' || id[18] != '-' || id[23] != '-') return 0;
+    if (id[14] != '7' || !strchr("89ab", id[19])) return 0;
+    if (strcmp(prev, id) >= 0) return 0;
+    memcpy(prev, id, sizeof(id));
+  }
+  return 1;
+}
+
+/* Test acknowledged inserts reject bad arguments */
+static int test_insert_ack_null_args(void) {
+  char id[SQRL_ID_SIZE];
+  return sqrl_insert_ack(NULL, "events", "{}", SQRL_ACK_NONE, id) == SQRL_ERR_INVALID_ARG;
+}
+
+/* Test conditional writes reject missing arguments */
+static int test_update_if_null_args(void) {
+  sqrl_document_t *doc = NULL;
+  if (sqrl_update_if(NULL, "users", "u1", "{}", 3, &doc) != SQRL_ERR_INVALID_ARG) return 0;
+  return sqrl_upsert(NULL, "users", "u1", "{}", &doc) == SQRL_ERR_INVALID_ARG && doc == NULL;
+}
+
+/* Test patches compile to ordered operations with escaped strings */
+static int test_patch_compile(void) {
+  sqrl_patch_t *p = sqrl_patch_new();
+  sqrl_patch_inc_int(p, "views", 1);
+  sqrl_patch_set_str(p, "title", "say \"hi\"");
+  sqrl_patch_unset(p, "draft");
+  sqrl_patch_push_str(p, "tags", "hot");
+  sqrl_patch_pull_int(p, "ids", 7);
+
+  char *json = sqrl_patch_compile(p);
+  int ok = json && sqrl_patch_count(p) == 5 &&
+           strcmp(json, "[{\"op\":\"inc\",\"field\":\"views\",\"value\":1},"
+                        "{\"op\":\"set\",\"field\":\"title\",\"value\":\"say \\\"hi\\\"\"},"
+                        "{\"op\":\"unset\",\"field\":\"draft\"},"
+                        "{\"op\":\"push\",\"field\":\"tags\",\"value\":\"hot\"},"
+                        "{\"op\":\"pull\",\"field\":\"ids\",\"value\":7}]") == 0;
+  free(json);
+
+  /* A dropped operation makes the whole patch uncompilable */
+  sqrl_patch_set_str(p, "name", NULL);
+  ok = ok && sqrl_patch_compile(p) == NULL &&
+       sqrl_update_patch(NULL, "posts", "p1", p, NULL) == SQRL_ERR_INVALID_ARG;
+  sqrl_patch_free(p);
+
+  /* So does a double JSON can't represent */
+  double bad[] = {NAN, INFINITY, -INFINITY};
+  for (size_t i = 0; ok && i < sizeof(bad) / sizeof(bad[0]); i++) {
+    p = sqrl_patch_inc_double(sqrl_patch_set_double(sqrl_patch_new(), "score", 0.5), "rank", bad[i]);
+    ok = sqrl_patch_count(p) == 1 && sqrl_patch_compile(p) == NULL;
+    sqrl_patch_free(p);
+  }
+  return ok;
+}
+
+/* Test bulk writes reject missing arguments */
+static int test_bulk_write_null_args(void) {
+  sqrl_query_t *q = sqrl_table("sessions");
+  sqrl_patch_t *p = sqrl_patch_new();
+  size_t count = 1;
+
+  int ok = sqrl_delete_where(NULL, q, &count) == SQRL_ERR_INVALID_ARG &&
+           sqrl_update_where(NULL, q, p, &count) == SQRL_ERR_INVALID_ARG;
+  sqrl_patch_free(p);
+  sqrl_query_free(q);
+  return ok;
+}
+
+/* Test double filters survive compilation exactly, and NaN or infinity
+ * invalidates the builder */
+static int test_query_double_filters(void) {
+  sqrl_query_t *q = sqrl_table("sessions");
+
+  /* Timestamps in filters must survive compilation exactly */
+  sqrl_find_lt(q, "expires", 1700000123);
+  char *compiled = sqrl_query_compile_structured(q);
+  int ok = compiled && strstr(compiled, "{\"$lt\":1700000123}");
+  free(compiled);
+
+  /* So must doubles that need all 17 digits */
+  sqrl_find_gte(q, "score", 0.1 + 0.2);
+  compiled = sqrl_query_compile_structured(q);
+  ok = ok && compiled && strstr(compiled, "{\"$gte\":0.30000000000000004}");
+  free(compiled);
+  compiled = sqrl_query_compile(q);
+  ok = ok && compiled && strstr(compiled, "0.30000000000000004");
+  free(compiled);
+  sqrl_query_free(q);
+
+  /* "nan" and "inf" aren't JSON, whichever operator carries them */
+  sqrl_query_t *(*ops[])(sqrl_query_t *, const char *, double) = {
+    sqrl_find_eq_double, sqrl_find_gt, sqrl_find_gte, sqrl_find_lt, sqrl_find_lte,
+  };
+  double bad[] = {NAN, INFINITY, -INFINITY};
+  for (size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i++) {
+    for (size_t j = 0; ok && j < sizeof(bad) / sizeof(bad[0]); j++) {
+      q = ops[i](sqrl_find_eq_int(sqrl_table("users"), "age", 30), "score", bad[j]);
+      ok = q && sqrl_query_compile(q) == NULL && sqrl_query_compile_structured(q) == NULL;
+      sqrl_query_free(q);
+    }
+  }
+  return ok && sqrl_find_gt(NULL, "score", NAN) == NULL;
+}
+
+/* Test count and exists modes drop sort and projection */
+static int test_query_count_modes(void) {
+  sqrl_query_t *q = sqrl_table("users");
+  sqrl_find_eq_str(q, "status", "active");
+  sqrl_sort(q, "name", SQRL_ASC);
+  sqrl_select(q, "name");
+  sqrl_limit(q, 50);
+
+  sqrl_count_mode(q);
+  char *structured = sqrl_query_compile_structured(q);
+  char *legacy = sqrl_query_compile(q);
+  int ok = structured && legacy &&
+           strcmp(structured, "{\"table\":\"users\",\"filter\":{\"status\":{\"$eq\":\"active\"}},"
+                              "\"limit\":50,\"count\":true}") == 0 &&
+           strstr(legacy, ".limit(50).count().run()") && !strstr(legacy, "orderBy") && !strstr(legacy, "pluck");
+  free(structured);
+  free(legacy);
+
+  sqrl_exists_mode(q);
+  structured = sqrl_query_compile_structured(q);
+  ok = ok && structured && strstr(structured, "\"limit\":1,\"count\":true}");
+  free(structured);
+
+  bool found = true;
+  ok = ok && sqrl_exists(NULL, q, &found) == SQRL_ERR_INVALID_ARG && sqrl_count(NULL, q, NULL) == SQRL_ERR_INVALID_ARG;
+  sqrl_query_free(q);
+  return ok;
+}
+
+/* Loopback tests
+ *
+ * These run a real client against the in-process server in loopback.c. The
+ * server logs every request and answers like SquirrelDB would; a test can
+ * override replies and push change events to the last subscribing
+ * connection.
+ */
+
+#define MAX_LOGGED 1024
+
+typedef struct test_server test_server_t;
+
+/* Returns true if it answered the request itself */
+typedef bool (*test_reply_t)(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id);
+
+struct test_server {
+  loopback_t *loopback;
+  test_reply_t reply;
+  void *state;
+  pthread_mutex_t mutex;
+  char *requests[MAX_LOGGED];
+  size_t request_count;
+  loopback_conn_t *feed_conn;  /* Connection of the last subscribe */
+  char feed_id[32];            /* Its subscription id */
+};
+
+static void sleep_ms(int ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Polls cond for up to two seconds */
+#define WAIT_UNTIL(cond) do { \
+  for (int wait_i = 0; wait_i < 2000 && !(cond); wait_i++) sleep_ms(1); \
+} while (0)
+
+static void test_server_handle(loopback_conn_t *conn, const char *request, void *user_data) {
+  test_server_t *ts = user_data;
+  char id[32];
+  loopback_request_id(request, id, sizeof(id));
+
+  pthread_mutex_lock(&ts->mutex);
+  if (ts->request_count < MAX_LOGGED) ts->requests[ts->request_count++] = strdup(request);
+  if (strstr(request, "\"type\":\"subscribe\"")) {
+    ts->feed_conn = conn;
+    snprintf(ts->feed_id, sizeof(ts->feed_id), "%s", id);
+  }
+  pthread_mutex_unlock(&ts->mutex);
+
+  if (ts->reply && ts->reply(ts, conn, request, id)) return;
+  loopback_reply_canned(conn, request);
+}
+
+static bool test_server_start(test_server_t *ts, test_reply_t reply, void *state) {
+  memset(ts, 0, sizeof(*ts));
+  ts->reply = reply;
+  ts->state = state;
+  pthread_mutex_init(&ts->mutex, NULL);
+  ts->loopback = loopback_start(test_server_handle, ts);
+  return ts->loopback != NULL;
+}
+
+static void test_server_stop(test_server_t *ts) {
+  loopback_stop(ts->loopback);
+  for (size_t i = 0; i < ts->request_count; i++) free(ts->requests[i]);
+  pthread_mutex_destroy(&ts->mutex);
+}
+
+/* Number of logged requests containing needle */
+static int test_server_count(test_server_t *ts, const char *needle) {
+  int n = 0;
+  pthread_mutex_lock(&ts->mutex);
+  for (size_t i = 0; i < ts->request_count; i++) n += strstr(ts->requests[i], needle) != NULL;
+  pthread_mutex_unlock(&ts->mutex);
+  return n;
+}
+
+/* Position in the log of the first or last request containing needle, -1
+ * if none */
+static int test_server_find(test_server_t *ts, const char *needle, bool last) {
+  int found = -1;
+  pthread_mutex_lock(&ts->mutex);
+  for (size_t i = 0; i < ts->request_count && (last || found < 0); i++) {
+    if (strstr(ts->requests[i], needle)) found = (int)i;
+  }
+  pthread_mutex_unlock(&ts->mutex);
+  return found;
+}
+
+static sqrl_client_t *test_connect(test_server_t *ts, const sqrl_options_t *opts) {
+  sqrl_client_t *client = NULL;
+  if (sqrl_connect(&client, "127.0.0.1", loopback_port(ts->loopback), opts) != SQRL_OK) return NULL;
+  return client;
+}
+
+/* Sends {"type":"change","id":<feed>,"change":change} on the feed's socket */
+static void test_server_push(test_server_t *ts, const char *change) {
+  char frame[1024];
+  pthread_mutex_lock(&ts->mutex);
+  snprintf(frame, sizeof(frame), "{\"type\":\"change\",\"id\":\"%s\",\"change\":%s}", ts->feed_id, change);
+  loopback_conn_t *conn = ts->feed_conn;
+  pthread_mutex_unlock(&ts->mutex);
+  if (conn) loopback_send(conn, frame);
+}
+
+/* A query round trip; every frame the server sent before the reply has
+ * been handled once it returns (sqrl_ping() doesn't wait for its pong) */
+static sqrl_error_t test_round_trip(sqrl_client_t *client) {
+  char *result = NULL;
+  sqrl_error_t err = sqrl_query(client, "db.table(\"users\").run()", &result);
+  sqrl_string_free(result);
+  return err;
+}
+
+#define TEST_INSERT(doc_id) \
+  "{\"type\":\"insert\",\"new\":{\"id\":\"" doc_id "\",\"collection\":\"users\",\"data\":{\"n\":1}}}"
+
+static void count_change(const sqrl_change_event_t *event, void *user_data) {
+  (void)event;
+  atomic_fetch_add((atomic_int *)user_data, 1);
+}
+
+/* Test unsubscribing from a change callback, its own handle and another
+ * handle on the same feed, neither hangs nor delivers again */
+typedef struct {
+  sqrl_subscription_t *_Atomic self;
+  sqrl_subscription_t *other;
+  atomic_int events;
+} unsub_state_t;
+
+static void unsubscribe_on_change(const sqrl_change_event_t *event, void *user_data) {
+  unsub_state_t *st = user_data;
+  (void)event;
+  if (atomic_fetch_add(&st->events, 1) == 0) {
+    sqrl_unsubscribe(st->other);
+    sqrl_unsubscribe(atomic_load(&st->self));
+  }
+}
+
+static int unsubscribe_in_callback(int credits) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.subscription_credits = credits;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  /* The later handle is called first, so it removes the other mid-event */
+  atomic_int other_events = 0;
+  unsub_state_t st = {NULL, NULL, 0};
+  sqrl_subscription_t *self = NULL;
+  int ok = sqrl_subscribe(client, "db.table(\"users\").changes()", count_change, &other_events, &st.other) == SQRL_OK &&
+           sqrl_subscribe(client, "db.table(\"users\").changes()", unsubscribe_on_change, &st, &self) == SQRL_OK;
+  atomic_store(&st.self, self);
+
+  test_server_push(&ts, TEST_INSERT("u1"));
+  WAIT_UNTIL(test_server_count(&ts, "\"type\":\"unsubscribe\"") == 1);
+  test_server_push(&ts, TEST_INSERT("u2"));
+
+  sqrl_debug_snapshot_t snap = {0};
+  ok = ok && test_round_trip(client) == SQRL_OK && sqrl_debug_snapshot(client, &snap) == SQRL_OK &&
+       snap.subscription_count == 0 && atomic_load(&st.events) == 1 && atomic_load(&other_events) == 0 &&
+       test_server_count(&ts, "\"type\":\"unsubscribe\"") == 1;
+  sqrl_debug_snapshot_free(&snap);
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+static int test_unsubscribe_in_callback(void) {
+  return unsubscribe_in_callback(0) && unsubscribe_in_callback(4);
+}
+
+/* Test a feed shared by two handles: the joiner is replayed what was
+ * tracked since an empty initial set, a replay callback may block while
+ * live events arrive, and the server feed lives until the last handle */
+#define MAX_RECORDED 16
+
+typedef struct {
+  test_server_t *ts;
+  sqrl_client_t *client;
+  bool block_on_initial;
+  sqrl_error_t round_trip_err;
+  pthread_mutex_t mutex;
+  char events[MAX_RECORDED][32];  /* "<type>:<document id>" */
+  int count;
+} recorder_t;
+
+static const char *change_name(sqrl_change_type_t type) {
+  switch (type) {
+    case SQRL_CHANGE_INITIAL: return "initial";
+    case SQRL_CHANGE_INSERT: return "insert";
+    case SQRL_CHANGE_UPDATE: return "update";
+    case SQRL_CHANGE_DELETE: return "delete";
+  }
+  return "?";
+}
+
+static void record_change(const sqrl_change_event_t *event, void *user_data) {
+  recorder_t *r = user_data;
+  const sqrl_document_t *doc = event->document ? event->document : event->new_doc;
+  pthread_mutex_lock(&r->mutex);
+  if (r->count < MAX_RECORDED) {
+    snprintf(r->events[r->count++], sizeof(r->events[0]), "%s:%s", change_name(event->type), doc ? doc->id : "-");
+  }
+  bool block = r->block_on_initial && event->type == SQRL_CHANGE_INITIAL;
+  r->block_on_initial = false;
+  pthread_mutex_unlock(&r->mutex);
+
+  if (block) {
+    test_server_push(r->ts, TEST_INSERT("u3"));
+    r->round_trip_err = test_round_trip(r->client);
+  }
+}
+
+static int recorded_count(recorder_t *r) {
+  pthread_mutex_lock(&r->mutex);
+  int n = r->count;
+  pthread_mutex_unlock(&r->mutex);
+  return n;
+}
+
+static bool recorded(recorder_t *r, int i, const char *expected) {
+  pthread_mutex_lock(&r->mutex);
+  bool match = i < r->count && strcmp(r->events[i], expected) == 0;
+  pthread_mutex_unlock(&r->mutex);
+  return match;
+}
+
+static int test_feed_sharing(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  recorder_t first = {&ts, client, false, SQRL_OK, PTHREAD_MUTEX_INITIALIZER, {{0}}, 0};
+  recorder_t joiner = {&ts, client, true, SQRL_OK, PTHREAD_MUTEX_INITIALIZER, {{0}}, 0};
+  sqrl_subscription_t *a = NULL, *b = NULL;
+
+  /* The initial set is empty, so only the changes build the snapshot */
+  int ok = sqrl_subscribe(client, "db.table(\"users\").changes({includeInitial: true})", record_change, &first, &a) == SQRL_OK;
+  test_server_push(&ts, TEST_INSERT("u1"));
+  test_server_push(&ts, TEST_INSERT("u2"));
+  test_server_push(&ts, "{\"type\":\"update\",\"new\":{\"id\":\"u1\",\"collection\":\"users\",\"data\":{\"n\":2}},"
+                        "\"old\":{\"id\":\"u1\",\"collection\":\"users\",\"data\":{\"n\":1}}}");
+  test_server_push(&ts, "{\"type\":\"delete\",\"old\":{\"id\":\"u2\",\"collection\":\"users\",\"data\":{\"n\":1}}}");
+  WAIT_UNTIL(recorded_count(&first) == 4);
+
+  ok = ok && recorded_count(&first) == 4 &&
+       sqrl_subscribe(client, "db.table(\"users\").changes({ includeInitial: true })", record_change, &joiner, &b) == SQRL_OK;
+  ok = ok && test_server_count(&ts, "\"type\":\"subscribe\"") == 1 &&
+       strcmp(sqrl_subscription_id(a), sqrl_subscription_id(b)) == 0 && joiner.round_trip_err == SQRL_OK &&
+       recorded(&joiner, 0, "initial:u1") && recorded(&joiner, 1, "insert:u3") && recorded_count(&joiner) == 2;
+  WAIT_UNTIL(recorded_count(&first) == 5);
+  ok = ok && recorded(&first, 4, "insert:u3");
+
+  /* The feed outlives its first handle */
+  ok = ok && sqrl_unsubscribe(a) == SQRL_OK;
+  test_server_push(&ts, TEST_INSERT("u4"));
+  WAIT_UNTIL(recorded_count(&joiner) == 3);
+  ok = ok && recorded(&joiner, 2, "insert:u4") && recorded_count(&first) == 5 &&
+       test_server_count(&ts, "\"type\":\"unsubscribe\"") == 0;
+
+  sqrl_debug_snapshot_t snap = {0};
+  ok = ok && sqrl_unsubscribe(b) == SQRL_OK && test_server_count(&ts, "\"type\":\"unsubscribe\"") == 1 &&
+       sqrl_debug_snapshot(client, &snap) == SQRL_OK && snap.subscription_count == 0;
+  sqrl_debug_snapshot_free(&snap);
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  pthread_mutex_destroy(&first.mutex);
+  pthread_mutex_destroy(&joiner.mutex);
+  return ok;
+}
+
+/* Test sqrl_count/sqrl_exists send count queries without changing the
+ * caller's builder, and refuse a changes query */
+static bool reply_count(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  (void)ts;
+  if (!strstr(request, "count\\\":true")) return false;  /* Inside the escaped query */
+  char out[128];
+  snprintf(out, sizeof(out), "{\"type\":\"result\",\"id\":\"%s\",\"data\":{\"count\":3}}", id);
+  loopback_send(conn, out);
+  return true;
+}
+
+static int test_count_keeps_builder(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_count, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  sqrl_query_t *q = sqrl_table("users");
+  sqrl_sort(q, "name", SQRL_ASC);
+  sqrl_select(q, "name");
+  char *before = sqrl_query_compile_structured(q);
+
+  size_t count = 0;
+  bool found = false;
+  int ok = sqrl_count(client, q, &count) == SQRL_OK && count == 3 &&
+           sqrl_exists(client, q, &found) == SQRL_OK && found &&
+           test_server_count(&ts, "limit\\\":1,") == 1;
+  char *after = sqrl_query_compile_structured(q);
+  ok = ok && before && after && strcmp(before, after) == 0 && !strstr(after, "count");
+  free(before);
+  free(after);
+
+  sqrl_changes(q);
+  ok = ok && sqrl_count(client, q, &count) == SQRL_ERR_INVALID_ARG &&
+       sqrl_exists(client, q, &found) == SQRL_ERR_INVALID_ARG && test_server_count(&ts, "count\\\":true") == 2;
+  sqrl_query_free(q);
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test sqrl_subscribe_query subscribes to changes without marking the
+ * caller's builder as a changes query */
+static int test_subscribe_query_keeps_builder(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  sqrl_query_t *q = sqrl_table("users");
+  sqrl_find_eq_str(q, "status", "active");
+  sqrl_subscription_t *sub = NULL;
+  int ok = sqrl_subscribe_query(client, q, ignore_change, NULL, &sub) == SQRL_OK &&
+           test_server_count(&ts, "changes\\\":{") == 1;
+
+  char *compiled = sqrl_query_compile_structured(q);
+  ok = ok && compiled && !strstr(compiled, "changes");
+  free(compiled);
+
+  size_t count = 0;
+  ok = ok && sqrl_count(client, q, &count) != SQRL_ERR_INVALID_ARG && sqrl_unsubscribe(sub) == SQRL_OK;
+  sqrl_query_free(q);
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test hedged reads under the concurrency limit: a blocking query waits
+ * for a slot instead of failing, and a timeout trips the breaker */
+typedef struct {
+  int delay_ms;
+  bool drop;
+} slow_queries_t;
+
+static bool reply_slow_query(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  const slow_queries_t *slow = ts->state;
+  (void)conn;
+  (void)id;
+  if (!strstr(request, "\"type\":\"query\"")) return false;
+  if (slow->drop) return true;
+  sleep_ms(slow->delay_ms);
+  return false;
+}
+
+static void *query_thread(void *arg) {
+  return (void *)(intptr_t)test_round_trip(arg);
+}
+
+static int test_hedged_query_limits(void) {
+  slow_queries_t slow = {100, false};
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_slow_query, &slow)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.hedge_percentile = 95.0;
+  opts.max_concurrency = 1;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, query_thread, client);
+  WAIT_UNTIL(test_server_count(&ts, "\"type\":\"query\"") == 1);
+  int ok = test_round_trip(client) == SQRL_OK;
+  void *first = NULL;
+  pthread_join(thread, &first);
+  ok = ok && (intptr_t)first == SQRL_OK;
+  sqrl_disconnect(client);
+
+  /* A timed-out hedged read is a failure to the breaker */
+  slow.drop = true;
+  opts.request_timeout_ms = 50;
+  opts.breaker_threshold = 1;
+  opts.breaker_cooldown_ms = 60000;
+  client = test_connect(&ts, &opts);
+  ok = ok && client && test_round_trip(client) == SQRL_ERR_TIMEOUT && test_round_trip(client) == SQRL_ERR_UNAVAILABLE;
+  sqrl_disconnect(client);
+
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test a lazy connect sends the requests parked during the handshake first,
+ * in order, and an unacknowledged insert never overtakes them */
+#define PARKED_QUERIES 64
+
+static void count_result(sqrl_error_t err, char *result, void *user_data) {
+  sqrl_string_free(result);
+  if (err == SQRL_OK) atomic_fetch_add((atomic_int *)user_data, 1);
+}
+
+static int test_lazy_connect_order(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  loopback_delay_handshake(ts.loopback, 100);
+
+  /* The second socket's handshake holds the flush back for as long again */
+  sqrl_options_t opts = sqrl_options_default();
+  opts.lazy_connect = true;
+  opts.connections = 2;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  atomic_int done = 0;
+  int ok = !sqrl_is_connected(client);
+  for (int i = 0; i < PARKED_QUERIES; i++) {
+    ok = ok && sqrl_query_async(client, "db.table(\"users\").run()", count_result, &done) == SQRL_OK;
+  }
+
+  /* Insert once the primary socket is up but before the parked queries
+   * have gone out */
+  uint64_t spins = 0;
+  while (!sqrl_is_connected(client) && ++spins < 1000000000ull) {}
+  char doc_id[SQRL_ID_SIZE];
+  for (int i = 0; ok && i < 100; i++) {
+    ok = sqrl_insert_ack(client, "users", "{\"n\":1}", SQRL_ACK_NONE, doc_id) == SQRL_OK;
+  }
+  ok = ok && test_round_trip(client) == SQRL_OK && atomic_load(&done) == PARKED_QUERIES &&
+       test_server_find(&ts, "\"type\":\"insert\"", false) > test_server_find(&ts, "\"type\":\"query\"", false) + PARKED_QUERIES - 1;
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test bulk writes name their table and refuse a builder without one */
+static int test_bulk_write_table(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  sqrl_query_t *unnamed = sqrl_table("");
+  sqrl_query_t *q = sqrl_table("sessions");
+  sqrl_patch_t *p = sqrl_patch_new();
+  sqrl_find_lt(q, "expires", 1700000123);
+
+  int ok = sqrl_delete_where(client, unnamed, NULL) == SQRL_ERR_INVALID_ARG &&
+           sqrl_update_where(client, unnamed, p, NULL) == SQRL_ERR_INVALID_ARG &&
+           test_server_count(&ts, "_many\"") == 0;
+  sqrl_delete_where(client, q, NULL);
+  ok = ok && test_server_count(&ts, "\"type\":\"delete_many\",\"id\"") == 1 &&
+       test_server_count(&ts, "\"collection\":\"sessions\"") == 1;
+
+  sqrl_patch_free(p);
+  sqrl_query_free(q);
+  sqrl_query_free(unnamed);
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test sqrl_update_patch sends a patch frame with the compiled ops and
+ * decodes the document it gets back */
+static bool reply_patch(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  (void)ts;
+  if (!strstr(request, "\"type\":\"patch\"")) return false;
+  char out[512];
+  snprintf(out, sizeof(out),
+           "{\"type\":\"result\",\"id\":\"%s\",\"data\":{\"id\":\"p1\",\"collection\":\"posts\","
+           "\"data\":{\"views\":2,\"tags\":[\"hot\"]},\"version\":3,"
+           "\"created_at\":\"2024-01-01T00:00:00Z\",\"updated_at\":\"2024-01-01T00:00:01Z\"}}",
+           id);
+  loopback_send(conn, out);
+  return true;
+}
+
+static int test_update_patch_round_trip(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_patch, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  sqrl_patch_t *p = sqrl_patch_new();
+  sqrl_patch_inc_int(p, "views", 1);
+  sqrl_patch_push_str(p, "tags", "hot");
+  sqrl_document_t *doc = NULL;
+  int ok = sqrl_update_patch(client, "posts", "p1", p, &doc) == SQRL_OK && doc &&
+           strcmp(doc->id, "p1") == 0 && strcmp(doc->collection, "posts") == 0 &&
+           strstr(doc->data, "\"views\":2") && doc->version == 3 &&
+           doc->updated_ns == 1704067201000000000;
+  ok = ok && test_server_count(&ts, "\"type\":\"patch\"") == 1 &&
+       test_server_count(&ts, "\"collection\":\"posts\",\"document_id\":\"p1\","
+                              "\"ops\":[{\"op\":\"inc\",\"field\":\"views\",\"value\":1},"
+                              "{\"op\":\"push\",\"field\":\"tags\",\"value\":\"hot\"}]}") == 1;
+  sqrl_document_free(doc);
+
+  /* An uncompilable patch never reaches the wire */
+  sqrl_patch_set_double(p, "score", NAN);
+  doc = NULL;
+  ok = ok && sqrl_update_patch(client, "posts", "p1", p, &doc) == SQRL_ERR_ENCODE && !doc &&
+       test_server_count(&ts, "\"type\":\"patch\"") == 1;
+
+  sqrl_patch_free(p);
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test document timestamps decode to epoch nanoseconds, out-of-range
+ * fields decode to 0, and compact documents share one collection name */
+static bool reply_timestamp(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  if (!strstr(request, "\"type\":\"insert\"")) return false;
+  char out[512];
+  snprintf(out, sizeof(out),
+           "{\"type\":\"result\",\"id\":\"%s\",\"data\":{\"id\":\"a\",\"collection\":\"users\","
+           "\"data\":{},\"created_at\":\"%s\",\"updated_at\":\"2024-01-01T00:00:00Z\"}}",
+           id, *(const char **)ts->state);
+  loopback_send(conn, out);
+  return true;
+}
+
+static int test_document_timestamps(void) {
+  static const struct {
+    const char *text;
+    int64_t ns;
+  } cases[] = {
+    {"2024-01-01T00:00:00Z", 1704067200000000000},
+    {"2024-01-01T01:30:00.5+01:30", 1704067200500000000},
+    {"2016-12-31T23:59:60Z", 1483228800000000000},
+    {"2024-02-29T00:00:00Z", 1709164800000000000},
+    {"2024-02-31T00:00:00Z", 0},
+    {"2023-02-29T00:00:00Z", 0},
+    {"2024-04-31T00:00:00Z", 0},
+    {"2024-01-01T24:00:00Z", 0},
+    {"2024-01-01T00:60:00Z", 0},
+    {"2024-01-01T00:00:61Z", 0},
+    {"2024-01-01T00:00:00+24:00", 0},
+    {"2024-01-01T00:00:00+01:60", 0},
+  };
+
+  const char *created_at = NULL;
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_timestamp, &created_at)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  int ok = client != NULL;
+
+  for (size_t i = 0; ok && i < sizeof(cases) / sizeof(cases[0]); i++) {
+    created_at = cases[i].text;
+    sqrl_document_t *doc = NULL;
+    ok = sqrl_insert(client, "users", "{}", &doc) == SQRL_OK && doc->created_ns == cases[i].ns &&
+         doc->updated_ns == 1704067200000000000 && doc->created_at && !doc->shared_collection;
+    sqrl_document_free(doc);
+  }
+  sqrl_disconnect(client);
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.compact_documents = true;
+  client = ok ? test_connect(&ts, &opts) : NULL;
+  sqrl_document_t *first = NULL, *second = NULL;
+  created_at = cases[0].text;
+  ok = client && sqrl_insert(client, "users", "{}", &first) == SQRL_OK &&
+       sqrl_insert(client, "users", "{}", &second) == SQRL_OK &&
+       first->shared_collection && first->collection == second->collection &&
+       strcmp(first->collection, "users") == 0 && !first->created_at && first->created_ns == cases[0].ns;
+
+  /* Freeing after disconnect leaves the interned name alone */
+  sqrl_document_free(first);
+  sqrl_disconnect(client);
+  sqrl_document_free(second);
+
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test write batching: a burst of requests shares a few flushes, lone
+ * requests shrink the window to zero, and batch_max_bytes flushes without
+ * waiting out the window */
+#define BATCHED_QUERIES 64
+
+static int test_write_batching(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.batch_window_us = 20000;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  atomic_int done = 0;
+  int ok = 1;
+  for (int i = 0; i < BATCHED_QUERIES; i++) {
+    ok = ok && sqrl_query_async(client, "db.table(\"users\").run()", count_result, &done) == SQRL_OK;
+  }
+  WAIT_UNTIL(atomic_load(&done) == BATCHED_QUERIES);
+
+  /* Replies can arrive before the flush that sent them updates the stats */
+  sqrl_stats_t stats = {0};
+  WAIT_UNTIL(sqrl_get_stats(client, &stats) == SQRL_OK && stats.frames_sent >= BATCHED_QUERIES &&
+             stats.avg_batch_frames > 2.0);
+  ok = ok && atomic_load(&done) == BATCHED_QUERIES &&
+       stats.frames_sent >= BATCHED_QUERIES && stats.batches_flushed >= 1 &&
+       stats.batches_flushed < BATCHED_QUERIES / 2 && stats.avg_batch_frames > 2.0;
+
+  /* Each single-frame flush halves the window */
+  for (int i = 0; ok && i < 20; i++) ok = test_round_trip(client) == SQRL_OK;
+  ok = ok && sqrl_get_stats(client, &stats) == SQRL_OK && stats.batch_window_us == 0;
+  sqrl_disconnect(client);
+
+  opts.batch_window_us = 2000000;
+  opts.batch_max_bytes = 1;
+  client = ok ? test_connect(&ts, &opts) : NULL;
+  uint64_t start = now_ms();
+  ok = client && test_round_trip(client) == SQRL_OK && now_ms() - start < 1000;
+  sqrl_disconnect(client);
+
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test a hedged read: once the primary connection stalls, the duplicate
+ * sent on the hedge connection answers the caller */
+typedef struct {
+  loopback_conn_t *_Atomic primary;  /* Connection of the first query */
+  atomic_bool stall;
+} stalled_primary_t;
+
+static bool reply_stalled_primary(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  stalled_primary_t *st = ts->state;
+  (void)id;
+  if (!strstr(request, "\"type\":\"query\"")) return false;
+  loopback_conn_t *expected = NULL;
+  atomic_compare_exchange_strong(&st->primary, &expected, conn);
+  if (atomic_load(&st->stall) && atomic_load(&st->primary) == conn) sleep_ms(500);
+  return false;
+}
+
+static int test_hedged_read(void) {
+  stalled_primary_t st = {NULL, false};
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_stalled_primary, &st)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.hedge_percentile = 90.0;
+  opts.hedge_min_delay_ms = 5;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  /* Enough fast round trips for a latency percentile (HEDGE_MIN_SAMPLES) */
+  int ok = loopback_connections(ts.loopback) == 2;
+  for (int i = 0; ok && i < 40; i++) ok = test_round_trip(client) == SQRL_OK;
+
+  sqrl_stats_t before, after;
+  ok = ok && sqrl_get_stats(client, &before) == SQRL_OK;
+  atomic_store(&st.stall, true);
+  uint64_t start = now_ms();
+  ok = ok && test_round_trip(client) == SQRL_OK && now_ms() - start < 400 &&
+       sqrl_get_stats(client, &after) == SQRL_OK && after.hedges_sent == before.hedges_sent + 1 &&
+       after.hedges_won == before.hedges_won + 1;
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test lazy connects: sqrl_connect() returns before the handshake, waiting
+ * can time out, and sqrl_warmup() overlaps the clients' handshakes */
+static int test_lazy_connect_warmup(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  loopback_delay_handshake(ts.loopback, 200);
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.lazy_connect = true;
+  uint64_t start = now_ms();
+  sqrl_client_t *clients[2] = {test_connect(&ts, &opts), test_connect(&ts, &opts)};
+  int ok = clients[0] && clients[1] && now_ms() - start < 100 &&
+           !sqrl_is_connected(clients[0]) && !sqrl_is_connected(clients[1]) &&
+           sqrl_wait_connected(clients[0], 20) == SQRL_ERR_TIMEOUT;
+
+  /* One handshake delay, not one per client */
+  ok = ok && sqrl_warmup(clients, 2) == SQRL_OK && now_ms() - start < 380 &&
+       sqrl_is_connected(clients[0]) && sqrl_is_connected(clients[1]) &&
+       sqrl_wait_connected(clients[1], 0) == SQRL_OK && test_server_count(&ts, "\"type\":\"ping\"") == 2;
+
+  sqrl_disconnect(clients[0]);
+  sqrl_disconnect(clients[1]);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test a lazy connect sends its parked requests without waiting for the
+ * hedge connection's handshake */
+static int test_lazy_connect_hedge(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  loopback_t *backup = loopback_start(NULL, NULL);
+  if (!backup) {
+    test_server_stop(&ts);
+    return 0;
+  }
+  loopback_delay_handshake(backup, 500);
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.lazy_connect = true;
+  opts.hedge_percentile = 90.0;
+  opts.hedge_port = loopback_port(backup);
+  uint64_t start = now_ms();
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  int ok = client && test_round_trip(client) == SQRL_OK && now_ms() - start < 300;
+  WAIT_UNTIL(loopback_connections(backup) == 1);
+  ok = ok && loopback_connections(backup) == 1;
+
+  /* Joins the connect thread, so the hedge handshake finishes first */
+  sqrl_disconnect(client);
+  loopback_stop(backup);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test striping: a query that returned a large reply moves to the bulk
+ * socket, and stalling it there holds up no other round trip */
+#define BIG_QUERY "db.table(\"big\").run()"
+
+static bool reply_big(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  if (!strstr(request, "table(\\\"big\\\")")) return false;
+  if (atomic_load((atomic_bool *)ts->state)) sleep_ms(300);
+  char pad[2049];
+  memset(pad, 'x', sizeof(pad) - 1);
+  pad[sizeof(pad) - 1] = '\0';
+  char out[2200];
+  snprintf(out, sizeof(out), "{\"type\":\"result\",\"id\":\"%s\",\"data\":[{\"id\":\"a\",\"pad\":\"%s\"}]}", id, pad);
+  loopback_send(conn, out);
+  return true;
+}
+
+static void *big_query_thread(void *arg) {
+  char *result = NULL;
+  sqrl_error_t err = sqrl_query(arg, BIG_QUERY, &result);
+  sqrl_string_free(result);
+  return (void *)(intptr_t)err;
+}
+
+static int test_striped_connections(void) {
+  atomic_bool stall = false;
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_big, &stall)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.connections = 2;
+  opts.bulk_threshold = 1024;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  sqrl_stats_t stats;
+  char *result = NULL;
+  int ok = sqrl_get_stats(client, &stats) == SQRL_OK && stats.connections == 3 &&
+           loopback_connections(ts.loopback) == 3 && stats.bulk_requests == 0 &&
+           sqrl_query(client, BIG_QUERY, &result) == SQRL_OK;
+  sqrl_string_free(result);
+
+  atomic_store(&stall, true);
+  pthread_t thread;
+  pthread_create(&thread, NULL, big_query_thread, client);
+  WAIT_UNTIL(test_server_count(&ts, "table(\\\"big\\\")") == 2);
+  uint64_t start = now_ms();
+  for (int i = 0; ok && i < 10; i++) ok = test_round_trip(client) == SQRL_OK;
+  ok = ok && now_ms() - start < 200;
+  void *stalled = NULL;
+  pthread_join(thread, &stalled);
+  ok = ok && (intptr_t)stalled == SQRL_OK;
+
+  /* A large request goes to the bulk socket whatever its reply */
+  char data[1100];
+  snprintf(data, sizeof(data), "{\"pad\":\"%01080d\"}", 0);
+  sqrl_document_t *doc = NULL;
+  ok = ok && sqrl_insert(client, "users", data, &doc) == SQRL_OK &&
+       sqrl_get_stats(client, &stats) == SQRL_OK && stats.bulk_requests == 2;
+  sqrl_document_free(doc);
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test single-flight reads: identical queries issued while one is in
+ * flight share its reply, and a query issued afterwards goes out again */
+#define COALESCED_THREADS 4
+
+static int test_coalesced_reads(void) {
+  slow_queries_t slow = {200, false};
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_slow_query, &slow)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.coalesce_reads = true;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  pthread_t threads[COALESCED_THREADS];
+  pthread_create(&threads[0], NULL, query_thread, client);
+  WAIT_UNTIL(test_server_count(&ts, "\"type\":\"query\"") == 1);
+  for (int i = 1; i < COALESCED_THREADS; i++) pthread_create(&threads[i], NULL, query_thread, client);
+
+  int ok = 1;
+  for (int i = 0; i < COALESCED_THREADS; i++) {
+    void *err = NULL;
+    pthread_join(threads[i], &err);
+    ok = ok && (intptr_t)err == SQRL_OK;
+  }
+
+  sqrl_stats_t stats;
+  ok = ok && test_server_count(&ts, "\"type\":\"query\"") == 1 && sqrl_get_stats(client, &stats) == SQRL_OK &&
+       stats.coalesced_queries == COALESCED_THREADS - 1 &&
+       test_round_trip(client) == SQRL_OK && test_server_count(&ts, "\"type\":\"query\"") == 2;
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test the result cache: repeats are served locally until a local write
+ * or a change event on the table drops them, and writes to other tables
+ * leave them alone */
+static uint64_t cache_invalidations(sqrl_client_t *client) {
+  sqrl_stats_t stats;
+  return sqrl_get_stats(client, &stats) == SQRL_OK ? stats.cache_invalidations : 0;
+}
+
+static int test_result_cache_invalidation(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.result_cache_ttl_ms = 60000;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  sqrl_document_t *doc = NULL;
+  int ok = test_round_trip(client) == SQRL_OK && test_round_trip(client) == SQRL_OK &&
+           test_server_count(&ts, "\"type\":\"query\"") == 1 && test_server_count(&ts, "\"type\":\"subscribe\"") == 1;
+
+  ok = ok && sqrl_insert(client, "users", "{\"n\":1}", &doc) == SQRL_OK && cache_invalidations(client) == 1 &&
+       test_round_trip(client) == SQRL_OK && test_server_count(&ts, "\"type\":\"query\"") == 2;
+  sqrl_document_free(doc);
+
+  /* A change made elsewhere arrives on the table's feed */
+  test_server_push(&ts, TEST_INSERT("u1"));
+  WAIT_UNTIL(cache_invalidations(client) == 2);
+  ok = ok && cache_invalidations(client) == 2 && test_round_trip(client) == SQRL_OK &&
+       test_server_count(&ts, "\"type\":\"query\"") == 3;
+
+  doc = NULL;
+  sqrl_stats_t stats;
+  ok = ok && sqrl_insert(client, "orders", "{\"n\":1}", &doc) == SQRL_OK && test_round_trip(client) == SQRL_OK &&
+       test_server_count(&ts, "\"type\":\"query\"") == 3 && sqrl_get_stats(client, &stats) == SQRL_OK &&
+       stats.cache_hits == 2 && stats.cache_misses == 3 && stats.cache_invalidations == 2;
+  sqrl_document_free(doc);
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test credit flow control: the subscribe asks for the window, a blocked
+ * callback on the dispatcher doesn't hold up replies, and credits come
+ * back in batches of half the window as callbacks return */
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool open;
+  atomic_int events;
+} gate_t;
+
+static void gated_change(const sqrl_change_event_t *event, void *user_data) {
+  gate_t *gate = user_data;
+  (void)event;
+  pthread_mutex_lock(&gate->mutex);
+  while (!gate->open) pthread_cond_wait(&gate->cond, &gate->mutex);
+  pthread_mutex_unlock(&gate->mutex);
+  atomic_fetch_add(&gate->events, 1);
+}
+
+static int test_credit_flow(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.subscription_credits = 4;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  gate_t gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, 0};
+  sqrl_subscription_t *sub = NULL;
+  int ok = sqrl_subscribe(client, "db.table(\"users\").changes()", gated_change, &gate, &sub) == SQRL_OK &&
+           test_server_count(&ts, "\"credits\":4") == 1;
+  test_server_push(&ts, TEST_INSERT("u1"));
+  test_server_push(&ts, TEST_INSERT("u2"));
+  test_server_push(&ts, TEST_INSERT("u3"));
+  test_server_push(&ts, TEST_INSERT("u4"));
+
+  /* The reader hands events to the dispatcher, so replies keep flowing */
+  sqrl_debug_snapshot_t snap = {0};
+  ok = ok && test_round_trip(client) == SQRL_OK && atomic_load(&gate.events) == 0 &&
+       test_server_count(&ts, "\"type\":\"credit\"") == 0 && sqrl_debug_snapshot(client, &snap) == SQRL_OK &&
+       snap.subscription_count == 1 && snap.subscriptions[0].queue_depth == 4;
+  sqrl_debug_snapshot_free(&snap);
+
+  pthread_mutex_lock(&gate.mutex);
+  gate.open = true;
+  pthread_cond_broadcast(&gate.cond);
+  pthread_mutex_unlock(&gate.mutex);
+  WAIT_UNTIL(test_server_count(&ts, "\"type\":\"credit\"") == 2);
+  ok = ok && atomic_load(&gate.events) == 4 && test_server_count(&ts, "\"credits\":2}") == 2;
+
+  ok = ok && sqrl_unsubscribe(sub) == SQRL_OK;
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  pthread_mutex_destroy(&gate.mutex);
+  pthread_cond_destroy(&gate.cond);
+  return ok;
+}
+
+/* Test change-feed lag: every event lands in the queue and callback
+ * histograms, and only events with a commit time in network and total */
+static void slow_change(const sqrl_change_event_t *event, void *user_data) {
+  (void)event;
+  sleep_ms(20);
+  atomic_fetch_add((atomic_int *)user_data, 1);
+}
+
+static int test_feed_lag(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  atomic_int events = 0;
+  sqrl_subscription_t *sub = NULL;
+  int ok = sqrl_subscribe(client, "db.table(\"users\").changes()", slow_change, &events, &sub) == SQRL_OK;
+
+  /* Committed a second ago by the server's clock */
+  time_t committed = time(NULL) - 1;
+  struct tm tm;
+  gmtime_r(&committed, &tm);
+  char stamp[32], change[256];
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+  snprintf(change, sizeof(change),
+           "{\"type\":\"insert\",\"committed_at\":\"%s\",\"new\":{\"id\":\"u1\",\"collection\":\"users\",\"data\":{}}}", stamp);
+  test_server_push(&ts, change);
+  test_server_push(&ts, change);
+  test_server_push(&ts, TEST_INSERT("u2"));
+
+  /* The histograms are updated after the callbacks return */
+  sqrl_subscription_stats_t stats = {0};
+  WAIT_UNTIL(sqrl_subscription_get_stats(sub, &stats) == SQRL_OK && stats.events == 3);
+  ok = ok && atomic_load(&events) == 3 && stats.events == 3 && stats.queue.count == 3 && stats.callback.count == 3 && stats.callback.sum_us >= 3 * 20000 &&
+       stats.network.count == 2 && stats.network.sum_us >= 2 * 1000000 && stats.network.sum_us < 2 * 3000000 &&
+       stats.total.count == 2 && stats.total.sum_us >= stats.network.sum_us + 2 * 20000;
+
+  ok = ok && sqrl_unsubscribe(sub) == SQRL_OK;
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test a multi-collection stream: the collection set is sent sorted and
+ * deduplicated, so equal sets share one feed, and each event names the
+ * collection it came from */
+static void record_collection(const sqrl_change_event_t *event, void *user_data) {
+  recorder_t *r = user_data;
+  pthread_mutex_lock(&r->mutex);
+  if (r->count < MAX_RECORDED) {
+    snprintf(r->events[r->count++], sizeof(r->events[0]), "%s:%s", change_name(event->type),
+             event->collection ? event->collection : "-");
+  }
+  pthread_mutex_unlock(&r->mutex);
+}
+
+static int test_collection_stream(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  static const char *const first_set[] = {"users", "orders", "users"};
+  static const char *const second_set[] = {"orders", "users"};
+  recorder_t r = {&ts, client, false, SQRL_OK, PTHREAD_MUTEX_INITIALIZER, {{0}}, 0};
+  sqrl_subscription_t *a = NULL, *b = NULL, *all = NULL;
+  int ok = sqrl_subscribe_collections(client, first_set, 3, record_collection, &r, &a) == SQRL_OK &&
+           sqrl_subscribe_collections(client, second_set, 2, ignore_change, NULL, &b) == SQRL_OK &&
+           test_server_count(&ts, "\"type\":\"subscribe\"") == 1 &&
+           test_server_count(&ts, "tables\\\":[\\\"orders\\\",\\\"users\\\"]") == 1 &&
+           strcmp(sqrl_subscription_id(a), sqrl_subscription_id(b)) == 0;
+
+  /* The change's own tag wins over its document's */
+  test_server_push(&ts, TEST_INSERT("u1"));
+  test_server_push(&ts, "{\"type\":\"delete\",\"old\":{\"id\":\"o1\",\"collection\":\"orders\",\"data\":{}}}");
+  test_server_push(&ts, "{\"type\":\"insert\",\"collection\":\"orders\",\"new\":{\"id\":\"o2\",\"data\":{}}}");
+  WAIT_UNTIL(recorded_count(&r) == 3);
+  ok = ok && recorded(&r, 0, "insert:users") && recorded(&r, 1, "delete:orders") && recorded(&r, 2, "insert:orders");
+
+  ok = ok && sqrl_subscribe_collections(client, NULL, 0, ignore_change, NULL, &all) == SQRL_OK &&
+       test_server_count(&ts, "tables\\\":[\\\"*\\\"]") == 1;
+
+  ok = ok && sqrl_unsubscribe(all) == SQRL_OK && sqrl_unsubscribe(b) == SQRL_OK && sqrl_unsubscribe(a) == SQRL_OK;
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  pthread_mutex_destroy(&r.mutex);
+  return ok;
+}
+
+/* Test multi-query round trips: one batch frame, a result or an error per
+ * query, and a short reply failing every entry */
+static bool reply_batch(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  if (!strstr(request, "\"type\":\"batch\"")) return false;
+  char out[512];
+  snprintf(out, sizeof(out),
+           "{\"type\":\"result\",\"id\":\"%s\",\"data\":[{\"type\":\"result\",\"data\":[1]},"
+           "{\"type\":\"error\",\"error\":\"table not found\"}%s]}",
+           id, atomic_load((atomic_bool *)ts->state) ? "" : ",{\"type\":\"result\",\"data\":{\"count\":2}}");
+  loopback_send(conn, out);
+  return true;
+}
+
+static int test_query_many_round_trip(void) {
+  atomic_bool short_reply = false;
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_batch, &short_reply)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  static const char *const queries[] = {
+    "db.table(\"users\").run()", "db.table(\"missing\").run()", "db.table(\"users\").count().run()",
+  };
+  sqrl_query_result_t results[3];
+  int ok = sqrl_query_many(client, queries, 3, results) == SQRL_OK && test_server_count(&ts, "\"type\":\"batch\"") == 1 &&
+           test_server_count(&ts, "\"type\":\"query\"") == 0 && test_server_count(&ts, "table(\\\"missing\\\")") == 1 &&
+           results[0].error == SQRL_OK && strcmp(results[0].result, "[1]") == 0 &&
+           results[1].error == SQRL_ERR_NOT_FOUND && !results[1].result &&
+           results[2].error == SQRL_OK && strcmp(results[2].result, "{\"count\":2}") == 0;
+  sqrl_query_results_free(results, 3);
+
+  atomic_store(&short_reply, true);
+  ok = ok && sqrl_query_many(client, queries, 3, results) == SQRL_ERR_DECODE &&
+       results[0].error == SQRL_ERR_DECODE && !results[0].result && results[2].error == SQRL_ERR_DECODE;
+  sqrl_query_results_free(results, 3);
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test compare-and-set updates against a versioned document: a stale
+ * version conflicts and returns the current copy, retrying with that copy's
+ * version applies */
+typedef struct {
+  atomic_int version;
+  atomic_bool send_current;  /* Include the document in conflict replies */
+} versioned_doc_t;
+
+static bool reply_versioned(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  versioned_doc_t *doc = ts->state;
+  const char *cond = strstr(request, "\"if_version\":");
+  if (!cond) return false;
+
+  char out[512];
+  int version = atomic_load(&doc->version);
+  if (strtol(cond + 13, NULL, 10) == version) {
+    atomic_store(&doc->version, ++version);
+    snprintf(out, sizeof(out),
+             "{\"type\":\"result\",\"id\":\"%s\",\"data\":{\"id\":\"a\",\"collection\":\"users\",\"data\":{},\"version\":%d}}",
+             id, version);
+  } else if (atomic_load(&doc->send_current)) {
+    snprintf(out, sizeof(out),
+             "{\"type\":\"error\",\"id\":\"%s\",\"error\":\"version conflict\","
+             "\"document\":{\"id\":\"a\",\"collection\":\"users\",\"data\":{},\"version\":%d}}",
+             id, version);
+  } else {
+    snprintf(out, sizeof(out), "{\"type\":\"error\",\"id\":\"%s\",\"error\":\"version conflict\"}", id);
+  }
+  loopback_send(conn, out);
+  return true;
+}
+
+static int test_update_if_conflict(void) {
+  versioned_doc_t stored = {3, true};
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_versioned, &stored)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  sqrl_document_t *current = NULL, *updated = NULL;
+  int ok = sqrl_update_if(client, "users", "a", "{\"n\":1}", 2, &current) == SQRL_ERR_CONFLICT &&
+           current && current->version == 3 && atomic_load(&stored.version) == 3 &&
+           sqrl_update_if(client, "users", "a", "{\"n\":1}", current->version, &updated) == SQRL_OK &&
+           updated && updated->version == 4 && test_server_count(&ts, "\"if_version\":3,") == 1;
+  sqrl_document_free(current);
+  sqrl_document_free(updated);
+
+  current = NULL;
+  atomic_store(&stored.send_current, false);
+  ok = ok && sqrl_update_if(client, "users", "a", "{\"n\":1}", 3, &current) == SQRL_ERR_CONFLICT && !current &&
+       sqrl_update_if(client, "users", "a", "{\"n\":1}", 3, NULL) == SQRL_ERR_CONFLICT &&
+       atomic_load(&stored.version) == 4;
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test each ack mode goes out on the wire under the id handed back, that
+ * SQRL_ACK_NONE returns without a reply, and that during a lazy connect an
+ * unacknowledged insert is queued asking for a queued ack instead */
+static bool reply_unacked(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  (void)ts;
+  (void)conn;
+  (void)id;
+  return strstr(request, "\"ack\":\"none\"") != NULL;
+}
+
+static int count_ack(test_server_t *ts, const char *doc_id, const char *ack) {
+  char needle[128];
+  snprintf(needle, sizeof(needle), "\"document_id\":\"%s\",\"ack\":\"%s\"", doc_id, ack);
+  return test_server_count(ts, needle);
+}
+
+static int test_insert_ack_modes(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_unacked, NULL)) return 0;
+
+  sqrl_options_t opts = sqrl_options_default();
+  opts.request_timeout_ms = 1000;
+  sqrl_client_t *client = test_connect(&ts, &opts);
+  if (!client) {
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  char durable[SQRL_ID_SIZE], queued[SQRL_ID_SIZE], none[SQRL_ID_SIZE];
+  int ok = sqrl_insert_ack(client, "users", "{\"n\":1}", SQRL_ACK_DURABLE, durable) == SQRL_OK &&
+           strlen(durable) == SQRL_ID_SIZE - 1 && count_ack(&ts, durable, "durable") == 1 &&
+           sqrl_insert_ack(client, "users", "{\"n\":2}", SQRL_ACK_QUEUED, queued) == SQRL_OK &&
+           strcmp(queued, durable) != 0 && count_ack(&ts, queued, "queued") == 1;
+
+  /* The server never answers, so waiting for it would time out */
+  uint64_t start = now_ms();
+  ok = ok && sqrl_insert_ack(client, "users", "{\"n\":3}", SQRL_ACK_NONE, none) == SQRL_OK &&
+       now_ms() - start < 500;
+  WAIT_UNTIL(count_ack(&ts, none, "none") == 1);
+  ok = ok && count_ack(&ts, none, "none") == 1 && test_server_count(&ts, "\"data\":{\"n\":3}") == 1;
+  sqrl_disconnect(client);
+
+  /* Nothing can be written before the handshake, so the frame is parked
+   * and asks for a reply that is then discarded */
+  loopback_delay_handshake(ts.loopback, 200);
+  opts.lazy_connect = true;
+  client = ok ? test_connect(&ts, &opts) : NULL;
+  start = now_ms();
+  ok = client && sqrl_insert_ack(client, "users", "{\"n\":4}", SQRL_ACK_NONE, none) == SQRL_OK &&
+       now_ms() - start < 100 && !sqrl_is_connected(client);
+  WAIT_UNTIL(count_ack(&ts, none, "queued") == 1);
+  ok = ok && count_ack(&ts, none, "queued") == 1 && count_ack(&ts, none, "none") == 0 &&
+       sqrl_insert_ack(client, "users", "{\"n\":5}", SQRL_ACK_DURABLE, durable) == SQRL_OK &&
+       count_ack(&ts, durable, "durable") == 1;
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test the server dropping the connection while threads submit async
+ * requests: each one is reported exactly once, by its callback or by the
+ * error its submit returned, never both */
+#define DROP_THREADS  4
+#define DROP_REQUESTS 4000
+
+typedef struct {
+  sqrl_client_t *client;
+  atomic_int reports[DROP_REQUESTS];
+} drop_worker_t;
+
+static bool reply_drop(test_server_t *ts, loopback_conn_t *conn, const char *request, const char *id) {
+  (void)id;
+  if (!strstr(request, "\"type\":\"query\"")) return false;
+  if (atomic_fetch_add((atomic_int *)ts->state, 1) == 500) loopback_drop(conn);
+  return false;
+}
+
+static void count_report(sqrl_error_t err, char *result, void *user_data) {
+  (void)err;
+  sqrl_string_free(result);
+  atomic_fetch_add((atomic_int *)user_data, 1);
+}
+
+static void *drop_worker(void *arg) {
+  drop_worker_t *w = arg;
+  for (int i = 0; i < DROP_REQUESTS; i++) {
+    if (sqrl_query_async(w->client, "db.table(\"users\").run()", count_report, &w->reports[i]) != SQRL_OK) {
+      atomic_fetch_add(&w->reports[i], 1);
+    }
+  }
+  return NULL;
+}
+
+static int test_drop_during_async(void) {
+  atomic_int seen = 0;
+  test_server_t ts;
+  if (!test_server_start(&ts, reply_drop, &seen)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  drop_worker_t *workers = calloc(DROP_THREADS, sizeof(drop_worker_t));
+  if (!client || !workers) {
+    sqrl_disconnect(client);
+    free(workers);
+    test_server_stop(&ts);
+    return 0;
+  }
+
+  pthread_t threads[DROP_THREADS];
+  for (int t = 0; t < DROP_THREADS; t++) {
+    workers[t].client = client;
+    pthread_create(&threads[t], NULL, drop_worker, &workers[t]);
+  }
+  for (int t = 0; t < DROP_THREADS; t++) pthread_join(threads[t], NULL);
+
+  int ok = atomic_load(&seen) > 500;
+  for (int t = 0; ok && t < DROP_THREADS; t++) {
+    for (int i = 0; ok && i < DROP_REQUESTS; i++) {
+      WAIT_UNTIL(atomic_load(&workers[t].reports[i]) > 0);
+      ok = atomic_load(&workers[t].reports[i]) == 1;
+    }
+  }
+  sqrl_disconnect(client);
+  for (int t = 0; ok && t < DROP_THREADS; t++) {
+    for (int i = 0; ok && i < DROP_REQUESTS; i++) ok = atomic_load(&workers[t].reports[i]) == 1;
+  }
+
+  free(workers);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test a shard group: each worker thread gets its own shard's client, and
+ * posted tasks run on the target shard, in posting order, when its owner
+ * polls */
+#define SHARDS      3
+#define SHARD_TASKS 5
+
+typedef struct {
+  sqrl_shards_t *shards;
+  int index;
+  sqrl_client_t *client;
+  bool attached;
+  bool round_trip;
+  bool exclusive;
+  size_t polled;
+  int ran;
+  int order[SHARD_TASKS];
+  bool on_target;
+} shard_worker_t;
+
+typedef struct {
+  shard_worker_t *worker;
+  int seq;
+} shard_job_t;
+
+static void run_shard_job(sqrl_client_t *client, void *user_data) {
+  shard_job_t *job = user_data;
+  shard_worker_t *w = job->worker;
+  if (w->ran < SHARD_TASKS) w->order[w->ran] = job->seq;
+  w->ran++;
+  w->on_target = w->on_target && client == w->client && sqrl_shard_index(w->shards) == w->index &&
+                 sqrl_shard_client(w->shards) == client;
+}
+
+static void *shard_worker(void *arg) {
+  shard_worker_t *w = arg;
+  w->attached = sqrl_shards_attach(w->shards, w->index, false) == SQRL_OK;
+  if (!w->attached) return NULL;
+  w->client = sqrl_shard_client(w->shards);
+  w->round_trip = w->client && test_round_trip(w->client) == SQRL_OK;
+
+  /* One shard per thread, and no stealing another thread's */
+  w->exclusive = sqrl_shards_attach(w->shards, (w->index + 1) % SHARDS, false) == SQRL_ERR_INVALID_ARG &&
+                 sqrl_shard_index(w->shards) == w->index;
+
+  uint64_t deadline = now_ms() + 2000;
+  while (w->ran < SHARD_TASKS && now_ms() < deadline) {
+    w->polled += sqrl_shards_poll(w->shards);
+    sleep_ms(1);
+  }
+  sqrl_shards_detach(w->shards);
+  return NULL;
+}
+
+static int test_shards_loopback(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+
+  sqrl_shards_t *shards = NULL;
+  if (sqrl_shards_connect(&shards, "127.0.0.1", loopback_port(ts.loopback), NULL, SHARDS) != SQRL_OK) {
+    test_server_stop(&ts);
+    return 0;
+  }
+  int ok = sqrl_shards_count(shards) == SHARDS && loopback_connections(ts.loopback) == SHARDS &&
+           sqrl_shard_client(shards) == NULL && sqrl_shard_index(shards) == -1 && sqrl_shards_poll(shards) == 0;
+
+  /* Posted before the owners attach; interleaved so each inbox sees its
+   * tasks among the others' */
+  shard_worker_t workers[SHARDS];
+  shard_job_t jobs[SHARDS][SHARD_TASKS];
+  memset(workers, 0, sizeof(workers));
+  for (int i = 0; i < SHARDS; i++) {
+    workers[i].shards = shards;
+    workers[i].index = i;
+    workers[i].on_target = true;
+  }
+  for (int seq = 0; ok && seq < SHARD_TASKS; seq++) {
+    for (int i = 0; ok && i < SHARDS; i++) {
+      jobs[i][seq] = (shard_job_t){&workers[i], seq};
+      ok = sqrl_shards_post(shards, i, run_shard_job, &jobs[i][seq]) == SQRL_OK;
+    }
+  }
+
+  pthread_t threads[SHARDS];
+  for (int i = 0; ok && i < SHARDS; i++) pthread_create(&threads[i], NULL, shard_worker, &workers[i]);
+  for (int i = 0; ok && i < SHARDS; i++) pthread_join(threads[i], NULL);
+
+  for (int i = 0; ok && i < SHARDS; i++) {
+    shard_worker_t *w = &workers[i];
+    ok = w->attached && w->round_trip && w->exclusive && w->on_target &&
+         w->ran == SHARD_TASKS && w->polled == SHARD_TASKS;
+    for (int seq = 0; ok && seq < SHARD_TASKS; seq++) ok = w->order[seq] == seq;
+    for (int j = 0; ok && j < i; j++) ok = workers[j].client != w->client;
+  }
+
+  sqrl_stats_t stats;
+  sqrl_shards_get_stats(shards, &stats);
+  ok = ok && stats.connections == SHARDS && stats.requests_completed >= SHARDS;
+
+  sqrl_shards_disconnect(shards);
+  test_server_stop(&ts);
+  return ok;
+}
+
+/* Test a live client's metrics: every sample carries the labels, and the
+ * latency histogram is cumulative, ends in +Inf and agrees with _count */
+#define LATENCY_METRIC "sqrl_client_request_latency_seconds"
+
+static int test_metrics_render_client(void) {
+  test_server_t ts;
+  if (!test_server_start(&ts, NULL, NULL)) return 0;
+  sqrl_client_t *client = test_connect(&ts, NULL);
+  int ok = client != NULL;
+  for (int i = 0; ok && i < 5; i++) ok = test_round_trip(client) == SQRL_OK;
+
+  sqrl_stats_t stats;
+  static char buf[16384];
+  size_t len = 0;
+  ok = ok && sqrl_get_stats(client, &stats) == SQRL_OK && stats.latency_count >= 5 &&
+       sqrl_metrics_render(client, NULL, "service=\"orders\"", buf, sizeof(buf), &len) == SQRL_OK &&
+       len == strlen(buf) && len > 6 && strcmp(buf + len - 6, "# EOF\n") == 0;
+
+  char expected[128];
+  snprintf(expected, sizeof(expected), "\nsqrl_client_requests_completed_total{service=\"orders\"} %llu\n",
+           (unsigned long long)stats.requests_completed);
+  ok = ok && strstr(buf, "\nsqrl_client_connected{service=\"orders\"} 1\n") && strstr(buf, expected);
+
+  /* Walk the samples: labels on each, buckets never decreasing */
+  uint64_t last_bucket = 0, inf_bucket = 0, count = 0;
+  int buckets = 0;
+  bool saw_inf = false;
+  const char *bucket_prefix = LATENCY_METRIC "_bucket{service=\"orders\",le=\"";
+  const char *count_prefix = LATENCY_METRIC "_count{service=\"orders\"} ";
+  for (const char *line = buf; ok && *line; line = strchr(line, '\n') + 1) {
+    if (*line == '#') continue;
+    const char *brace = strchr(line, '{');
+    ok = brace && brace < strchr(line, '\n') && strncmp(brace, "{service=\"orders\"", 17) == 0;
+    if (ok && strncmp(line, bucket_prefix, strlen(bucket_prefix)) == 0) {
+      const char *le = line + strlen(bucket_prefix);
+      uint64_t value = strtoull(strstr(le, "} ") + 2, NULL, 10);
+      ok = !saw_inf && value >= last_bucket;
+      last_bucket = value;
+      buckets++;
+      if (strncmp(le, "+Inf\"", 5) == 0) {
+        saw_inf = true;
+        inf_bucket = value;
+      }
+    } else if (ok && strncmp(line, count_prefix, strlen(count_prefix)) == 0) {
+      count = strtoull(line + strlen(count_prefix), NULL, 10);
+    }
+  }
+  ok = ok && buckets == SQRL_LATENCY_BUCKETS && saw_inf && inf_bucket == count && count == stats.latency_count;
+
+  /* Without labels there are no empty braces */
+  ok = ok && sqrl_metrics_render(client, NULL, "", buf, sizeof(buf), &len) == SQRL_OK &&
+       strstr(buf, "\nsqrl_client_connected 1\n") && strstr(buf, "{le=\"+Inf\"}") && !strstr(buf, "{}");
+
+  /* Too small: reports the size the full output needs */
+  size_t needed = len;
+  ok = ok && sqrl_metrics_render(client, NULL, "", buf, 64, &len) == SQRL_ERR_ENCODE && len == needed;
+
+  sqrl_disconnect(client);
+  test_server_stop(&ts);
+  return ok;
+}
+
 int main(void) {
   printf("SquirrelDB C SDK Tests\n");
   printf("======================\n\n");
@@ -258,6 +2098,9 @@ int main(void) {
   RUN_TEST(test_connect_null_client);
   RUN_TEST(test_connect_null_host);
   RUN_TEST(test_connect_refused);
+  RUN_TEST(test_lazy_connect_refused);
+  RUN_TEST(test_resolver_cache);
+  RUN_TEST(test_shards_errors);
 
   printf("\nNULL Safety:\n");
   RUN_TEST(test_document_free_null);
@@ -266,6 +2109,56 @@ int main(void) {
   RUN_TEST(test_string_array_free_null);
   RUN_TEST(test_is_connected_null);
   RUN_TEST(test_session_id_null);
+  RUN_TEST(test_get_stats_null);
+  RUN_TEST(test_async_null_args);
+  RUN_TEST(test_debug_snapshot_null_args);
+  RUN_TEST(test_subscription_stats_null);
+  RUN_TEST(test_subscribe_collections_null_args);
+  RUN_TEST(test_query_many_null_args);
+  RUN_TEST(test_insert_ack_null_args);
+  RUN_TEST(test_update_if_null_args);
+
+  printf("\nDocument Ids:\n");
+  RUN_TEST(test_generate_id);
+
+  printf("\nQuery Builder:\n");
+  RUN_TEST(test_query_select_changes);
+  RUN_TEST(test_query_select_limits);
+  RUN_TEST(test_subscribe_query_null_args);
+  RUN_TEST(test_patch_compile);
+  RUN_TEST(test_bulk_write_null_args);
+  RUN_TEST(test_query_double_filters);
+  RUN_TEST(test_query_count_modes);
+
+  printf("\nLoopback:\n");
+  RUN_TEST(test_unsubscribe_in_callback);
+  RUN_TEST(test_feed_sharing);
+  RUN_TEST(test_count_keeps_builder);
+  RUN_TEST(test_subscribe_query_keeps_builder);
+  RUN_TEST(test_hedged_query_limits);
+  RUN_TEST(test_lazy_connect_order);
+  RUN_TEST(test_bulk_write_table);
+  RUN_TEST(test_update_patch_round_trip);
+  RUN_TEST(test_document_timestamps);
+  RUN_TEST(test_write_batching);
+  RUN_TEST(test_hedged_read);
+  RUN_TEST(test_lazy_connect_warmup);
+  RUN_TEST(test_lazy_connect_hedge);
+  RUN_TEST(test_striped_connections);
+  RUN_TEST(test_coalesced_reads);
+  RUN_TEST(test_result_cache_invalidation);
+  RUN_TEST(test_credit_flow);
+  RUN_TEST(test_feed_lag);
+  RUN_TEST(test_collection_stream);
+  RUN_TEST(test_query_many_round_trip);
+  RUN_TEST(test_update_if_conflict);
+  RUN_TEST(test_insert_ack_modes);
+  RUN_TEST(test_drop_during_async);
+  RUN_TEST(test_shards_loopback);
+
+  printf("\nMetrics:\n");
+  RUN_TEST(test_metrics_render_empty);
+  RUN_TEST(test_metrics_render_client);
 
   printf("\n======================\n");
   printf("Results: %d/%d tests passed\n", tests_passed, tests_run);